@@ -7,6 +7,8 @@
  */
  
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <buddy-alloc.h>
 
 #define BIT_ARRAY_NUM_BITS (8 * sizeof(unsigned long int))
@@ -39,31 +41,89 @@ static inline void bit_array_not(unsigned long int *bit_array, unsigned long int
 		bit_array[array_index] |= bit_value;
 }
 
+static inline void bit_array_set_range(unsigned long int *bit_array, unsigned long int index, unsigned long int count)
+{
+	unsigned long int array_index = index >> BIT_ARRAY_INDEX_SHIFT;
+	unsigned long int first_bit = index & BIT_ARRAY_INDEX_MASK;
+
+	/* Leading partial word */
+	if (first_bit + count < BIT_ARRAY_NUM_BITS) {
+		bit_array[array_index] |= ((1UL << count) - 1UL) << first_bit;
+		return;
+	}
+	bit_array[array_index++] |= ~0UL << first_bit;
+	count -= BIT_ARRAY_NUM_BITS - first_bit;
+
+	/* Whole words */
+	for (; count >= BIT_ARRAY_NUM_BITS; count -= BIT_ARRAY_NUM_BITS)
+		bit_array[array_index++] = ~0UL;
+
+	/* Trailing partial word */
+	if (count)
+		bit_array[array_index] |= (1UL << count) - 1UL;
+}
+
+static inline void bit_array_clear_range(unsigned long int *bit_array, unsigned long int index, unsigned long int count)
+{
+	unsigned long int array_index = index >> BIT_ARRAY_INDEX_SHIFT;
+	unsigned long int first_bit = index & BIT_ARRAY_INDEX_MASK;
+
+	/* Leading partial word */
+	if (first_bit + count < BIT_ARRAY_NUM_BITS) {
+		bit_array[array_index] &= ~(((1UL << count) - 1UL) << first_bit);
+		return;
+	}
+	bit_array[array_index++] &= ~(~0UL << first_bit);
+	count -= BIT_ARRAY_NUM_BITS - first_bit;
+
+	/* Whole words */
+	for (; count >= BIT_ARRAY_NUM_BITS; count -= BIT_ARRAY_NUM_BITS)
+		bit_array[array_index++] = 0;
+
+	/* Trailing partial word */
+	if (count)
+		bit_array[array_index] &= ~((1UL << count) - 1UL);
+}
+
 static inline void list_init(buddy_block_info_t *list)
 {
-	list->next = list;
-	list->prev = list;
+	BUDDY_SET_POINTER(list, next, list);
+	BUDDY_SET_POINTER(list, prev, list);
 }
 
 static inline void list_add(buddy_block_info_t *list, buddy_block_info_t *node)
 {
-	node->next = list;
-	node->prev = list->prev;
-	list->prev->next = node;
-	list->prev = node;
+	buddy_block_info_t *prev = BUDDY_GET_POINTER(list, prev);
+
+	BUDDY_SET_POINTER(node, next, list);
+	BUDDY_SET_POINTER(node, prev, prev);
+	BUDDY_SET_POINTER(prev, next, node);
+	BUDDY_SET_POINTER(list, prev, node);
 }
 
 static inline void list_remove(buddy_block_info_t *list)
 {
-	list->next->prev = list->prev;
-	list->prev->next = list->next;
-	list->next = list;
-	list->prev = list;
+	buddy_block_info_t *next = BUDDY_GET_POINTER(list, next);
+	buddy_block_info_t *prev = BUDDY_GET_POINTER(list, prev);
+
+	BUDDY_SET_POINTER(next, prev, prev);
+	BUDDY_SET_POINTER(prev, next, next);
+	list_init(list);
+}
+
+static inline void list_push(buddy_block_info_t *list, buddy_block_info_t *node)
+{
+	buddy_block_info_t *next = BUDDY_GET_POINTER(list, next);
+
+	BUDDY_SET_POINTER(node, next, next);
+	BUDDY_SET_POINTER(node, prev, list);
+	BUDDY_SET_POINTER(next, prev, node);
+	BUDDY_SET_POINTER(list, next, node);
 }
 
 static inline bool list_empty(buddy_block_info_t *list)
 {
-	return list->next == list;
+	return BUDDY_GET_POINTER(list, next) == list;
 }
 
 static inline buddy_block_info_t *list_pop(buddy_block_info_t *list)
@@ -71,294 +131,1659 @@ static inline buddy_block_info_t *list_pop(buddy_block_info_t *list)
 	buddy_block_info_t *front = NULL;
 	if (!list_empty(list))
 	{
-		front = list->next;
+		front = BUDDY_GET_POINTER(list, next);
 		list_remove(front);
 	}
 	return front;
 }
 
-static inline unsigned int long size_to_level(const buddy_allocator_t *allocator, size_t size)
+static inline void *base_of(const buddy_allocator_t *allocator)
 {
-	/* Floor on the minimum allocation size */
-	if (size < allocator->min_allocation)
-		return allocator->max_level;
+	return BUDDY_GET_POINTER(allocator, address);
+}
 
-	/* Round up to next power of two */
-	size = 1 << (BUDDY_NUM_BITS - __builtin_clzl(size - 1));
+static inline unsigned long int index_of(const buddy_allocator_t *allocator, const void *ptr, unsigned long int level)
+{
+	return (1UL << level) + ((ptr - base_of(allocator)) >> (allocator->total_levels - level)) - 1UL;
+}
 
-	/* Delta between the number of levels and the first set bit in the size */
-	/* TODO simplify with size rounding */
-	return allocator->total_levels - BUDDY_ILOG2(size);
+static inline void *address_of(const buddy_allocator_t *allocator, unsigned long int index, unsigned long int level)
+{
+	return base_of(allocator) + ((index - ((1UL << level) - 1UL)) << (allocator->total_levels - level));
 }
 
-static inline unsigned long int index_of(const buddy_allocator_t *allocator, const void *ptr, unsigned long int level)
+#if defined(BUDDY_OUT_OF_BAND_METADATA) || defined(BUDDY_ADDRESS_ORDERED)
+
+static inline unsigned long int free_map_find(const buddy_allocator_t *allocator, unsigned long int level, unsigned long int from)
+{
+	const unsigned long int *free_map = BUDDY_GET_POINTER(allocator, free_map);
+	const unsigned long int *free_summary = BUDDY_GET_POINTER(allocator, free_summary);
+	unsigned long int last = (2UL << level) - 2UL;
+	unsigned long int last_word = last >> BIT_ARRAY_INDEX_SHIFT;
+	unsigned long int array_index = from >> BIT_ARRAY_INDEX_SHIFT;
+	unsigned long int word = free_map[array_index] & (~0UL << (from & BIT_ARRAY_INDEX_MASK));
+	unsigned long int summary_index;
+	unsigned long int summary;
+
+	/* Past the word holding from, the summary skips 64 empty words at a time to the next one with a free block */
+	if (!word) {
+		if (++array_index > last_word)
+			return ~0UL;
+		summary_index = array_index >> BIT_ARRAY_INDEX_SHIFT;
+		summary = free_summary[summary_index] & (~0UL << (array_index & BIT_ARRAY_INDEX_MASK));
+		while (!summary) {
+			if (++summary_index > (last_word >> BIT_ARRAY_INDEX_SHIFT))
+				return ~0UL;
+			summary = free_summary[summary_index];
+		}
+		array_index = (summary_index << BIT_ARRAY_INDEX_SHIFT) + __builtin_ctzl(summary);
+		if (array_index > last_word)
+			return ~0UL;
+		word = free_map[array_index];
+	}
+
+	/* Make sure we did not run into the next level */
+	from = (array_index << BIT_ARRAY_INDEX_SHIFT) + __builtin_ctzl(word);
+	return from <= last ? from : ~0UL;
+}
+
+static inline void free_map_set(buddy_allocator_t *allocator, unsigned long int index)
 {
-	return (1UL << level) + ((ptr - allocator->address) >> (allocator->total_levels - level)) - 1UL;
+	bit_array_set(BUDDY_GET_POINTER(allocator, free_map), index);
+	bit_array_set(BUDDY_GET_POINTER(allocator, free_summary), index >> BIT_ARRAY_INDEX_SHIFT);
 }
 
-static inline unsigned long int free_index(const buddy_allocator_t *allocator, unsigned long int index)
+static inline void free_map_clear(buddy_allocator_t *allocator, unsigned long int index)
 {
-	return (index - 1) >> 1;
+	/* The summary bit goes with the last free block of its word */
+	bit_array_clear(BUDDY_GET_POINTER(allocator, free_map), index);
+	if (!BUDDY_GET_POINTER(allocator, free_map)[index >> BIT_ARRAY_INDEX_SHIFT])
+		bit_array_clear(BUDDY_GET_POINTER(allocator, free_summary), index >> BIT_ARRAY_INDEX_SHIFT);
 }
 
-static inline unsigned long int split_index(const buddy_allocator_t *allocator, unsigned long int index)
+static inline void free_map_add(buddy_allocator_t *allocator, unsigned long int level, void *block)
 {
-	return index + (allocator->max_indexes >> 1);
+	unsigned long int index = index_of(allocator, block, level);
+
+	/* Mark the block free and pull the search hint back if needed */
+	free_map_set(allocator, index);
+	if (index < BUDDY_GET_POINTER(allocator, free_hints)[level])
+		BUDDY_GET_POINTER(allocator, free_hints)[level] = index;
 }
 
-static inline void *to_buddy(const buddy_allocator_t *allocator, const void *ptr, unsigned long int level)
+static inline void *free_map_take(buddy_allocator_t *allocator, unsigned long int level)
 {
-#ifdef BUDDY_MEMORY_ALIGNED_ON_SIZE
-	return (void *)((unsigned long int)ptr ^ (allocator->size >> level));
-#else
-	return ((ptr - allocator->address) ^ (allocator->size >> level)) + allocator->address;
+	/* Everything below the hint is known to be clear, so this takes the lowest addressed free block */
+	unsigned long int index = free_map_find(allocator, level, BUDDY_GET_POINTER(allocator, free_hints)[level]);
+
+	free_map_clear(allocator, index);
+	BUDDY_GET_POINTER(allocator, free_hints)[level] = index;
+
+	return address_of(allocator, index, level);
+}
+
 #endif
+
+#ifdef BUDDY_OUT_OF_BAND_METADATA
+
+static inline void free_block_add(buddy_allocator_t *allocator, unsigned long int level, void *block)
+{
+	free_map_add(allocator, level, block);
+
+	allocator->free_levels |= (1UL << level);
+	BUDDY_GET_POINTER(allocator, free_counts)[level] += 1;
+	allocator->available += allocator->size >> level;
 }
 
-static void *buddy_alloc_from_level(buddy_allocator_t *allocator, unsigned long int level)
+static inline void free_block_remove(buddy_allocator_t *allocator, unsigned long int level, void *block)
 {
-	long int block_at_level;
-	long int index;
-	buddy_block_info_t *block_ptr = 0;
-	buddy_block_info_t *buddy_block_ptr = 0;
+	free_map_clear(allocator, index_of(allocator, block, level));
 
-	/* Search backwards up the levels */
-	for (block_at_level = level; block_at_level >= 0; --block_at_level) {
-		if (!list_empty(&allocator->free_blocks[block_at_level])) {
-			block_ptr = list_pop(&allocator->free_blocks[block_at_level]);
-			break;
-		}
-	}
+	if (--BUDDY_GET_POINTER(allocator, free_counts)[level] == 0)
+		allocator->free_levels &= ~(1UL << level);
+	allocator->available -= allocator->size >> level;
+}
 
-	/* Did we find a block? */
-	if (!block_ptr)
-		return block_ptr;
+static inline void *free_block_pop(buddy_allocator_t *allocator, unsigned long int level)
+{
+	void *block = free_map_take(allocator, level);
 
-	/* Calculate the index of the block found */
-	index = index_of(allocator, block_ptr, block_at_level);
+	if (--BUDDY_GET_POINTER(allocator, free_counts)[level] == 0)
+		allocator->free_levels &= ~(1UL << level);
+	allocator->available -= allocator->size >> level;
+
+	return block;
+}
+
+static inline void *free_block_first(const buddy_allocator_t *allocator, unsigned long int level)
+{
+	unsigned long int index;
 
-	/* Do we need to split blocks? */
-	if (block_at_level != level) {
+	if (!BUDDY_GET_POINTER(allocator, free_counts)[level])
+		return 0;
 
-		/* Split the block until we reach the requested level */
-		while (block_at_level < level) {
+	index = free_map_find(allocator, level, BUDDY_GET_POINTER(allocator, free_hints)[level]);
+	return address_of(allocator, index, level);
+}
 
-			/* Mark block as split */
-			bit_array_set(allocator->block_index, split_index(allocator, index));
+static inline void *free_block_next(const buddy_allocator_t *allocator, unsigned long int level, void *block)
+{
+	unsigned long int index = free_map_find(allocator, level, index_of(allocator, block, level) + 1UL);
 
-			/* Mark as allocated, level zero does not use a allocation flags */
-			if (block_at_level > 0)
-				bit_array_not(allocator->block_index, free_index(allocator, index));
+	return index != ~0UL ? address_of(allocator, index, level) : 0;
+}
 
-			/* Get the buddy pointer */
-			buddy_block_ptr = (buddy_block_info_t *)to_buddy(allocator, block_ptr, block_at_level + 1);
+#else
 
-			/* Add right side to the free list */
-			list_add(&allocator->free_blocks[block_at_level + 1], buddy_block_ptr);
+static inline void free_block_add(buddy_allocator_t *allocator, unsigned long int level, void *block)
+{
+	/* The list is taken from the front, so pushing there reuses the most recently released block first */
+	if (allocator->policy == BUDDY_POLICY_LIFO)
+		list_push(&BUDDY_GET_POINTER(allocator, free_blocks)[level], block);
+	else
+		list_add(&BUDDY_GET_POINTER(allocator, free_blocks)[level], block);
+#ifdef BUDDY_ADDRESS_ORDERED
+	free_map_add(allocator, level, block);
+#endif
+	allocator->free_levels |= (1UL << level);
+	BUDDY_GET_POINTER(allocator, free_counts)[level] += 1;
+	allocator->available += allocator->size >> level;
+}
 
-			/* Adjust index to left child */
-			index = (index << 1) + 1;
+static inline void free_block_remove(buddy_allocator_t *allocator, unsigned long int level, void *block)
+{
+	list_remove(block);
+#ifdef BUDDY_ADDRESS_ORDERED
+	free_map_clear(allocator, index_of(allocator, block, level));
+#endif
+	if (--BUDDY_GET_POINTER(allocator, free_counts)[level] == 0)
+		allocator->free_levels &= ~(1UL << level);
+	allocator->available -= allocator->size >> level;
+}
 
-			/* Adjust to the next level */
-			++block_at_level;
-		}
+static inline void *free_block_pop(buddy_allocator_t *allocator, unsigned long int level)
+{
+	buddy_block_info_t *block;
+
+#ifdef BUDDY_ADDRESS_ORDERED
+	/* The map finds the lowest addressed block, which is then unlinked from wherever it sits in the list */
+	if (allocator->policy == BUDDY_POLICY_ADDRESS) {
+		block = free_map_take(allocator, level);
+		list_remove(block);
+	} else {
+		block = list_pop(&BUDDY_GET_POINTER(allocator, free_blocks)[level]);
+		free_map_clear(allocator, index_of(allocator, block, level));
 	}
+#else
+	block = list_pop(&BUDDY_GET_POINTER(allocator, free_blocks)[level]);
+#endif
 
-	/* Mark as allocated, level zero does not use a allocation flag */
-	if (level > 0)
-		bit_array_not(allocator->block_index, free_index(allocator, index));
+	if (--BUDDY_GET_POINTER(allocator, free_counts)[level] == 0)
+		allocator->free_levels &= ~(1UL << level);
+	allocator->available -= allocator->size >> level;
 
-	/* All done */
-	return block_ptr;
+	return block;
 }
 
-static void buddy_release_at_level(buddy_allocator_t *allocator, void *ptr, unsigned long int level)
+static inline void *free_block_first(const buddy_allocator_t *allocator, unsigned long int level)
 {
-	void *buddy_ptr = to_buddy(allocator, ptr, level);
-	unsigned long int index = index_of(allocator, ptr, level);
+	buddy_block_info_t *list = &BUDDY_GET_POINTER(allocator, free_blocks)[level];
 
-	/* Flip the allocation bit, level zero does not use a allocation bit */
-	if (level > 0)
-		bit_array_not(allocator->block_index, free_index(allocator, index));
+	return !list_empty(list) ? BUDDY_GET_POINTER(list, next) : 0;
+}
 
-	/* Consolidate the blocks */
-	while (level > 0 && !bit_array_is_set(allocator->block_index, free_index(allocator, index))) {
+static inline void *free_block_next(const buddy_allocator_t *allocator, unsigned long int level, void *block)
+{
+	buddy_block_info_t *next = BUDDY_GET_POINTER((buddy_block_info_t *)block, next);
 
-		/* Clear the split bit */
-		bit_array_clear(allocator->block_index, split_index(allocator, index));
+	return next != &BUDDY_GET_POINTER(allocator, free_blocks)[level] ? next : 0;
+}
 
-		/* Remove it from the list */
-		list_remove(buddy_ptr);
+#endif
 
-		/* Adjust the index and level */
-		index = (index - 1) >> 1;
-		--level;
+#ifdef BUDDY_DEFERRED_COALESCING
 
-		/* Make sure our we are now using the left buddy */
-		if (buddy_ptr < ptr)
-			ptr = buddy_ptr;
+static inline void deferred_block_push(buddy_allocator_t *allocator, unsigned long int level, void *block)
+{
+	/* The block stays in use as far as the block index is concerned */
+	list_add(&BUDDY_GET_POINTER(allocator, deferred_blocks)[level], block);
+	allocator->deferred_levels |= (1UL << level);
+	BUDDY_GET_POINTER(allocator, deferred_counts)[level] += 1;
+	allocator->available += allocator->size >> level;
+}
 
-		/* Get the new buddy */
-		buddy_ptr = to_buddy(allocator, ptr, level);
+static inline void *deferred_block_pop(buddy_allocator_t *allocator, unsigned long int level)
+{
+	buddy_block_info_t *block = list_pop(&BUDDY_GET_POINTER(allocator, deferred_blocks)[level]);
 
-		/* Flip the allocation bit */
-		if (level > 0)
-			bit_array_not(allocator->block_index, free_index(allocator, index));
-	}
+	if (--BUDDY_GET_POINTER(allocator, deferred_counts)[level] == 0)
+		allocator->deferred_levels &= ~(1UL << level);
+	allocator->available -= allocator->size >> level;
 
-	/* Clear the split bit */
-	bit_array_clear(allocator->block_index, split_index(allocator, index));
+	return block;
+}
 
-	/* Add combined block to it's free list */
-	list_add(&allocator->free_blocks[level], ptr);
+#endif
+
+static inline unsigned long int order_to_level(const buddy_allocator_t *allocator, unsigned long int order)
+{
+	/* Orders below the leaf size take a leaf, orders beyond the tree wrap around to beyond the last level */
+	if (order <= allocator->total_levels - allocator->max_level)
+		return allocator->max_level;
+	return allocator->total_levels - order;
 }
 
-void *buddy_alloc(buddy_allocator_t *allocator, size_t size)
+#ifdef BUDDY_BLOCKED_INDEX
+
+#define INDEX_BLOCK_SLOTS (1UL << BUDDY_INDEX_BLOCK_LEVELS)
+
+static inline unsigned long int index_top_levels(const buddy_allocator_t *allocator)
 {
-	unsigned long int level = size_to_level(allocator, size);
-	return buddy_alloc_from_level(allocator, level);
+	/* The top subtree takes the levels left over so every lower one is complete, it is padded to a whole block */
+	return ((allocator->max_level - 1) % BUDDY_INDEX_BLOCK_LEVELS) + 1;
 }
 
-void buddy_release(buddy_allocator_t *allocator, void *ptr, size_t size)
+static inline unsigned long int node_slot(const buddy_allocator_t *allocator, unsigned long int index)
 {
-	/* Do nothing on null pointer */
-	if (!ptr)
-		return;
+	unsigned long int top = index_top_levels(allocator);
+	unsigned long int depth = BUDDY_ILOG2(index + 1);
+	unsigned long int band;
+	unsigned long int row;
+	unsigned long int subtree;
+	unsigned long int before;
+
+	if (depth < top)
+		return index;
+
+	/* Locate the subtree within its band of subtrees and the node within the subtree, every band holds 256 times the
+	 * subtrees of the one above. Leaves have no bits, theirs is the slot a subtree root of the next band would have. */
+	band = (depth - top) / BUDDY_INDEX_BLOCK_LEVELS;
+	row = (depth - top) % BUDDY_INDEX_BLOCK_LEVELS;
+	subtree = ((index + 1) >> row) - (1UL << (top + (band * BUDDY_INDEX_BLOCK_LEVELS)));
+	before = ((~0UL / 255UL) & ((1UL << (band * BUDDY_INDEX_BLOCK_LEVELS)) - 1UL)) << top;
+
+	return ((1UL + before + subtree) * INDEX_BLOCK_SLOTS) + (1UL << row) + ((index + 1) & ((1UL << row) - 1UL)) - 1UL;
+}
 
-	/* Determine level and release */
-	buddy_release_at_level(allocator, ptr, size_to_level(allocator, size));
+static inline unsigned long int parent_slot(const buddy_allocator_t *allocator, unsigned long int index, unsigned long int slot)
+{
+	unsigned long int local = slot % INDEX_BLOCK_SLOTS;
+
+	/* Only the parent of a subtree root lives in another block */
+	if (local)
+		return (slot - local) + ((local - 1) >> 1);
+	return node_slot(allocator, (index - 1) >> 1);
 }
 
-void buddy_free(buddy_allocator_t *allocator, void *ptr)
+static inline unsigned long int child_slot(const buddy_allocator_t *allocator, unsigned long int child, unsigned long int slot)
 {
-	unsigned long int index;
+	unsigned long int local = ((slot % INDEX_BLOCK_SLOTS) << 1) + 2 - (child & 1);
+	unsigned long int nodes = slot < INDEX_BLOCK_SLOTS ? (1UL << index_top_levels(allocator)) - 1UL : INDEX_BLOCK_SLOTS - 1UL;
 
-	/* Do nothing on null pointer */
-	if (!ptr)
-		return;
+	/* Children of the last row of a subtree are the roots of subtrees in the next band */
+	if (local < nodes)
+		return (slot - (slot % INDEX_BLOCK_SLOTS)) + local;
+	return node_slot(allocator, child);
+}
 
-	/* Determine level and release */
-	index = index_of(allocator, ptr, allocator->max_level);
-	for (unsigned long int level = allocator->max_level; level > 0; --level) {
-		index = (index - 1) >> 1;
-		if (bit_array_is_set(allocator->block_index, split_index(allocator, index))) {
-			buddy_release_at_level(allocator, ptr, level);
-			return;
-		}
-	}
+/* The free bit of a pair of buddies belongs to their parent and sits next to its split bit */
+static inline unsigned long int pair_bit(const buddy_allocator_t *allocator, unsigned long int slot)
+{
+	return slot << 1;
+}
 
-	/* Must be allocated from the root */
-	buddy_release_at_level(allocator, ptr, 0);
+static inline unsigned long int split_bit(const buddy_allocator_t *allocator, unsigned long int slot)
+{
+	return (slot << 1) + 1;
 }
 
-void buddy_init(buddy_allocator_t *allocator, void *address, size_t size)
+#else
+
+/* Without BUDDY_BLOCKED_INDEX the bits of a node are found from its breadth first index alone */
+static inline unsigned long int node_slot(const buddy_allocator_t *allocator, unsigned long int index)
 {
-	int i;
+	return index;
+}
 
-	/* Initialize allocator setup */
-	allocator->address = address;
-	allocator->size = size;
-	allocator->min_allocation = BUDDY_MIN_LEAF_SIZE;
-	allocator->total_levels = BUDDY_ILOG2(allocator->size);
-	allocator->max_indexes = BUDDY_MAX_INDEXES(allocator->size, allocator->min_allocation);
-	allocator->max_level = BUDDY_MAX_LEVELS(allocator->size, allocator->min_allocation);
-	allocator->free_blocks = (void *)allocator + sizeof(buddy_allocator_t);
-	allocator->block_index = (void *)allocator + sizeof(buddy_allocator_t) + (sizeof(buddy_block_info_t) * (allocator->max_level + 1));
-	allocator->extra_metadata = 0;
+static inline unsigned long int parent_slot(const buddy_allocator_t *allocator, unsigned long int index, unsigned long int slot)
+{
+	return (index - 1) >> 1;
+}
 
-	/* Initial the block levels */
-	for (i = 0; i < allocator->max_level + 1; ++i)
-		list_init(&allocator->free_blocks[i]);
+static inline unsigned long int child_slot(const buddy_allocator_t *allocator, unsigned long int child, unsigned long int slot)
+{
+	return child;
+}
 
-	/* Initialize the clear the block index */
-	for (i = 0; i < (allocator->max_indexes + (BUDDY_NUM_BITS - 1)) / BUDDY_NUM_BITS; ++i)
-		allocator->block_index[i] = 0;
+/* The free bit of a pair of buddies belongs to their parent */
+static inline unsigned long int pair_bit(const buddy_allocator_t *allocator, unsigned long int slot)
+{
+	return slot;
+}
 
-	/* Add memory at level 0 */
-	list_add(&allocator->free_blocks[0], (buddy_block_info_t *)address);
+static inline unsigned long int split_bit(const buddy_allocator_t *allocator, unsigned long int slot)
+{
+	return slot + (allocator->max_indexes >> 1);
 }
 
-buddy_allocator_t *buddy_create(void *address, size_t size)
+#endif
+
+static inline unsigned long int pair_index(const buddy_allocator_t *allocator, unsigned long int parent)
+{
+	return pair_bit(allocator, node_slot(allocator, parent));
+}
+
+static inline unsigned long int free_index(const buddy_allocator_t *allocator, unsigned long int index)
 {
-	int i;
-	buddy_allocator_t *final_allocator = address;
+	return pair_index(allocator, (index - 1) >> 1);
+}
 
-	/* Setup initial alloctor usig the tailing side of the address range */
-	size_t metadata_size = buddy_sizeof_metadata(size, BUDDY_MIN_LEAF_SIZE);
-	buddy_allocator_t *initial_allocator = (buddy_allocator_t *)((address + size) - metadata_size);
+static inline unsigned long int split_index(const buddy_allocator_t *allocator, unsigned long int index)
+{
+	return split_bit(allocator, node_slot(allocator, index));
+}
 
-	/* Setup the initial allocator */
-	buddy_init(initial_allocator, address, size);
+static inline unsigned long int index_words(const buddy_allocator_t *allocator)
+{
+#ifdef BUDDY_BLOCKED_INDEX
+	/* Less the room left for aligning the index */
+	return BUDDY_BLOCK_INDEX_SIZE(allocator->size, allocator->min_allocation) - (BUDDY_INDEX_BLOCK_BYTES / sizeof(unsigned long int));
+#else
+	return BUDDY_BLOCK_INDEX_SIZE(allocator->size, allocator->min_allocation);
+#endif
+}
 
-	/* Allocate enough min sized block to cover the meta data, we do not need the actual pointers for anything */
-	initial_allocator->extra_metadata = (void *)-1;
-	for (i = 0; i < (metadata_size + (BUDDY_MIN_LEAF_SIZE - 1)) / BUDDY_MIN_LEAF_SIZE; ++i)
-		(void)buddy_alloc_from_level(initial_allocator, initial_allocator->max_level);
+static inline void split_set_range(buddy_allocator_t *allocator, unsigned long int first, unsigned long int count)
+{
+#ifdef BUDDY_BLOCKED_INDEX
+	/* Neighbours on a level are not adjacent in the blocked layout */
+	for (unsigned long int i = 0; i < count; ++i)
+		bit_array_set(BUDDY_GET_POINTER(allocator, block_index), split_index(allocator, first + i));
+#else
+	bit_array_set_range(BUDDY_GET_POINTER(allocator, block_index), split_index(allocator, first), count);
+#endif
+}
 
-	/* Move the initial allocator into place */
-	final_allocator = address;
-	final_allocator->address = address;
-	final_allocator->size = initial_allocator->size;
-	final_allocator->min_allocation = initial_allocator->min_allocation;
-	final_allocator->max_indexes = initial_allocator->max_indexes;
-	final_allocator->total_levels = initial_allocator->total_levels;
-	final_allocator->max_level = initial_allocator->max_level;
-	final_allocator->free_blocks = address + sizeof(buddy_allocator_t);
-	final_allocator->block_index = address +  sizeof(buddy_allocator_t) + (sizeof(buddy_block_info_t) * (final_allocator->max_level + 1));
-	final_allocator->extra_metadata = 0;
+static inline void split_clear_range(buddy_allocator_t *allocator, unsigned long int first, unsigned long int count)
+{
+#ifdef BUDDY_BLOCKED_INDEX
+	for (unsigned long int i = 0; i < count; ++i)
+		bit_array_clear(BUDDY_GET_POINTER(allocator, block_index), split_index(allocator, first + i));
+#else
+	bit_array_clear_range(BUDDY_GET_POINTER(allocator, block_index), split_index(allocator, first), count);
+#endif
+}
 
-	/* Copy the block indexes */
-	for (i = 0; i < (final_allocator->max_indexes + (BUDDY_NUM_BITS - 1)) / BUDDY_NUM_BITS; ++i)
-		final_allocator->block_index[i] = initial_allocator->block_index[i];
+#ifdef BUDDY_STATS
+#define buddy_stat_add(allocator, level, counter, count) (BUDDY_GET_POINTER(allocator, level_stats)[level].counter += (count))
+#else
+#define buddy_stat_add(allocator, level, counter, count) do { } while (0)
+#endif
 
-	/* Relink the free blocks */
-	for (int level = 0; level < initial_allocator->max_level + 1; ++level) {
+#ifdef BUDDY_LEVEL_MAP
 
-		/* Initialize the final allocator free block list for the current level */
-		list_init(&final_allocator->free_blocks[level]);
+static inline unsigned long int level_map_bits(const buddy_allocator_t *allocator)
+{
+	/* Just enough bits for the deepest level, matching BUDDY_LEVEL_MAP_BITS() */
+	return BUDDY_ILOG2(allocator->max_level | 1UL) + 1UL;
+}
 
-		/* For non-empty free block lists in the initial allocator, rewrite the head and tail pointers */
-		if (!list_empty(&initial_allocator->free_blocks[level])) {
+static inline unsigned long int level_map_bit(const buddy_allocator_t *allocator, const void *ptr)
+{
+	/* Only the first leaf of a block is ever looked up */
+	return ((ptr - base_of(allocator)) >> (allocator->total_levels - allocator->max_level)) * level_map_bits(allocator);
+}
 
-			final_allocator->free_blocks[level].next = initial_allocator->free_blocks[level].next;
-			final_allocator->free_blocks[level].prev = initial_allocator->free_blocks[level].prev;
+#endif
 
-			final_allocator->free_blocks[level].next->prev = &final_allocator->free_blocks[level];
-			final_allocator->free_blocks[level].prev->next = &final_allocator->free_blocks[level];
-		}
+static inline void level_map_set(buddy_allocator_t *allocator, const void *ptr, unsigned long int level)
+{
+#ifdef BUDDY_LEVEL_MAP
+	unsigned long int *level_map = BUDDY_GET_POINTER(allocator, level_map);
+	unsigned long int mask = (1UL << level_map_bits(allocator)) - 1UL;
+	unsigned long int bit = level_map_bit(allocator, ptr);
+	unsigned long int word = bit / BUDDY_NUM_BITS;
+	unsigned long int shift = bit % BUDDY_NUM_BITS;
+
+	/* Entries are packed back to back, so one may carry over into the next word */
+	level_map[word] = (level_map[word] & ~(mask << shift)) | (level << shift);
+	if (shift + level_map_bits(allocator) > BUDDY_NUM_BITS)
+		level_map[word + 1] = (level_map[word + 1] & ~(mask >> (BUDDY_NUM_BITS - shift))) | (level >> (BUDDY_NUM_BITS - shift));
+#endif
+}
+
+static unsigned long int level_of(const buddy_allocator_t *allocator, const void *ptr)
+{
+#ifdef BUDDY_LEVEL_MAP
+	const unsigned long int *level_map = BUDDY_GET_POINTER(allocator, level_map);
+	unsigned long int bit = level_map_bit(allocator, ptr);
+	unsigned long int word = bit / BUDDY_NUM_BITS;
+	unsigned long int shift = bit % BUDDY_NUM_BITS;
+	unsigned long int level = level_map[word] >> shift;
+
+	if (shift + level_map_bits(allocator) > BUDDY_NUM_BITS)
+		level |= level_map[word + 1] << (BUDDY_NUM_BITS - shift);
+
+	return level & ((1UL << level_map_bits(allocator)) - 1UL);
+#else
+	unsigned long int index = index_of(allocator, ptr, allocator->max_level);
+	unsigned long int slot = node_slot(allocator, index);
+
+	/* The block level is one below the nearest split ancestor */
+	for (unsigned long int level = allocator->max_level; level > 0; --level) {
+		slot = parent_slot(allocator, index, slot);
+		index = (index - 1) >> 1;
+		if (bit_array_is_set(BUDDY_GET_POINTER(allocator, block_index), split_bit(allocator, slot)))
+			return level;
 	}
 
-	/* All done */
-	return final_allocator;
+	/* Must be allocated from the root */
+	return 0;
+#endif
 }
 
-size_t buddy_largest_available(const buddy_allocator_t *allocator)
+static inline void *to_buddy(const buddy_allocator_t *allocator, const void *ptr, unsigned long int level)
 {
-	/* Find first level with a block available */
-	for (unsigned long int level = 0; level < allocator->max_level + 1; ++level)
-		if (!list_empty(&allocator->free_blocks[level]))
-			return allocator->size >> level;
+#ifdef BUDDY_MEMORY_ALIGNED_ON_SIZE
+	return (void *)((unsigned long int)ptr ^ (allocator->size >> level));
+#else
+	return ((ptr - base_of(allocator)) ^ (allocator->size >> level)) + base_of(allocator);
+#endif
+}
 
-	/* No blocks available */
+#ifdef BUDDY_PAGE_RELEASE
+
+static inline size_t page_keep(const buddy_allocator_t *allocator)
+{
+	/* The free list links live in the first page of a block unless the metadata is out of band */
+#ifdef BUDDY_OUT_OF_BAND_METADATA
 	return 0;
+#else
+	return allocator->page_size;
+#endif
 }
 
-size_t buddy_available(const buddy_allocator_t *allocator)
+static inline unsigned long int page_find(const unsigned long int *bit_array, unsigned long int from, unsigned long int to, bool released)
 {
-	size_t available = 0;
-	int blocks_available;
+	unsigned long int flip = released ? 0 : ~0UL;
+	unsigned long int array_index = from >> BIT_ARRAY_INDEX_SHIFT;
+	unsigned long int word = (bit_array[array_index] ^ flip) & (~0UL << (from & BIT_ARRAY_INDEX_MASK));
+
+	/* Scan a word at a time for the next page in the wanted state before to */
+	while (!word) {
+		if (++array_index << BIT_ARRAY_INDEX_SHIFT >= to)
+			return to;
+		word = bit_array[array_index] ^ flip;
+	}
 
-	for (unsigned long int level = 0; level < allocator->max_level + 1; ++level) {
-		blocks_available = 0;
-		for (buddy_block_info_t *cursor = allocator->free_blocks[level].next; cursor != &allocator->free_blocks[level]; cursor = cursor->next)
-			++blocks_available;
-		available += blocks_available << (allocator->total_levels - level);
+	from = (array_index << BIT_ARRAY_INDEX_SHIFT) + __builtin_ctzl(word);
+	return from < to ? from : to;
+}
+
+static void page_commit_range(buddy_allocator_t *allocator, void *address, size_t size)
+{
+	unsigned long int *released_map = BUDDY_GET_POINTER(allocator, released_map);
+	unsigned long int shift = BUDDY_ILOG2(allocator->page_size);
+	unsigned long int page = (address - base_of(allocator)) >> shift;
+	unsigned long int end = ((address - base_of(allocator)) + size + (allocator->page_size - 1)) >> shift;
+	unsigned long int run;
+
+	/* Bring back each run of released pages touching the range */
+	while ((page = page_find(released_map, page, end, true)) < end) {
+		run = page_find(released_map, page, end, false) - page;
+		bit_array_clear_range(released_map, page, run);
+		allocator->released -= run << shift;
+		if (allocator->commit)
+			allocator->commit(base_of(allocator) + (page << shift), run << shift, allocator->page_context);
+		page += run;
 	}
+}
 
-	return available;
+static void page_decommit_range(buddy_allocator_t *allocator, void *address, size_t size)
+{
+	unsigned long int *released_map = BUDDY_GET_POINTER(allocator, released_map);
+	unsigned long int shift = BUDDY_ILOG2(allocator->page_size);
+	unsigned long int page = (address - base_of(allocator)) >> shift;
+	unsigned long int end = ((address - base_of(allocator)) + size) >> shift;
+	unsigned long int run;
+
+	/* Release each run of committed pages in the range, pages released before are left alone */
+	while ((page = page_find(released_map, page, end, false)) < end) {
+		run = page_find(released_map, page, end, true) - page;
+		bit_array_set_range(released_map, page, run);
+		allocator->released += run << shift;
+		allocator->decommit(base_of(allocator) + (page << shift), run << shift, allocator->page_context);
+		page += run;
+	}
 }
 
-size_t buddy_used(const buddy_allocator_t *allocator)
+static size_t page_purge(buddy_allocator_t *allocator, size_t committed)
+{
+	size_t released = allocator->released;
+
+	/* Release the largest free blocks first until no more than the given amount of free memory is committed */
+	for (unsigned long int level = 0; level <= allocator->max_level && (allocator->size >> level) >= allocator->release_min_block; ++level) {
+		for (void *block = free_block_first(allocator, level); block && allocator->available - allocator->released > committed; block = free_block_next(allocator, level, block))
+			page_decommit_range(allocator, block + page_keep(allocator), (allocator->size >> level) - page_keep(allocator));
+	}
+
+	return allocator->released - released;
+}
+
+#endif
+
+static inline void page_unrelease(buddy_allocator_t *allocator, void *address, size_t size)
+{
+#ifdef BUDDY_PAGE_RELEASE
+	/* The range is about to be used, bring back whichever of its pages are released */
+	if (allocator->released && size)
+		page_commit_range(allocator, address, size);
+#endif
+}
+
+static inline void page_unrelease_links(buddy_allocator_t *allocator, void *block, size_t size)
 {
-	return allocator->size - buddy_available(allocator);
+#ifdef BUDDY_PAGE_RELEASE
+	/* A block put on a free list only needs the page its links are written to, the rest can stay released */
+	page_unrelease(allocator, block, size < page_keep(allocator) ? size : page_keep(allocator));
+#endif
+}
+
+static inline void page_prepare_split(buddy_allocator_t *allocator, void *block_ptr, unsigned long int block_at_level, unsigned long int level, const void *target)
+{
+#ifdef BUDDY_PAGE_RELEASE
+	size_t block_size = allocator->size >> level;
+	void *half;
+
+	if (!allocator->released)
+		return;
+
+	/* Commit the pages of the target block, then the link pages of the halves split off on the way down */
+	page_unrelease(allocator, base_of(allocator) + ((target - base_of(allocator)) & ~(block_size - 1)), block_size);
+	for (unsigned long int at_level = block_at_level + 1; at_level <= level; ++at_level) {
+		half = to_buddy(allocator, base_of(allocator) + ((target - base_of(allocator)) & ~((allocator->size >> at_level) - 1)), at_level);
+		page_unrelease_links(allocator, half, allocator->size >> at_level);
+	}
+#endif
+}
+
+static void *buddy_split(buddy_allocator_t *allocator, void *block_ptr, unsigned long int block_at_level, unsigned long int level, const void *target)
+{
+	unsigned long int index = index_of(allocator, block_ptr, block_at_level);
+	/* The block only needs a slot when it is split, parent_slot() looks the parent up afresh from a zero slot */
+	unsigned long int slot = block_at_level < level ? node_slot(allocator, index) : 0;
+	unsigned long int parent = block_at_level > 0 ? parent_slot(allocator, index, slot) : 0;
+	void *buddy_block_ptr;
+
+	/* Split the block until we reach the requested level */
+	while (block_at_level < level) {
+
+		/* Mark block as split */
+		bit_array_set(BUDDY_GET_POINTER(allocator, block_index), split_bit(allocator, slot));
+		buddy_stat_add(allocator, block_at_level, splits, 1);
+
+		/* Mark as allocated, level zero does not use a allocation flags */
+		if (block_at_level > 0)
+			bit_array_not(BUDDY_GET_POINTER(allocator, block_index), pair_bit(allocator, parent));
+
+		/* Get the buddy pointer */
+		buddy_block_ptr = to_buddy(allocator, block_ptr, block_at_level + 1);
+
+		/* Adjust index to left child */
+		index = (index << 1) + 1;
+
+		/* Keep the half holding the target, normally the left */
+		if (target >= buddy_block_ptr) {
+			buddy_block_ptr = block_ptr;
+			block_ptr = to_buddy(allocator, block_ptr, block_at_level + 1);
+			++index;
+		}
+
+		/* Add other side to the free list */
+		free_block_add(allocator, block_at_level + 1, buddy_block_ptr);
+
+		/* Adjust to the next level, the kept half is only split further above the requested level */
+		parent = slot;
+		if (++block_at_level < level)
+			slot = child_slot(allocator, index, slot);
+	}
+
+	/* Mark as allocated, level zero does not use a allocation flag */
+	if (level > 0)
+		bit_array_not(BUDDY_GET_POINTER(allocator, block_index), pair_bit(allocator, parent));
+
+	/* Remember the size for buddy_free() */
+	level_map_set(allocator, block_ptr, level);
+
+	/* All done */
+	return block_ptr;
+}
+
+static void *buddy_alloc_from_level(buddy_allocator_t *allocator, unsigned long int level)
+{
+	unsigned long int block_at_level;
+	unsigned long int available;
+	void *block_ptr = 0;
+
+	/* Larger than the whole region */
+	if (level > allocator->max_level) {
+		buddy_stat_add(allocator, 0, failures, 1);
+		return block_ptr;
+	}
+
+#ifdef BUDDY_DEFERRED_COALESCING
+	/* Reuse a block released at this level, it was never merged so there is nothing to split */
+	if (BUDDY_GET_POINTER(allocator, deferred_counts)[level]) {
+		buddy_stat_add(allocator, level, allocs, 1);
+		buddy_stat_add(allocator, level, reused, 1);
+		return deferred_block_pop(allocator, level);
+	}
+#endif
+
+	/* Mask off the levels with blocks smaller than requested */
+	available = allocator->free_levels & ((2UL << level) - 1UL);
+
+	/* Did we find a block? */
+	if (!available) {
+#ifdef BUDDY_DEFERRED_COALESCING
+		/* Merging the waiting blocks may make room */
+		if (allocator->deferred_levels) {
+			buddy_coalesce_all(allocator);
+			return buddy_alloc_from_level(allocator, level);
+		}
+#endif
+		buddy_stat_add(allocator, level, failures, 1);
+		return block_ptr;
+	}
+
+	/* The nearest level up with a free block is the highest set bit */
+	block_at_level = BUDDY_ILOG2(available);
+	block_ptr = free_block_pop(allocator, block_at_level);
+	buddy_stat_add(allocator, level, allocs, 1);
+
+	/* Split down to the requested level keeping the left most block */
+	page_prepare_split(allocator, block_ptr, block_at_level, level, block_ptr);
+	return buddy_split(allocator, block_ptr, block_at_level, level, block_ptr);
+}
+
+static void buddy_merge(buddy_allocator_t *allocator, void *ptr, unsigned long int level)
+{
+	void *buddy_ptr = to_buddy(allocator, ptr, level);
+	unsigned long int index = index_of(allocator, ptr, level);
+	unsigned long int slot = node_slot(allocator, index);
+	unsigned long int parent = level > 0 ? parent_slot(allocator, index, slot) : 0;
+
+	/* Flip the allocation bit, level zero does not use a allocation bit */
+	if (level > 0)
+		bit_array_not(BUDDY_GET_POINTER(allocator, block_index), pair_bit(allocator, parent));
+
+	/* Consolidate the blocks */
+	while (level > 0 && !bit_array_is_set(BUDDY_GET_POINTER(allocator, block_index), pair_bit(allocator, parent))) {
+
+		/* Clear the split bit, leaf level blocks are never split and have no split bit */
+		if (level < allocator->max_level)
+			bit_array_clear(BUDDY_GET_POINTER(allocator, block_index), split_bit(allocator, slot));
+
+		/* Remove it from the list, any released pages of the buddy stay released in the merged block */
+		free_block_remove(allocator, level, buddy_ptr);
+		buddy_stat_add(allocator, level, merges, 1);
+
+		/* Adjust the index and level */
+		index = (index - 1) >> 1;
+		slot = parent;
+		--level;
+
+		/* Make sure our we are now using the left buddy */
+		if (buddy_ptr < ptr)
+			ptr = buddy_ptr;
+
+		/* Get the new buddy */
+		buddy_ptr = to_buddy(allocator, ptr, level);
+
+		/* Flip the allocation bit */
+		if (level > 0) {
+			parent = parent_slot(allocator, index, slot);
+			bit_array_not(BUDDY_GET_POINTER(allocator, block_index), pair_bit(allocator, parent));
+		}
+	}
+
+	/* Clear the split bit */
+	if (level < allocator->max_level)
+		bit_array_clear(BUDDY_GET_POINTER(allocator, block_index), split_bit(allocator, slot));
+
+	/* Add combined block to it's free list */
+	free_block_add(allocator, level, ptr);
+
+#ifdef BUDDY_PAGE_RELEASE
+	/* Only a large merged block releases pages and only those not already released, so churn of small blocks
+	 * never reaches the hook */
+	if (allocator->page_size && (allocator->size >> level) >= allocator->release_min_block && allocator->available - allocator->released > allocator->release_high)
+		page_purge(allocator, allocator->release_low);
+#endif
+}
+
+static void buddy_release_at_level(buddy_allocator_t *allocator, void *ptr, unsigned long int level)
+{
+	buddy_stat_add(allocator, level, frees, 1);
+
+#ifdef BUDDY_DEFERRED_COALESCING
+	/* Hold on to the block for the next allocation of the same size */
+	if (BUDDY_GET_POINTER(allocator, deferred_counts)[level] < BUDDY_GET_POINTER(allocator, deferred_limits)[level]) {
+		buddy_stat_add(allocator, level, deferred, 1);
+		deferred_block_push(allocator, level, ptr);
+		return;
+	}
+#endif
+
+	buddy_merge(allocator, ptr, level);
+}
+
+static size_t buddy_carve(buddy_allocator_t *allocator, void *block_ptr, unsigned long int block_at_level, unsigned long int level, void **ptrs, size_t n)
+{
+	size_t block_size = allocator->size >> level;
+	size_t count = 1UL << (level - block_at_level);
+	unsigned long int nodes;
+	unsigned long int next_nodes;
+	unsigned long int first;
+
+	/* Carve no more leaves than requested */
+	if (count > n)
+		count = n;
+	page_unrelease(allocator, block_ptr, count * block_size);
+
+	/* Mark the block as allocated or split, level zero does not use a allocation flag */
+	if (block_at_level > 0)
+		bit_array_not(BUDDY_GET_POINTER(allocator, block_index), free_index(allocator, index_of(allocator, block_ptr, block_at_level)));
+
+	/* Split the leftmost nodes of each level covering the carved leaves, a word at a time */
+	nodes = 1;
+	for (unsigned long int split_level = block_at_level; split_level < level; ++split_level) {
+
+		first = index_of(allocator, block_ptr, split_level);
+		split_set_range(allocator, first, nodes);
+		buddy_stat_add(allocator, split_level, splits, nodes);
+
+		/* Children of fully carved nodes are both in use so their free bit stays clear, except for a
+		 * trailing node with only its left child carved, the right child goes to the free list */
+		next_nodes = (count + (1UL << (level - split_level - 1)) - 1UL) >> (level - split_level - 1);
+		if (next_nodes & 1UL) {
+			bit_array_set(BUDDY_GET_POINTER(allocator, block_index), pair_index(allocator, first + nodes - 1UL));
+			page_unrelease_links(allocator, block_ptr + (next_nodes * (allocator->size >> (split_level + 1))), allocator->size >> (split_level + 1));
+			free_block_add(allocator, split_level + 1, block_ptr + (next_nodes * (allocator->size >> (split_level + 1))));
+		}
+
+		nodes = next_nodes;
+	}
+
+	/* Hand out the carved leaves in address order */
+	buddy_stat_add(allocator, level, allocs, count);
+	for (size_t i = 0; i < count; ++i) {
+		ptrs[i] = block_ptr + (i * block_size);
+		level_map_set(allocator, ptrs[i], level);
+	}
+
+	return count;
+}
+
+static int buddy_compare_blocks(const void *left, const void *right)
+{
+	const void *left_ptr = *(void * const *)left;
+	const void *right_ptr = *(void * const *)right;
+
+	return (left_ptr > right_ptr) - (left_ptr < right_ptr);
+}
+
+void *buddy_alloc(buddy_allocator_t *allocator, size_t size)
+{
+	unsigned long int level = buddy_size_to_level(allocator, size);
+	return buddy_alloc_from_level(allocator, level);
+}
+
+void *buddy_alloc_order(buddy_allocator_t *allocator, unsigned long int order)
+{
+	return buddy_alloc_from_level(allocator, order_to_level(allocator, order));
+}
+
+void *buddy_alloc_aligned(buddy_allocator_t *allocator, size_t alignment, size_t size)
+{
+	unsigned long int level = buddy_size_to_level(allocator, size);
+	unsigned long int base_alignment = (unsigned long int)base_of(allocator) & -(unsigned long int)base_of(allocator);
+	size_t block_size = allocator->size >> level;
+	unsigned long int search_level;
+	unsigned long int available;
+	void *block_ptr;
+	void *aligned_ptr;
+
+	/* Only power of two alignments are supported */
+	if (alignment & (alignment - 1))
+		return 0;
+
+	/* Larger than the whole region */
+	if (level > allocator->max_level) {
+		buddy_stat_add(allocator, 0, failures, 1);
+		return 0;
+	}
+
+	/* Every block is aligned on its own size relative to the base address, so when the base is aligned at least
+	 * as strictly any block the size of the alignment will do. Allocate one and split it down to the requested
+	 * size, the remainder goes back to the free lists. */
+	if (!base_alignment || alignment <= base_alignment) {
+
+		/* Search no lower than the level of blocks the size of the alignment */
+		search_level = level;
+		if (alignment > block_size)
+			search_level = alignment < allocator->size ? allocator->total_levels - BUDDY_ILOG2(alignment) : 0;
+
+#ifdef BUDDY_DEFERRED_COALESCING
+		/* A block waiting at this level is as aligned as any other of its size */
+		if (search_level == level && BUDDY_GET_POINTER(allocator, deferred_counts)[level]) {
+			buddy_stat_add(allocator, level, allocs, 1);
+			buddy_stat_add(allocator, level, reused, 1);
+			return deferred_block_pop(allocator, level);
+		}
+#endif
+
+		/* Find the nearest level up with a free block */
+		available = allocator->free_levels & ((2UL << search_level) - 1UL);
+		if (!available) {
+#ifdef BUDDY_DEFERRED_COALESCING
+			/* Merging the waiting blocks may make room */
+			if (allocator->deferred_levels) {
+				buddy_coalesce_all(allocator);
+				return buddy_alloc_aligned(allocator, alignment, size);
+			}
+#endif
+			buddy_stat_add(allocator, level, failures, 1);
+			return 0;
+		}
+		search_level = BUDDY_ILOG2(available);
+		block_ptr = free_block_pop(allocator, search_level);
+		buddy_stat_add(allocator, level, allocs, 1);
+		page_prepare_split(allocator, block_ptr, search_level, level, block_ptr);
+		return buddy_split(allocator, block_ptr, search_level, level, block_ptr);
+	}
+
+	/* Otherwise only blocks no larger than the base alignment can ever start on an aligned address */
+	if (block_size > base_alignment) {
+		buddy_stat_add(allocator, level, failures, 1);
+		return 0;
+	}
+
+	/* Look for a free block with an aligned block of the requested size inside it, smallest blocks first */
+	for (long int block_at_level = level; block_at_level >= 0; --block_at_level) {
+		for (void *cursor = free_block_first(allocator, block_at_level); cursor; cursor = free_block_next(allocator, block_at_level, cursor)) {
+
+			/* Round up to the first aligned address in the block */
+			aligned_ptr = (void *)(((unsigned long int)cursor + (alignment - 1)) & ~(alignment - 1));
+			if (aligned_ptr + block_size > (void *)cursor + (allocator->size >> block_at_level))
+				continue;
+
+			/* Split down towards it */
+			free_block_remove(allocator, block_at_level, cursor);
+			buddy_stat_add(allocator, level, allocs, 1);
+			page_prepare_split(allocator, cursor, block_at_level, level, aligned_ptr);
+			return buddy_split(allocator, cursor, block_at_level, level, aligned_ptr);
+		}
+	}
+
+	/* Nothing suitable, unless merging the waiting blocks makes room */
+#ifdef BUDDY_DEFERRED_COALESCING
+	if (allocator->deferred_levels) {
+		buddy_coalesce_all(allocator);
+		return buddy_alloc_aligned(allocator, alignment, size);
+	}
+#endif
+	buddy_stat_add(allocator, level, failures, 1);
+	return 0;
+}
+
+void buddy_release(buddy_allocator_t *allocator, void *ptr, size_t size)
+{
+	/* Do nothing on null pointer */
+	if (!ptr)
+		return;
+
+	/* Determine level and release */
+	buddy_release_at_level(allocator, ptr, buddy_size_to_level(allocator, size));
+}
+
+void buddy_release_order(buddy_allocator_t *allocator, void *ptr, unsigned long int order)
+{
+	/* Do nothing on null pointer */
+	if (!ptr)
+		return;
+
+	buddy_release_at_level(allocator, ptr, order_to_level(allocator, order));
+}
+
+void buddy_free(buddy_allocator_t *allocator, void *ptr)
+{
+	/* Do nothing on null pointer */
+	if (!ptr)
+		return;
+
+	/* Determine level and release */
+	buddy_release_at_level(allocator, ptr, level_of(allocator, ptr));
+}
+
+static bool buddy_grow_in_place(buddy_allocator_t *allocator, void *ptr, unsigned long int level, unsigned long int new_level)
+{
+	/* The block must be the left half at every level it grows through and each right half must be a free block,
+	 * which is the case exactly when the allocation bit of the parent shows a single child in use */
+	for (unsigned long int at_level = level; at_level > new_level; --at_level) {
+		if ((ptr - base_of(allocator)) & (allocator->size >> at_level))
+			return false;
+		if (!bit_array_is_set(BUDDY_GET_POINTER(allocator, block_index), free_index(allocator, index_of(allocator, ptr, at_level))))
+			return false;
+	}
+
+	/* Absorb the right halves, each parent ends up allocated whole */
+	for (unsigned long int at_level = level; at_level > new_level; --at_level) {
+		unsigned long int parent = (index_of(allocator, ptr, at_level) - 1) >> 1;
+		page_unrelease(allocator, to_buddy(allocator, ptr, at_level), allocator->size >> at_level);
+		free_block_remove(allocator, at_level, to_buddy(allocator, ptr, at_level));
+		buddy_stat_add(allocator, at_level, merges, 1);
+		bit_array_not(BUDDY_GET_POINTER(allocator, block_index), pair_index(allocator, parent));
+		bit_array_clear(BUDDY_GET_POINTER(allocator, block_index), split_index(allocator, parent));
+	}
+
+	/* Remember the new size for buddy_free() */
+	level_map_set(allocator, ptr, new_level);
+
+	return true;
+}
+
+void *buddy_realloc(buddy_allocator_t *allocator, void *ptr, size_t size)
+{
+	unsigned long int level;
+	unsigned long int new_level;
+	void *new_ptr;
+
+	/* Behave like buddy_alloc() on a null pointer */
+	if (!ptr)
+		return buddy_alloc(allocator, size);
+
+	/* And like buddy_free() on a zero size */
+	if (!size) {
+		buddy_free(allocator, ptr);
+		return 0;
+	}
+
+	/* Nothing bigger than the whole region */
+	if (size > allocator->size)
+		return 0;
+
+	level = level_of(allocator, ptr);
+	new_level = buddy_size_to_level(allocator, size);
+
+	/* Already the right size */
+	if (new_level == level)
+		return ptr;
+
+	/* Shrink by splitting off the tail halves, the block is already in use so undo the allocation flip done by
+	 * buddy_split() on the original block */
+	if (new_level > level) {
+		if (level > 0)
+			bit_array_not(BUDDY_GET_POINTER(allocator, block_index), free_index(allocator, index_of(allocator, ptr, level)));
+		return buddy_split(allocator, ptr, level, new_level, ptr);
+	}
+
+	/* Grow by merging with free right hand buddies */
+	if (buddy_grow_in_place(allocator, ptr, level, new_level))
+		return ptr;
+
+	/* Fall back to moving the block, leaving the original intact on failure */
+	new_ptr = buddy_alloc_from_level(allocator, new_level);
+	if (!new_ptr)
+		return 0;
+	memcpy(new_ptr, ptr, allocator->size >> level);
+	buddy_release_at_level(allocator, ptr, level);
+
+	return new_ptr;
+}
+
+size_t buddy_usable_size(const buddy_allocator_t *allocator, const void *ptr)
+{
+	/* Null pointers have no size */
+	if (!ptr)
+		return 0;
+
+	return allocator->size >> level_of(allocator, ptr);
+}
+
+size_t buddy_alloc_batch(buddy_allocator_t *allocator, size_t size, void **ptrs, size_t n)
+{
+	unsigned long int level = buddy_size_to_level(allocator, size);
+	unsigned long int block_at_level;
+	unsigned long int available;
+	void *block_ptr;
+	size_t count = 0;
+
+	/* Larger than the whole region */
+	if (level > allocator->max_level) {
+		buddy_stat_add(allocator, 0, failures, 1);
+		return 0;
+	}
+
+#ifdef BUDDY_DEFERRED_COALESCING
+	/* Blocks waiting at this level go first, there is nothing to split */
+	while (count < n && BUDDY_GET_POINTER(allocator, deferred_counts)[level]) {
+		buddy_stat_add(allocator, level, allocs, 1);
+		buddy_stat_add(allocator, level, reused, 1);
+		ptrs[count++] = deferred_block_pop(allocator, level);
+	}
+#endif
+
+	while (count < n) {
+
+		/* Find the nearest level up with a free block */
+		available = allocator->free_levels & ((2UL << level) - 1UL);
+		if (!available) {
+#ifdef BUDDY_DEFERRED_COALESCING
+			/* Merging the waiting blocks may make room */
+			if (allocator->deferred_levels) {
+				buddy_coalesce_all(allocator);
+				continue;
+			}
+#endif
+			buddy_stat_add(allocator, level, failures, 1);
+			break;
+		}
+
+		/* Carve as many blocks as possible out of it in one pass */
+		block_at_level = BUDDY_ILOG2(available);
+		block_ptr = free_block_pop(allocator, block_at_level);
+		count += buddy_carve(allocator, block_ptr, block_at_level, level, ptrs + count, n - count);
+	}
+
+	/* Let the caller know how many were allocated */
+	return count;
+}
+
+void buddy_release_batch(buddy_allocator_t *allocator, void **ptrs, size_t n, size_t size)
+{
+	unsigned long int level = buddy_size_to_level(allocator, size);
+	size_t block_size = allocator->size >> level;
+	unsigned long int offset;
+	unsigned long int max_up;
+	unsigned long int up;
+	size_t run;
+	size_t i = 0;
+
+	/* Sorting brings sibling blocks together */
+	qsort(ptrs, n, sizeof(void *), buddy_compare_blocks);
+
+	while (i < n) {
+
+		/* Do nothing on null pointers */
+		if (!ptrs[i]) {
+			++i;
+			continue;
+		}
+
+#ifdef BUDDY_DEFERRED_COALESCING
+		/* Top up the waiting list of the level first, like single releases do */
+		if (BUDDY_GET_POINTER(allocator, deferred_counts)[level] < BUDDY_GET_POINTER(allocator, deferred_limits)[level]) {
+			buddy_release_at_level(allocator, ptrs[i], level);
+			++i;
+			continue;
+		}
+#endif
+
+		/* The alignment of the block bounds the height of the subtree it can head */
+		offset = ptrs[i] - base_of(allocator);
+		max_up = offset ? __builtin_ctzl(offset) - (allocator->total_levels - level) : level;
+		if (max_up > level)
+			max_up = level;
+
+		/* Measure the run of contiguous blocks that follow */
+		for (run = 1; run < (1UL << max_up) && i + run < n; ++run)
+			if (ptrs[i + run] != ptrs[i] + (run * block_size))
+				break;
+
+		/* A complete subtree collapses into a single block, clear its split bits a word at a time */
+		up = BUDDY_ILOG2(run);
+		for (unsigned long int split_level = level - up; split_level < level; ++split_level) {
+			split_clear_range(allocator, index_of(allocator, ptrs[i], split_level), 1UL << (split_level - (level - up)));
+			buddy_stat_add(allocator, split_level + 1, merges, 1UL << (split_level - (level - up)));
+		}
+
+		/* Release the combined block */
+		buddy_stat_add(allocator, level, frees, 1UL << up);
+		buddy_merge(allocator, ptrs[i], level - up);
+		i += 1UL << up;
+	}
+}
+
+static void buddy_layout(buddy_allocator_t *allocator)
+{
+	void *metadata = (void *)allocator + sizeof(buddy_allocator_t);
+
+	/* Carve the metadata arrays from the space following the allocator, matching buddy_sizeof_metadata() */
+#ifndef BUDDY_OUT_OF_BAND_METADATA
+	BUDDY_SET_POINTER(allocator, free_blocks, metadata);
+	metadata += sizeof(buddy_block_info_t) * (allocator->max_level + 1);
+#endif
+#if defined(BUDDY_OUT_OF_BAND_METADATA) || defined(BUDDY_ADDRESS_ORDERED)
+	BUDDY_SET_POINTER(allocator, free_hints, metadata);
+	metadata += sizeof(unsigned long int) * (allocator->max_level + 1);
+#endif
+	BUDDY_SET_POINTER(allocator, free_counts, metadata);
+	metadata += sizeof(unsigned long int) * (allocator->max_level + 1);
+#ifdef BUDDY_BLOCKED_INDEX
+	/* Start the index on a block boundary, buddy_sizeof_metadata() leaves room for it */
+	metadata = (void *)(((unsigned long int)metadata + (BUDDY_INDEX_BLOCK_BYTES - 1)) & ~(BUDDY_INDEX_BLOCK_BYTES - 1));
+#endif
+	BUDDY_SET_POINTER(allocator, block_index, metadata);
+	metadata += index_words(allocator) * sizeof(unsigned long int);
+#if defined(BUDDY_OUT_OF_BAND_METADATA) || defined(BUDDY_ADDRESS_ORDERED)
+	BUDDY_SET_POINTER(allocator, free_map, metadata);
+	metadata += BUDDY_NODE_MAP_SIZE(allocator->size, allocator->min_allocation) * sizeof(unsigned long int);
+	BUDDY_SET_POINTER(allocator, free_summary, metadata);
+	metadata += BUDDY_FREE_SUMMARY_SIZE(allocator->size, allocator->min_allocation) * sizeof(unsigned long int);
+#endif
+#ifdef BUDDY_LEVEL_MAP
+	BUDDY_SET_POINTER(allocator, level_map, metadata);
+	metadata += BUDDY_LEVEL_MAP_SIZE(allocator->size, allocator->min_allocation);
+#endif
+#ifdef BUDDY_STATS
+	BUDDY_SET_POINTER(allocator, level_stats, metadata);
+	metadata += BUDDY_STATS_SIZE(allocator->size, allocator->min_allocation);
+#endif
+#ifdef BUDDY_DEFERRED_COALESCING
+	BUDDY_SET_POINTER(allocator, deferred_blocks, metadata);
+	metadata += sizeof(buddy_block_info_t) * (allocator->max_level + 1);
+	BUDDY_SET_POINTER(allocator, deferred_counts, metadata);
+	metadata += sizeof(unsigned long int) * (allocator->max_level + 1);
+	BUDDY_SET_POINTER(allocator, deferred_limits, metadata);
+	metadata += sizeof(unsigned long int) * (allocator->max_level + 1);
+#endif
+#ifdef BUDDY_PAGE_RELEASE
+	BUDDY_SET_POINTER(allocator, released_map, metadata);
+#endif
+}
+
+static void buddy_setup(buddy_allocator_t *allocator, void *address, size_t size, size_t min_size, bool zeroed)
+{
+	unsigned long int i;
+
+	/* The leaf size must be a power of two large enough to hold the free list links */
+	if (min_size < BUDDY_MIN_LEAF_SIZE)
+		min_size = BUDDY_MIN_LEAF_SIZE;
+	min_size = 1UL << BUDDY_ILOG2(min_size);
+
+	/* Initialize allocator setup, the tree is rounded up to cover the region and only whole leaves are managed */
+	BUDDY_SET_POINTER(allocator, address, address);
+	allocator->region_size = size & ~(min_size - 1UL);
+	allocator->min_allocation = min_size;
+	allocator->total_levels = BUDDY_CLOG2(size);
+	allocator->size = 1UL << allocator->total_levels;
+	allocator->max_indexes = BUDDY_MAX_INDEXES(allocator->size, allocator->min_allocation);
+	allocator->max_level = BUDDY_MAX_LEVELS(allocator->size, allocator->min_allocation);
+	allocator->free_levels = 0;
+	allocator->available = 0;
+#ifdef BUDDY_OUT_OF_BAND_METADATA
+	allocator->policy = BUDDY_POLICY_ADDRESS;
+#else
+	allocator->policy = BUDDY_POLICY_FIFO;
+#endif
+	allocator->extra_metadata = 0;
+	buddy_layout(allocator);
+
+	/* Initial the block levels */
+	for (i = 0; i < allocator->max_level + 1; ++i) {
+#ifndef BUDDY_OUT_OF_BAND_METADATA
+		list_init(&BUDDY_GET_POINTER(allocator, free_blocks)[i]);
+#endif
+#if defined(BUDDY_OUT_OF_BAND_METADATA) || defined(BUDDY_ADDRESS_ORDERED)
+		BUDDY_GET_POINTER(allocator, free_hints)[i] = (1UL << i) - 1UL;
+#endif
+		BUDDY_GET_POINTER(allocator, free_counts)[i] = 0;
+#ifdef BUDDY_DEFERRED_COALESCING
+		list_init(&BUDDY_GET_POINTER(allocator, deferred_blocks)[i]);
+		BUDDY_GET_POINTER(allocator, deferred_counts)[i] = 0;
+		BUDDY_GET_POINTER(allocator, deferred_limits)[i] = 0;
+#endif
+	}
+#ifdef BUDDY_DEFERRED_COALESCING
+	allocator->deferred_levels = 0;
+#endif
+#ifdef BUDDY_PAGE_RELEASE
+	allocator->released = 0;
+	allocator->page_size = 0;
+	allocator->decommit = 0;
+	allocator->commit = 0;
+#endif
+	buddy_stats_reset(allocator);
+
+	/* Metadata known to be zero, such as fresh anonymous pages, is left untouched so start up does not grow with the
+	 * region and the pages of the index are only faulted in as the tree is first split there */
+	if (zeroed)
+		return;
+
+	/* Initialize the clear the block index */
+	for (i = 0; i < index_words(allocator); ++i)
+		BUDDY_GET_POINTER(allocator, block_index)[i] = 0;
+#if defined(BUDDY_OUT_OF_BAND_METADATA) || defined(BUDDY_ADDRESS_ORDERED) || defined(BUDDY_PAGE_RELEASE)
+	for (i = 0; i < BUDDY_NODE_MAP_SIZE(allocator->size, allocator->min_allocation); ++i) {
+#if defined(BUDDY_OUT_OF_BAND_METADATA) || defined(BUDDY_ADDRESS_ORDERED)
+		BUDDY_GET_POINTER(allocator, free_map)[i] = 0;
+#endif
+#ifdef BUDDY_PAGE_RELEASE
+		BUDDY_GET_POINTER(allocator, released_map)[i] = 0;
+#endif
+	}
+#endif
+#if defined(BUDDY_OUT_OF_BAND_METADATA) || defined(BUDDY_ADDRESS_ORDERED)
+	for (i = 0; i < BUDDY_FREE_SUMMARY_SIZE(allocator->size, allocator->min_allocation); ++i)
+		BUDDY_GET_POINTER(allocator, free_summary)[i] = 0;
+#endif
+}
+
+static bool buddy_reserve(buddy_allocator_t *allocator, unsigned long int index, unsigned long int level, unsigned long int head, unsigned long int tail)
+{
+	unsigned long int leaves = 1UL << (allocator->max_level - level);
+	unsigned long int first = (index - ((1UL << level) - 1UL)) << (allocator->max_level - level);
+	void *ptr = address_of(allocator, index, level);
+	bool left;
+	bool right;
+
+	/* Blocks wholly below the head leaf or at and beyond the tail leaf are in use for good */
+	if (first + leaves <= head || first >= tail) {
+		level_map_set(allocator, ptr, level);
+		return true;
+	}
+
+	/* Blocks wholly between them are free, they are the only ones ever written to */
+	if (first >= head && first + leaves <= tail) {
+		free_block_add(allocator, level, ptr);
+		return false;
+	}
+
+	/* Partially reserved blocks are split, only the edges of the range get this far so the recursion visits at most
+	 * two blocks a level */
+	bit_array_set(BUDDY_GET_POINTER(allocator, block_index), split_index(allocator, index));
+	left = buddy_reserve(allocator, (index << 1) + 1, level + 1, head, tail);
+	right = buddy_reserve(allocator, (index << 1) + 2, level + 1, head, tail);
+
+	/* The allocation bit shows exactly one child in use */
+	if (left != right)
+		bit_array_set(BUDDY_GET_POINTER(allocator, block_index), pair_index(allocator, index));
+
+	return true;
+}
+
+static void buddy_init_common(buddy_allocator_t *allocator, void *address, size_t size, size_t min_size, bool zeroed)
+{
+	buddy_setup(allocator, address, size, min_size, zeroed);
+
+	/* Free every leaf of the region, the tail of the tree beyond it stays in use */
+	buddy_reserve(allocator, 0, 0, 0, allocator->region_size / allocator->min_allocation);
+}
+
+static buddy_allocator_t *buddy_create_common(void *address, size_t size, size_t min_size, bool zeroed)
+{
+	buddy_allocator_t *allocator = address;
+
+	/* Build the allocator in place at the start of the region, so nothing is ever copied */
+	buddy_setup(allocator, address, size, min_size, zeroed);
+
+	/* Reserve enough leaves to cover the metadata, the free blocks all lie beyond it */
+	buddy_reserve(allocator, 0, 0, (buddy_sizeof_metadata(size, allocator->min_allocation) + (allocator->min_allocation - 1)) / allocator->min_allocation,
+		allocator->region_size / allocator->min_allocation);
+
+	/* All done */
+	return allocator;
+}
+
+void buddy_init_ex(buddy_allocator_t *allocator, void *address, size_t size, size_t min_size)
+{
+	buddy_init_common(allocator, address, size, min_size, false);
+}
+
+void buddy_init(buddy_allocator_t *allocator, void *address, size_t size)
+{
+	buddy_init_ex(allocator, address, size, BUDDY_MIN_LEAF_SIZE);
+}
+
+buddy_allocator_t *buddy_create_ex(void *address, size_t size, size_t min_size)
+{
+	return buddy_create_common(address, size, min_size, false);
+}
+
+buddy_allocator_t *buddy_create(void *address, size_t size)
+{
+	return buddy_create_ex(address, size, BUDDY_MIN_LEAF_SIZE);
+}
+
+void buddy_init_zeroed(buddy_allocator_t *allocator, void *address, size_t size, size_t min_size)
+{
+	buddy_init_common(allocator, address, size, min_size, true);
+}
+
+buddy_allocator_t *buddy_create_zeroed(void *address, size_t size, size_t min_size)
+{
+	return buddy_create_common(address, size, min_size, true);
+}
+
+size_t buddy_largest_available(const buddy_allocator_t *allocator)
+{
+	unsigned long int levels = allocator->free_levels;
+
+#ifdef BUDDY_DEFERRED_COALESCING
+	/* Waiting blocks can be handed out as they are */
+	levels |= allocator->deferred_levels;
+#endif
+
+	/* No blocks available */
+	if (!levels)
+		return 0;
+
+	/* The first level with a block available is the lowest set bit */
+	return allocator->size >> __builtin_ctzl(levels);
+}
+
+size_t buddy_available(const buddy_allocator_t *allocator)
+{
+	return allocator->available;
+}
+
+size_t buddy_used(const buddy_allocator_t *allocator)
+{
+	return allocator->region_size - buddy_available(allocator);
+}
+
+unsigned long int buddy_free_histogram(const buddy_allocator_t *allocator, unsigned long int *counts, unsigned long int max_levels)
+{
+	unsigned long int levels = allocator->max_level + 1;
+
+	/* Copy out as many levels as will fit */
+	if (levels > max_levels)
+		levels = max_levels;
+	for (unsigned long int level = 0; level < levels; ++level)
+		counts[level] = BUDDY_GET_POINTER(allocator, free_counts)[level];
+
+	/* Let the caller know the full histogram size */
+	return allocator->max_level + 1;
+}
+
+unsigned long int buddy_fragmentation(const buddy_allocator_t *allocator)
+{
+	/* Nothing free is nothing fragmented */
+	if (!allocator->available)
+		return 0;
+
+	/* Percentage of the free memory lying outside the largest free block */
+	return ((allocator->available - buddy_largest_available(allocator)) * 100UL) / allocator->available;
+}
+
+unsigned long int buddy_stats(const buddy_allocator_t *allocator, buddy_stats_t *stats, buddy_level_stats_t *level_stats, unsigned long int max_levels)
+{
+	unsigned long int levels = allocator->max_level + 1;
+
+	/* Snapshot the totals */
+	if (stats) {
+		stats->size = allocator->region_size;
+		stats->available = allocator->available;
+		stats->largest_available = buddy_largest_available(allocator);
+#ifdef BUDDY_PAGE_RELEASE
+		stats->released = allocator->released;
+#else
+		stats->released = 0;
+#endif
+		stats->fragmentation = buddy_fragmentation(allocator);
+		stats->totals.allocs = 0;
+		stats->totals.frees = 0;
+		stats->totals.splits = 0;
+		stats->totals.merges = 0;
+		stats->totals.failures = 0;
+		stats->totals.deferred = 0;
+		stats->totals.reused = 0;
+#ifdef BUDDY_STATS
+		for (unsigned long int level = 0; level < levels; ++level) {
+			stats->totals.allocs += BUDDY_GET_POINTER(allocator, level_stats)[level].allocs;
+			stats->totals.frees += BUDDY_GET_POINTER(allocator, level_stats)[level].frees;
+			stats->totals.splits += BUDDY_GET_POINTER(allocator, level_stats)[level].splits;
+			stats->totals.merges += BUDDY_GET_POINTER(allocator, level_stats)[level].merges;
+			stats->totals.failures += BUDDY_GET_POINTER(allocator, level_stats)[level].failures;
+			stats->totals.deferred += BUDDY_GET_POINTER(allocator, level_stats)[level].deferred;
+			stats->totals.reused += BUDDY_GET_POINTER(allocator, level_stats)[level].reused;
+		}
+#endif
+	}
+
+	/* Copy out as many levels as will fit */
+	for (unsigned long int level = 0; level_stats && level < levels && level < max_levels; ++level) {
+#ifdef BUDDY_STATS
+		level_stats[level] = BUDDY_GET_POINTER(allocator, level_stats)[level];
+#else
+		level_stats[level] = (buddy_level_stats_t){ 0 };
+#endif
+	}
+
+	/* Let the caller know the full number of levels */
+	return levels;
+}
+
+void buddy_stats_reset(buddy_allocator_t *allocator)
+{
+#ifdef BUDDY_STATS
+	for (unsigned long int level = 0; level < allocator->max_level + 1; ++level)
+		BUDDY_GET_POINTER(allocator, level_stats)[level] = (buddy_level_stats_t){ 0 };
+#endif
+}
+
+typedef struct snapshot_writer
+{
+	unsigned char *buffer;
+	size_t size;
+	size_t length;
+} snapshot_writer_t;
+
+static inline void snapshot_put_byte(snapshot_writer_t *writer, unsigned char value)
+{
+	/* Keep counting past the end so the caller learns the full length */
+	if (writer->length < writer->size)
+		writer->buffer[writer->length] = value;
+	++writer->length;
+}
+
+static void snapshot_put_u64(snapshot_writer_t *writer, unsigned long long int value)
+{
+	/* Fixed width fields are little endian whatever the host */
+	for (int i = 0; i < 8; ++i)
+		snapshot_put_byte(writer, (unsigned char)(value >> (i * 8)));
+}
+
+static void snapshot_put_varint(snapshot_writer_t *writer, unsigned long long int value)
+{
+	/* Seven bits at a time, high bit set on all but the last byte */
+	while (value >= 0x80) {
+		snapshot_put_byte(writer, (unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	snapshot_put_byte(writer, (unsigned char)value);
+}
+
+#ifdef BUDDY_BLOCKED_INDEX
+
+static inline unsigned long long int snapshot_index_word(const buddy_allocator_t *allocator, unsigned long int word)
+{
+	unsigned long int internal = (1UL << allocator->max_level) - 1UL;
+	unsigned long int half = allocator->max_indexes >> 1;
+	unsigned long long int value = 0;
+	unsigned long int bit;
+
+	/* Gather the bits in the breadth first layout, the free bits of the parents followed by the split bits */
+	for (unsigned long int i = 0; i < 64; ++i) {
+		bit = (word * 64) + i;
+		if (bit < half ? bit < internal && bit_array_is_set(BUDDY_GET_POINTER(allocator, block_index), pair_index(allocator, bit)) :
+		                 bit - half < internal && bit_array_is_set(BUDDY_GET_POINTER(allocator, block_index), split_index(allocator, bit - half)))
+			value |= 1ULL << i;
+	}
+
+	return value;
+}
+
+#else
+
+static inline unsigned long long int snapshot_index_word(const buddy_allocator_t *allocator, unsigned long int word)
+{
+	unsigned long int words = BUDDY_BLOCK_INDEX_SIZE(allocator->size, allocator->min_allocation);
+	unsigned long long int value = 0;
+
+	/* The snapshot always uses 64 bit words, gather them from narrower native words */
+	if (BUDDY_NUM_BITS == 64)
+		return BUDDY_GET_POINTER(allocator, block_index)[word];
+	for (unsigned long int i = 0; i < 64 / BUDDY_NUM_BITS; ++i) {
+		unsigned long int native = (word * (64 / BUDDY_NUM_BITS)) + i;
+		if (native < words)
+			value |= (unsigned long long int)BUDDY_GET_POINTER(allocator, block_index)[native] << (i * BUDDY_NUM_BITS);
+	}
+
+	return value;
+}
+
+#endif
+
+size_t buddy_snapshot(const buddy_allocator_t *allocator, void *buffer, size_t size)
+{
+	snapshot_writer_t writer = { buffer, size, 0 };
+	size_t available = allocator->available;
+	unsigned long int words = (allocator->max_indexes + 63) / 64;
+	unsigned long int word = 0;
+	unsigned long int zeros;
+	unsigned long int literals;
+
+#ifdef BUDDY_DEFERRED_COALESCING
+	/* Blocks waiting to merge are still in use as far as the block index is concerned */
+	for (unsigned long int level = 0; level < allocator->max_level + 1; ++level)
+		available -= BUDDY_GET_POINTER(allocator, deferred_counts)[level] * (allocator->size >> level);
+#endif
+
+	/* Header */
+	snapshot_put_u64(&writer, BUDDY_SNAPSHOT_MAGIC | ((unsigned long long int)BUDDY_SNAPSHOT_VERSION << 32));
+	snapshot_put_u64(&writer, (unsigned long int)base_of(allocator));
+	snapshot_put_u64(&writer, allocator->size);
+	snapshot_put_u64(&writer, allocator->region_size);
+	snapshot_put_u64(&writer, allocator->min_allocation);
+	snapshot_put_u64(&writer, allocator->max_level);
+	snapshot_put_u64(&writer, allocator->max_indexes);
+	snapshot_put_u64(&writer, available);
+
+	/* Free block counts */
+	for (unsigned long int level = 0; level < allocator->max_level + 1; ++level)
+		snapshot_put_varint(&writer, BUDDY_GET_POINTER(allocator, free_counts)[level]);
+
+	/* The block index as runs of zero words, which cover every untouched subtree, each followed by the non zero
+	 * words up to the next zero word */
+	while (word < words) {
+		for (zeros = 0; word < words && !snapshot_index_word(allocator, word); ++zeros)
+			++word;
+		for (literals = 0; word + literals < words && snapshot_index_word(allocator, word + literals); ++literals);
+		snapshot_put_varint(&writer, zeros);
+		snapshot_put_varint(&writer, literals);
+		for (; literals > 0; --literals)
+			snapshot_put_u64(&writer, snapshot_index_word(allocator, word++));
+	}
+
+	/* The allocation bits cannot tell which of two unsplit buddies is the free one, so add the free blocks as
+	 * offsets into their level */
+	for (unsigned long int level = 0; level < allocator->max_level + 1; ++level) {
+		void *block = free_block_first(allocator, level);
+		for (; block; block = free_block_next(allocator, level, block))
+			snapshot_put_varint(&writer, index_of(allocator, block, level) - ((1UL << level) - 1UL));
+	}
+
+	/* Let the caller know the full length */
+	return writer.length;
+}
+
+bool buddy_set_policy(buddy_allocator_t *allocator, buddy_policy_t policy)
+{
+	/* Address order needs the free map, and without free lists there is no other order */
+#ifdef BUDDY_OUT_OF_BAND_METADATA
+	if (policy != BUDDY_POLICY_ADDRESS)
+		return false;
+#elif !defined(BUDDY_ADDRESS_ORDERED)
+	if (policy == BUDDY_POLICY_ADDRESS)
+		return false;
+#endif
+	if (policy > BUDDY_POLICY_ADDRESS)
+		return false;
+
+	/* The free map is always kept up to date, so the policy can change at any time, blocks already on the lists keep their places */
+	allocator->policy = policy;
+	return true;
+}
+
+void buddy_set_watermark(buddy_allocator_t *allocator, size_t size, unsigned long int count)
+{
+#ifdef BUDDY_DEFERRED_COALESCING
+	unsigned long int level = buddy_size_to_level(allocator, size);
+
+	if (level > allocator->max_level)
+		return;
+
+	/* Merge whatever no longer fits under the watermark */
+	BUDDY_GET_POINTER(allocator, deferred_limits)[level] = count;
+	while (BUDDY_GET_POINTER(allocator, deferred_counts)[level] > count)
+		buddy_merge(allocator, deferred_block_pop(allocator, level), level);
+#endif
+}
+
+void buddy_coalesce_all(buddy_allocator_t *allocator)
+{
+#ifdef BUDDY_DEFERRED_COALESCING
+	unsigned long int level;
+
+	/* Merge every waiting block */
+	while (allocator->deferred_levels) {
+		level = __builtin_ctzl(allocator->deferred_levels);
+		while (BUDDY_GET_POINTER(allocator, deferred_counts)[level])
+			buddy_merge(allocator, deferred_block_pop(allocator, level), level);
+	}
+#endif
+}
+
+bool buddy_set_page_release(buddy_allocator_t *allocator, size_t page_size, size_t min_block, size_t low, size_t high, buddy_page_hook_t decommit, buddy_page_hook_t commit, void *context)
+{
+#ifdef BUDDY_PAGE_RELEASE
+	/* Pages are tracked a bit each in a map with room for a bit per leaf, so a page must cover whole leaves */
+	if (page_size && ((page_size & (page_size - 1)) || page_size < allocator->min_allocation))
+		return false;
+
+	/* Bring back everything released under the old settings */
+	page_unrelease(allocator, base_of(allocator), allocator->size);
+	allocator->page_size = page_size;
+	if (!page_size)
+		return true;
+
+	/* Released blocks must be a power of two with at least a page beyond the one holding the free list links */
+	if (min_block < page_keep(allocator) + page_size)
+		min_block = page_keep(allocator) + page_size;
+	allocator->release_min_block = 1UL << BUDDY_CLOG2(min_block);
+	allocator->release_low = low;
+	allocator->release_high = high > low ? high : low;
+	allocator->decommit = decommit ? decommit : buddy_pages_dontneed;
+	allocator->commit = commit;
+	allocator->page_context = context;
+
+	/* Apply the new watermarks right away */
+	if (allocator->available - allocator->released > allocator->release_high)
+		page_purge(allocator, allocator->release_low);
+
+	return true;
+#else
+	return !page_size;
+#endif
+}
+
+size_t buddy_trim(buddy_allocator_t *allocator)
+{
+#ifdef BUDDY_PAGE_RELEASE
+	if (allocator->page_size)
+		return page_purge(allocator, 0);
+#endif
+	return 0;
 }
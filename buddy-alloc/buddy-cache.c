@@ -0,0 +1,135 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <buddy-cache.h>
+
+static inline void cache_lock(buddy_cache_t *cache)
+{
+	if (cache->lock)
+		buddy_lock_acquire(cache->lock);
+}
+
+static inline void cache_unlock(buddy_cache_t *cache)
+{
+	if (cache->lock)
+		buddy_lock_release(cache->lock);
+}
+
+static inline bool cache_holds(const buddy_cache_t *cache, unsigned long int level)
+{
+	/* Only the smallest levels are cached, larger sizes and sizes beyond the tree go to the shared allocator */
+	return level >= cache->first_level && level <= cache->allocator->max_level;
+}
+
+static inline size_t cache_level_size(const buddy_cache_t *cache, unsigned long int level)
+{
+	return cache->allocator->size >> level;
+}
+
+static void cache_refill(buddy_cache_t *cache, unsigned long int level)
+{
+	buddy_cache_level_t *cached = &cache->levels[level - cache->first_level];
+	size_t size = cache_level_size(cache, level);
+
+	/* Carve a batch of blocks under a single lock acquisition */
+	cache_lock(cache);
+	cached->count += buddy_alloc_batch(cache->allocator, size, &cached->blocks[cached->count], BUDDY_CACHE_BATCH - cached->count);
+	cache_unlock(cache);
+}
+
+static void cache_drain(buddy_cache_t *cache, unsigned long int level, unsigned long int keep)
+{
+	buddy_cache_level_t *cached = &cache->levels[level - cache->first_level];
+	size_t size = cache_level_size(cache, level);
+
+	if (cached->count <= keep)
+		return;
+
+	/* Coalesce the excess back under a single lock acquisition */
+	cache_lock(cache);
+	buddy_release_batch(cache->allocator, &cached->blocks[keep], cached->count - keep, size);
+	cache_unlock(cache);
+	cached->count = keep;
+}
+
+void buddy_cache_init(buddy_cache_t *cache, buddy_allocator_t *allocator, buddy_lock_t *lock)
+{
+	cache->allocator = allocator;
+	cache->lock = lock;
+
+	/* Cache the smallest levels, small allocators may have fewer levels than the cache */
+	if (allocator->max_level + 1 > BUDDY_CACHE_LEVELS)
+		cache->first_level = allocator->max_level + 1 - BUDDY_CACHE_LEVELS;
+	else
+		cache->first_level = 0;
+
+	for (int i = 0; i < BUDDY_CACHE_LEVELS; ++i)
+		cache->levels[i].count = 0;
+}
+
+void *buddy_cache_alloc(buddy_cache_t *cache, size_t size)
+{
+	unsigned long int level = buddy_size_to_level(cache->allocator, size);
+	buddy_cache_level_t *cached;
+	void *ptr;
+
+	/* Large blocks go straight to the shared allocator, which fails cleanly on sizes beyond the tree */
+	if (!cache_holds(cache, level)) {
+		cache_lock(cache);
+		ptr = buddy_alloc(cache->allocator, size);
+		cache_unlock(cache);
+		return ptr;
+	}
+
+	/* Refill an empty level in one batch */
+	cached = &cache->levels[level - cache->first_level];
+	if (!cached->count) {
+		cache_refill(cache, level);
+		if (!cached->count)
+			return 0;
+	}
+
+	return cached->blocks[--cached->count];
+}
+
+void buddy_cache_release(buddy_cache_t *cache, void *ptr, size_t size)
+{
+	unsigned long int level;
+	buddy_cache_level_t *cached;
+
+	/* Do nothing on null pointer */
+	if (!ptr)
+		return;
+
+	/* Large blocks go straight back to the shared allocator */
+	level = buddy_size_to_level(cache->allocator, size);
+	if (!cache_holds(cache, level)) {
+		cache_lock(cache);
+		buddy_release(cache->allocator, ptr, size);
+		cache_unlock(cache);
+		return;
+	}
+
+	/* Flush a batch from a full level to make room */
+	cached = &cache->levels[level - cache->first_level];
+	if (cached->count == BUDDY_CACHE_CAPACITY)
+		cache_drain(cache, level, BUDDY_CACHE_CAPACITY - BUDDY_CACHE_BATCH);
+
+	cached->blocks[cached->count++] = ptr;
+}
+
+void buddy_cache_flush(buddy_cache_t *cache)
+{
+	buddy_cache_trim(cache, 0);
+}
+
+void buddy_cache_trim(buddy_cache_t *cache, unsigned long int keep)
+{
+	for (unsigned long int level = cache->first_level; level < cache->first_level + BUDDY_CACHE_LEVELS && level <= cache->allocator->max_level; ++level)
+		cache_drain(cache, level, keep);
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <stdint.h>
+#include <buddy-heap.h>
+
+static buddy_heap_region_t *heap_find_region(buddy_heap_t *heap, const void *ptr)
+{
+	unsigned long int low = 0;
+	unsigned long int high = heap->num_regions;
+	unsigned long int middle;
+
+	/* Binary search for the last region starting at or below the pointer */
+	while (low < high) {
+		middle = (low + high) >> 1;
+		if (heap->regions[middle].address <= ptr)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	/* Make sure the pointer falls inside it */
+	if (low == 0 || ptr >= heap->regions[low - 1].address + heap->regions[low - 1].size)
+		return 0;
+
+	return &heap->regions[low - 1];
+}
+
+static buddy_heap_region_t *heap_insert_region(buddy_heap_t *heap, void *address, size_t size, bool pinned)
+{
+	unsigned long int position;
+
+	if (heap->num_regions == BUDDY_HEAP_MAX_REGIONS)
+		return 0;
+
+	/* Keep the regions sorted by address */
+	for (position = heap->num_regions; position > 0 && heap->regions[position - 1].address > address; --position)
+		heap->regions[position] = heap->regions[position - 1];
+	++heap->num_regions;
+
+	/* Create the allocator, its internal metadata shows up as the used bytes of an empty region */
+	heap->regions[position].address = address;
+	heap->regions[position].size = size;
+	heap->regions[position].allocator = buddy_create_ex(address, size, heap->min_size);
+	heap->regions[position].overhead = buddy_used(heap->regions[position].allocator);
+	heap->regions[position].pinned = pinned;
+
+	return &heap->regions[position];
+}
+
+static void heap_remove_region(buddy_heap_t *heap, buddy_heap_region_t *region)
+{
+	unsigned long int position = region - heap->regions;
+
+	--heap->num_regions;
+	for (; position < heap->num_regions; ++position)
+		heap->regions[position] = heap->regions[position + 1];
+}
+
+static inline bool heap_region_empty(const buddy_heap_region_t *region)
+{
+	return buddy_used(region->allocator) == region->overhead;
+}
+
+bool buddy_heap_init(buddy_heap_t *heap, size_t region_size, size_t min_size, buddy_heap_grow_t grow, buddy_heap_shrink_t shrink, void *context)
+{
+	/* Grown regions double from region_size, so it must be a power of two holding at least one leaf */
+	if (!region_size || (region_size & (region_size - 1)) || region_size < min_size)
+		return false;
+
+	heap->grow = grow;
+	heap->shrink = shrink;
+	heap->context = context;
+	heap->initial_region_size = region_size;
+	heap->region_size = region_size;
+	heap->min_size = min_size;
+	heap->num_regions = 0;
+
+	return true;
+}
+
+bool buddy_heap_add_region(buddy_heap_t *heap, void *address, size_t size)
+{
+	return heap_insert_region(heap, address, size, true) != 0;
+}
+
+void *buddy_heap_alloc(buddy_heap_t *heap, size_t size)
+{
+	buddy_heap_region_t *region;
+	size_t region_size;
+	void *address;
+	void *ptr;
+
+	/* The largest available block of each region is known in constant time, only ask regions that can succeed */
+	for (unsigned long int i = 0; i < heap->num_regions; ++i)
+		if (buddy_largest_available(heap->regions[i].allocator) >= size) {
+			ptr = buddy_alloc(heap->regions[i].allocator, size);
+			if (ptr)
+				return ptr;
+		}
+
+	/* Out of memory, see if we can grow */
+	if (!heap->grow || heap->num_regions == BUDDY_HEAP_MAX_REGIONS)
+		return 0;
+
+	/* The metadata occupies the front of a region, so a block of the requested size needs twice as much, which has to
+	 * fit in the largest power of two a size_t holds */
+	if (size > (SIZE_MAX >> 2) + 1)
+		return 0;
+	region_size = heap->region_size;
+	while (region_size < size << 1)
+		region_size <<= 1;
+
+	/* Add the new region and allocate from it */
+	address = heap->grow(region_size, heap->context);
+	if (!address)
+		return 0;
+	region = heap_insert_region(heap, address, region_size, false);
+
+	/* Grow geometrically so the number of regions stays logarithmic in the heap size, short of wrapping around */
+	if (region_size << 1)
+		heap->region_size = region_size << 1;
+	return buddy_alloc(region->allocator, size);
+}
+
+void buddy_heap_release(buddy_heap_t *heap, void *ptr, size_t size)
+{
+	buddy_heap_region_t *region;
+
+	/* Do nothing on null pointer */
+	if (!ptr)
+		return;
+
+	/* Release to the region owning the address */
+	region = heap_find_region(heap, ptr);
+	if (region)
+		buddy_release(region->allocator, ptr, size);
+}
+
+void buddy_heap_free(buddy_heap_t *heap, void *ptr)
+{
+	buddy_heap_region_t *region;
+
+	/* Do nothing on null pointer */
+	if (!ptr)
+		return;
+
+	/* Free to the region owning the address */
+	region = heap_find_region(heap, ptr);
+	if (region)
+		buddy_free(region->allocator, ptr);
+}
+
+size_t buddy_heap_trim(buddy_heap_t *heap)
+{
+	size_t returned = 0;
+	unsigned long int i = 0;
+	void *address;
+	size_t size;
+
+	if (!heap->shrink)
+		return 0;
+
+	/* Hand back every grown region with nothing but metadata in use */
+	while (i < heap->num_regions) {
+		if (heap->regions[i].pinned || !heap_region_empty(&heap->regions[i])) {
+			++i;
+			continue;
+		}
+		address = heap->regions[i].address;
+		size = heap->regions[i].size;
+		heap_remove_region(heap, &heap->regions[i]);
+		heap->shrink(address, size, heap->context);
+		returned += size;
+	}
+
+	/* Restart geometric growth from the largest grown region still held */
+	heap->region_size = heap->initial_region_size;
+	for (i = 0; i < heap->num_regions; ++i)
+		if (!heap->regions[i].pinned && heap->regions[i].size << 1 > heap->region_size)
+			heap->region_size = heap->regions[i].size << 1;
+
+	return returned;
+}
+
+size_t buddy_heap_available(const buddy_heap_t *heap)
+{
+	size_t available = 0;
+
+	for (unsigned long int i = 0; i < heap->num_regions; ++i)
+		available += buddy_available(heap->regions[i].allocator);
+
+	return available;
+}
+
+size_t buddy_heap_used(const buddy_heap_t *heap)
+{
+	size_t used = 0;
+
+	for (unsigned long int i = 0; i < heap->num_regions; ++i)
+		used += buddy_used(heap->regions[i].allocator) - heap->regions[i].overhead;
+
+	return used;
+}
@@ -0,0 +1,22 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <buddy-lock.h>
+
+#if defined(__unix__)
+#include <sched.h>
+#endif
+
+void buddy_lock_relax(void)
+{
+#if defined(__unix__)
+	sched_yield();
+#endif
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <buddy-lockfree.h>
+
+/* Node status bits, after NBBS (Marotta et al, "NBBS: A Non-Blocking Buddy System"). The OCC bits of a child side
+ * mean something below that child is allocated, the COAL bits mean a free below that child is clearing the marks of
+ * its path. An allocated node is BUSY so neither its ancestors nor its descendants can be handed out. */
+#define LOCKFREE_OCC_RIGHT 0x01U
+#define LOCKFREE_OCC_LEFT 0x02U
+#define LOCKFREE_COAL_RIGHT 0x04U
+#define LOCKFREE_COAL_LEFT 0x08U
+#define LOCKFREE_OCC 0x10U
+#define LOCKFREE_BUSY (LOCKFREE_OCC | LOCKFREE_OCC_LEFT | LOCKFREE_OCC_RIGHT)
+
+#define LOCKFREE_CLAIMED (~0UL)
+#define LOCKFREE_NO_CURSOR (~0UL)
+
+/* Every thread starts searching at a different place and then carries on from its last allocation, so threads
+ * mostly claim nodes in different parts of the tree */
+static atomic_ulong next_thread_ordinal;
+static _Thread_local unsigned long int thread_cursor = LOCKFREE_NO_CURSOR;
+
+static inline unsigned long int parent_of(unsigned long int index)
+{
+	return (index - 1) >> 1;
+}
+
+static inline unsigned long int sibling_of(unsigned long int index)
+{
+	return ((index - 1) ^ 1UL) + 1;
+}
+
+static inline unsigned long int depth_of(unsigned long int index)
+{
+	return BUDDY_ILOG2(index + 1);
+}
+
+static inline unsigned char occ_bit(unsigned long int child)
+{
+	return (child & 1UL) ? LOCKFREE_OCC_LEFT : LOCKFREE_OCC_RIGHT;
+}
+
+static inline unsigned char coal_bit(unsigned long int child)
+{
+	return (child & 1UL) ? LOCKFREE_COAL_LEFT : LOCKFREE_COAL_RIGHT;
+}
+
+static inline unsigned long int index_of(const buddy_lockfree_t *allocator, const void *ptr, unsigned long int level)
+{
+	return (1UL << level) + ((ptr - allocator->address) >> (allocator->total_levels - level)) - 1UL;
+}
+
+static inline unsigned long int leaf_of(const buddy_lockfree_t *allocator, const void *ptr)
+{
+	return (ptr - allocator->address) >> (allocator->total_levels - allocator->max_level);
+}
+
+static void lockfree_unmark(buddy_lockfree_t *allocator, unsigned long int index, unsigned long int upper_bound)
+{
+	unsigned long int current = index;
+	unsigned long int child;
+	unsigned char value;
+	unsigned char cleared;
+
+	/* Clear the marks bottom up until the other half of a parent is still occupied */
+	do {
+		child = current;
+		current = parent_of(child);
+		value = atomic_load(&allocator->tree[current]);
+		do {
+			/* An allocation has taken the path back, the marks from here up are its own */
+			if (!(value & coal_bit(child)))
+				return;
+			cleared = value & ~(occ_bit(child) | coal_bit(child));
+		} while (!atomic_compare_exchange_weak(&allocator->tree[current], &value, cleared));
+	} while (depth_of(current) > upper_bound && !(cleared & occ_bit(sibling_of(child))));
+}
+
+static void lockfree_release_node(buddy_lockfree_t *allocator, unsigned long int index, unsigned long int upper_bound)
+{
+	unsigned long int runner = index;
+	unsigned char value;
+
+	/* Announce the free on the path up to the bound, stopping where the other half stays occupied */
+	while (depth_of(runner) > upper_bound) {
+		value = atomic_fetch_or(&allocator->tree[parent_of(runner)], coal_bit(runner));
+		if ((value & occ_bit(sibling_of(runner))) && !(value & coal_bit(sibling_of(runner))))
+			break;
+		runner = parent_of(runner);
+	}
+
+	/* Free the node, then take back the marks no allocation has claimed in the meantime */
+	atomic_store(&allocator->tree[index], 0);
+	if (depth_of(index) != upper_bound)
+		lockfree_unmark(allocator, index, upper_bound);
+}
+
+static unsigned long int lockfree_try_claim(buddy_lockfree_t *allocator, unsigned long int index)
+{
+	unsigned long int current = index;
+	unsigned long int child;
+	unsigned char expected = 0;
+	unsigned char value;
+	unsigned char marked;
+
+	/* The node itself must be entirely free */
+	if (!atomic_compare_exchange_strong(&allocator->tree[index], &expected, LOCKFREE_BUSY))
+		return index;
+
+	/* Mark the path to the root, backing out if an ancestor turns out to be allocated as a whole */
+	while (current > 0) {
+		child = current;
+		current = parent_of(child);
+		value = atomic_load(&allocator->tree[current]);
+		do {
+			if (value & LOCKFREE_OCC) {
+				lockfree_release_node(allocator, index, depth_of(child));
+				return current;
+			}
+			marked = (value & ~coal_bit(child)) | occ_bit(child);
+		} while (!atomic_compare_exchange_weak(&allocator->tree[current], &value, marked));
+	}
+
+	return LOCKFREE_CLAIMED;
+}
+
+void buddy_lockfree_init(buddy_lockfree_t *allocator, void *address, size_t size, size_t min_size)
+{
+	unsigned long int nodes;
+
+	/* The leaf size must be a power of two, as for the core allocator */
+	if (min_size < BUDDY_MIN_LEAF_SIZE)
+		min_size = BUDDY_MIN_LEAF_SIZE;
+	min_size = 1UL << BUDDY_ILOG2(min_size);
+
+	/* The tree covers the largest power of two fitting the region, the levels are derived from that size */
+	allocator->address = address;
+	allocator->total_levels = BUDDY_ILOG2(size);
+	allocator->size = 1UL << allocator->total_levels;
+	allocator->min_allocation = min_size;
+	allocator->max_level = allocator->total_levels - BUDDY_ILOG2(min_size);
+	atomic_init(&allocator->used, 0);
+
+	/* The status tree and the level map follow the allocator */
+	nodes = 2UL << allocator->max_level;
+	allocator->tree = (atomic_uchar *)(allocator + 1);
+	allocator->level_map = (unsigned char *)(allocator->tree + nodes);
+	for (unsigned long int i = 0; i < nodes; ++i)
+		atomic_init(&allocator->tree[i], 0);
+}
+
+void *buddy_lockfree_alloc(buddy_lockfree_t *allocator, size_t size)
+{
+	unsigned long int level;
+	unsigned long int shift;
+	unsigned long int first;
+	unsigned long int count;
+	unsigned long int start;
+	unsigned long int offset;
+	unsigned long int failed;
+	unsigned long int failed_depth;
+	unsigned long int end;
+
+	if (size > allocator->size)
+		return 0;
+
+	level = BUDDY_SIZE_TO_LEVEL(allocator->total_levels, allocator->max_level, allocator->min_allocation, size);
+	shift = allocator->total_levels - level;
+	first = (1UL << level) - 1;
+	count = 1UL << level;
+
+	if (thread_cursor == LOCKFREE_NO_CURSOR)
+		thread_cursor = atomic_fetch_add_explicit(&next_thread_ordinal, 1, memory_order_relaxed) * 0x9e3779b97f4a7c15UL;
+	start = (thread_cursor >> shift) & (count - 1);
+
+	/* Search the whole level once, wrapping around from the cursor */
+	for (unsigned long int scanned = 0; scanned < count;) {
+		offset = (start + scanned) & (count - 1);
+
+		/* Skip nodes which are allocated or have allocations below them without trying to claim them */
+		if (atomic_load_explicit(&allocator->tree[first + offset], memory_order_relaxed) & LOCKFREE_BUSY) {
+			++scanned;
+			continue;
+		}
+
+		failed = lockfree_try_claim(allocator, first + offset);
+		if (failed == LOCKFREE_CLAIMED) {
+			allocator->level_map[offset << (allocator->max_level - level)] = level;
+			atomic_fetch_add_explicit(&allocator->used, 1UL << shift, memory_order_relaxed);
+			thread_cursor = (offset + 1) << shift;
+			return allocator->address + (offset << shift);
+		}
+
+		/* Carry on after the subtree of the node which was in the way */
+		failed_depth = depth_of(failed);
+		end = (failed - ((1UL << failed_depth) - 1) + 1) << (level - failed_depth);
+		scanned += end - offset;
+	}
+
+	/* Nothing free at this level */
+	return 0;
+}
+
+void buddy_lockfree_release(buddy_lockfree_t *allocator, void *ptr, size_t size)
+{
+	unsigned long int level;
+
+	/* Do nothing on null pointer */
+	if (!ptr)
+		return;
+
+	level = BUDDY_SIZE_TO_LEVEL(allocator->total_levels, allocator->max_level, allocator->min_allocation, size);
+	atomic_fetch_sub_explicit(&allocator->used, 1UL << (allocator->total_levels - level), memory_order_relaxed);
+	lockfree_release_node(allocator, index_of(allocator, ptr, level), 0);
+}
+
+void buddy_lockfree_free(buddy_lockfree_t *allocator, void *ptr)
+{
+	unsigned long int level;
+
+	/* Do nothing on null pointer */
+	if (!ptr)
+		return;
+
+	/* The level must be read before the node is freed and the leaf can be handed out again */
+	level = allocator->level_map[leaf_of(allocator, ptr)];
+	atomic_fetch_sub_explicit(&allocator->used, 1UL << (allocator->total_levels - level), memory_order_relaxed);
+	lockfree_release_node(allocator, index_of(allocator, ptr, level), 0);
+}
+
+size_t buddy_lockfree_available(buddy_lockfree_t *allocator)
+{
+	return allocator->size - buddy_lockfree_used(allocator);
+}
+
+size_t buddy_lockfree_used(buddy_lockfree_t *allocator)
+{
+	return atomic_load_explicit(&allocator->used, memory_order_relaxed);
+}
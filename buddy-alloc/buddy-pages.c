@@ -0,0 +1,31 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <buddy-alloc.h>
+
+#if defined(__unix__)
+#include <sys/mman.h>
+#endif
+
+void buddy_pages_dontneed(void *address, size_t size, void *context)
+{
+#if defined(__unix__)
+	madvise(address, size, MADV_DONTNEED);
+#endif
+}
+
+void buddy_pages_free(void *address, size_t size, void *context)
+{
+#if defined(__unix__) && defined(MADV_FREE)
+	madvise(address, size, MADV_FREE);
+#else
+	buddy_pages_dontneed(address, size, context);
+#endif
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <stdatomic.h>
+#include <buddy-shard.h>
+
+#define BUDDY_SHARD_NO_HOME (~0UL)
+
+/* Every thread gets an ordinal on first use, its home shard is the ordinal modulo the number of shards */
+static atomic_ulong next_thread_ordinal;
+static _Thread_local unsigned long int thread_ordinal = BUDDY_SHARD_NO_HOME;
+
+static inline unsigned long int home_shard(const buddy_shards_t *shards)
+{
+	if (thread_ordinal == BUDDY_SHARD_NO_HOME)
+		thread_ordinal = atomic_fetch_add_explicit(&next_thread_ordinal, 1, memory_order_relaxed);
+	return thread_ordinal & (shards->num_shards - 1);
+}
+
+static inline buddy_shard_t *owning_shard(buddy_shards_t *shards, const void *ptr)
+{
+	unsigned long int shard = (ptr - shards->address) >> shards->shard_shift;
+
+	/* The last shard also owns the remainder of the region */
+	return &shards->shards[shard < shards->num_shards ? shard : shards->num_shards - 1];
+}
+
+bool buddy_shards_init(buddy_shards_t *shards, void *address, size_t size, unsigned long int num_shards)
+{
+	size_t shard_size;
+
+	/* Home shards and stealing wrap around with a mask */
+	if (num_shards == 0 || (num_shards & (num_shards - 1)) || size / num_shards < BUDDY_MIN_LEAF_SIZE)
+		return false;
+
+	/* Shards are a power of two in size so the owner of an address is found with a shift */
+	shard_size = 1UL << BUDDY_ILOG2(size / num_shards);
+
+	/* Initialize the shard setup */
+	shards->address = address;
+	shards->size = size;
+	shards->shard_shift = BUDDY_ILOG2(shard_size);
+	shards->num_shards = num_shards;
+
+	/* Each shard is an independent allocator with internal metadata, the last one takes what the others leave */
+	for (unsigned long int i = 0; i < num_shards; ++i) {
+		buddy_lock_init(&shards->shards[i].lock);
+		shards->shards[i].allocator = buddy_create(address + (i * shard_size), i < num_shards - 1 ? shard_size : size - (i * shard_size));
+	}
+
+	return true;
+}
+
+void *buddy_shards_alloc(buddy_shards_t *shards, size_t size)
+{
+	unsigned long int home = home_shard(shards);
+	buddy_shard_t *shard;
+	void *ptr;
+
+	/* Try the home shard first, then steal from the others in turn */
+	for (unsigned long int i = 0; i < shards->num_shards; ++i) {
+		shard = &shards->shards[(home + i) & (shards->num_shards - 1)];
+		buddy_lock_acquire(&shard->lock);
+		ptr = buddy_alloc(shard->allocator, size);
+		buddy_lock_release(&shard->lock);
+		if (ptr)
+			return ptr;
+	}
+
+	/* All shards are exhausted */
+	return 0;
+}
+
+void buddy_shards_release(buddy_shards_t *shards, void *ptr, size_t size)
+{
+	buddy_shard_t *shard;
+
+	/* Do nothing on null pointer */
+	if (!ptr)
+		return;
+
+	/* Release to the shard owning the address */
+	shard = owning_shard(shards, ptr);
+	buddy_lock_acquire(&shard->lock);
+	buddy_release(shard->allocator, ptr, size);
+	buddy_lock_release(&shard->lock);
+}
+
+void buddy_shards_free(buddy_shards_t *shards, void *ptr)
+{
+	buddy_shard_t *shard;
+
+	/* Do nothing on null pointer */
+	if (!ptr)
+		return;
+
+	/* Free to the shard owning the address */
+	shard = owning_shard(shards, ptr);
+	buddy_lock_acquire(&shard->lock);
+	buddy_free(shard->allocator, ptr);
+	buddy_lock_release(&shard->lock);
+}
+
+size_t buddy_shards_available(buddy_shards_t *shards)
+{
+	size_t available = 0;
+
+	for (unsigned long int i = 0; i < shards->num_shards; ++i) {
+		buddy_lock_acquire(&shards->shards[i].lock);
+		available += buddy_available(shards->shards[i].allocator);
+		buddy_lock_release(&shards->shards[i].lock);
+	}
+
+	return available;
+}
+
+size_t buddy_shards_used(buddy_shards_t *shards)
+{
+	return shards->size - buddy_shards_available(shards);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <buddy-shared.h>
+
+buddy_shared_t *buddy_shared_create(void *address, size_t size)
+{
+	buddy_shared_t *shared = address;
+
+	/* The allocator is built in place after the header, the magic goes last so attaching sees a complete heap */
+	buddy_lock_init(&shared->lock);
+	shared->size = size;
+	buddy_create(buddy_shared_allocator(shared), size - sizeof(buddy_shared_t));
+	shared->magic = BUDDY_SHARED_MAGIC;
+
+	return shared;
+}
+
+buddy_shared_t *buddy_shared_attach(void *address)
+{
+	buddy_shared_t *shared = address;
+	buddy_allocator_t *allocator = buddy_shared_allocator(shared);
+
+	if (shared->magic != BUDDY_SHARED_MAGIC)
+		return 0;
+
+	/* The region starts at the allocator, which only holds wherever the heap is mapped when it is relocatable */
+	if (BUDDY_GET_POINTER(allocator, address) != (void *)allocator)
+		return 0;
+
+	return shared;
+}
+
+void *buddy_shared_alloc(buddy_shared_t *shared, size_t size)
+{
+	void *ptr;
+
+	buddy_lock_acquire(&shared->lock);
+	ptr = buddy_alloc(buddy_shared_allocator(shared), size);
+	buddy_lock_release(&shared->lock);
+
+	return ptr;
+}
+
+void buddy_shared_release(buddy_shared_t *shared, void *ptr, size_t size)
+{
+	/* Do nothing on null pointer */
+	if (!ptr)
+		return;
+
+	buddy_lock_acquire(&shared->lock);
+	buddy_release(buddy_shared_allocator(shared), ptr, size);
+	buddy_lock_release(&shared->lock);
+}
+
+void buddy_shared_free(buddy_shared_t *shared, void *ptr)
+{
+	/* Do nothing on null pointer */
+	if (!ptr)
+		return;
+
+	buddy_lock_acquire(&shared->lock);
+	buddy_free(buddy_shared_allocator(shared), ptr);
+	buddy_lock_release(&shared->lock);
+}
+
+size_t buddy_shared_available(buddy_shared_t *shared)
+{
+	size_t available;
+
+	buddy_lock_acquire(&shared->lock);
+	available = buddy_available(buddy_shared_allocator(shared));
+	buddy_lock_release(&shared->lock);
+
+	return available;
+}
+
+size_t buddy_shared_used(buddy_shared_t *shared)
+{
+	size_t used;
+
+	buddy_lock_acquire(&shared->lock);
+	used = buddy_used(buddy_shared_allocator(shared));
+	buddy_lock_release(&shared->lock);
+
+	return used;
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <string.h>
+#include <buddy-slab.h>
+
+/* The objects start after the header rounded up to the quantum, which keeps them aligned like the classes */
+#define SLAB_HEADER_SIZE ((sizeof(buddy_slab_page_t) + (BUDDY_SLAB_QUANTUM - 1)) & ~(BUDDY_SLAB_QUANTUM - 1))
+
+static inline void slab_lock(buddy_slab_t *slab)
+{
+	if (slab->lock)
+		buddy_lock_acquire(slab->lock);
+}
+
+static inline void slab_unlock(buddy_slab_t *slab)
+{
+	if (slab->lock)
+		buddy_lock_release(slab->lock);
+}
+
+static inline void slab_list_init(buddy_slab_page_t *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void slab_list_add(buddy_slab_page_t *list, buddy_slab_page_t *page)
+{
+	page->next = list->next;
+	page->prev = list;
+	list->next->prev = page;
+	list->next = page;
+}
+
+static inline void slab_list_remove(buddy_slab_page_t *page)
+{
+	page->next->prev = page->prev;
+	page->prev->next = page->next;
+}
+
+static inline unsigned long int slab_class_of(size_t size)
+{
+	unsigned long int shift;
+
+	/* Quantum spaced classes */
+	if (size <= 4 * BUDDY_SLAB_QUANTUM)
+		return size ? (size - 1) / BUDDY_SLAB_QUANTUM : 0;
+
+	/* Four classes in every doubling above, size lies in (2^(shift + 2), 2^(shift + 3)] */
+	shift = BUDDY_CLOG2(size) - 3;
+	return 4 + ((shift - 4) << 2) + (((size - (1UL << (shift + 2))) + ((1UL << shift) - 1)) >> shift) - 1;
+}
+
+static inline size_t slab_class_size(unsigned long int class)
+{
+	if (class < 4)
+		return (class + 1) * BUDDY_SLAB_QUANTUM;
+	return (4UL << ((class >> 2) + 3)) + (((class & 3) + 1) << ((class >> 2) + 3));
+}
+
+static inline unsigned long int slab_objects(size_t slab_size, size_t size)
+{
+	unsigned long int objects = (slab_size - SLAB_HEADER_SIZE) / size;
+
+	return objects < BUDDY_SLAB_MAX_OBJECTS ? objects : BUDDY_SLAB_MAX_OBJECTS;
+}
+
+static inline unsigned long int slab_page_of(const buddy_slab_t *slab, const void *ptr)
+{
+	return (ptr - BUDDY_GET_POINTER(slab->allocator, address)) / BUDDY_SLAB_PAGE_SIZE;
+}
+
+static inline size_t slab_waste(size_t slab_size, size_t size)
+{
+	return slab_size - SLAB_HEADER_SIZE - (slab_objects(slab_size, size) * size);
+}
+
+static void slab_class_setup(buddy_slab_t *slab, buddy_slab_class_t *class, size_t size)
+{
+	size_t slab_size = BUDDY_SLAB_PAGE_SIZE;
+
+	/* Slabs are buddy blocks no smaller than a leaf, take the smallest leaving no more than an eighth unused */
+	if (slab_size < slab->allocator->min_allocation)
+		slab_size = slab->allocator->min_allocation;
+	while (slab_size < SLAB_HEADER_SIZE + size || slab_waste(slab_size, size) > (slab_size >> 3))
+		slab_size <<= 1;
+	class->size = size;
+	class->slab_size = slab_size;
+	class->objects = slab_objects(slab_size, size);
+
+	/* The allocator serves power of two classes of a leaf or more without rounding, a slab holding a single object
+	 * saves nothing over a buddy block and one as large as the region would not fit */
+	if ((!(size & (size - 1)) && size >= slab->allocator->min_allocation) || class->objects < 2 || slab_size >= slab->allocator->size)
+		class->objects = 0;
+
+	slab_list_init(&class->partial);
+}
+
+static buddy_slab_page_t *slab_new(buddy_slab_t *slab, unsigned long int class_index)
+{
+	buddy_slab_class_t *class = &slab->classes[class_index];
+	buddy_slab_page_t *page = buddy_alloc(slab->allocator, class->slab_size);
+
+	if (!page)
+		return 0;
+
+	/* Every object starts out free */
+	page->used = 0;
+	memset(page->free_map, 0, sizeof(page->free_map));
+	for (unsigned long int word = 0; word < class->objects / BUDDY_NUM_BITS; ++word)
+		page->free_map[word] = ~0UL;
+	if (class->objects % BUDDY_NUM_BITS)
+		page->free_map[class->objects / BUDDY_NUM_BITS] = (1UL << (class->objects % BUDDY_NUM_BITS)) - 1UL;
+
+	/* Route frees anywhere in the slab back to it */
+	memset(&slab->slab_map[slab_page_of(slab, page)], class_index + 1, class->slab_size / BUDDY_SLAB_PAGE_SIZE);
+	slab_list_add(&class->partial, page);
+
+	return page;
+}
+
+static void slab_delete(buddy_slab_t *slab, buddy_slab_class_t *class, buddy_slab_page_t *page)
+{
+	slab_list_remove(page);
+	memset(&slab->slab_map[slab_page_of(slab, page)], 0, class->slab_size / BUDDY_SLAB_PAGE_SIZE);
+	buddy_release(slab->allocator, page, class->slab_size);
+}
+
+void buddy_slab_init(buddy_slab_t *slab, buddy_allocator_t *allocator, buddy_lock_t *lock)
+{
+	slab->allocator = allocator;
+	slab->lock = lock;
+
+	/* The slab map follows the slab front end and starts out empty */
+	slab->slab_map = (unsigned char *)(slab + 1);
+	memset(slab->slab_map, 0, (allocator->size + (BUDDY_SLAB_PAGE_SIZE - 1)) / BUDDY_SLAB_PAGE_SIZE);
+
+	for (unsigned long int class = 0; class < BUDDY_SLAB_CLASSES; ++class)
+		slab_class_setup(slab, &slab->classes[class], slab_class_size(class));
+}
+
+void *buddy_slab_alloc(buddy_slab_t *slab, size_t size)
+{
+	unsigned long int class_index = slab_class_of(size);
+	buddy_slab_class_t *class = &slab->classes[class_index];
+	buddy_slab_page_t *page;
+	unsigned long int word;
+	unsigned long int object;
+	void *ptr;
+
+	/* Large objects go straight to the allocator */
+	if (size > BUDDY_SLAB_MAX_SIZE || !class->objects) {
+		slab_lock(slab);
+		ptr = buddy_alloc(slab->allocator, size);
+		slab_unlock(slab);
+		return ptr;
+	}
+
+	slab_lock(slab);
+
+	/* Take the first slab with a free object, carving a new one when there is none */
+	page = class->partial.next;
+	if (page == &class->partial) {
+		page = slab_new(slab, class_index);
+		if (!page) {
+			slab_unlock(slab);
+			return 0;
+		}
+	}
+
+	/* The lowest free object */
+	for (word = 0; !page->free_map[word]; ++word);
+	object = (word * BUDDY_NUM_BITS) + __builtin_ctzl(page->free_map[word]);
+	page->free_map[word] &= page->free_map[word] - 1;
+
+	/* Full slabs leave the list until an object is freed */
+	if (++page->used == class->objects)
+		slab_list_remove(page);
+
+	slab_unlock(slab);
+
+	return (void *)page + SLAB_HEADER_SIZE + (object * class->size);
+}
+
+void buddy_slab_free(buddy_slab_t *slab, void *ptr)
+{
+	unsigned long int class_index;
+	buddy_slab_class_t *class;
+	buddy_slab_page_t *page;
+	unsigned long int object;
+	void *base;
+
+	/* Do nothing on null pointer */
+	if (!ptr)
+		return;
+
+	slab_lock(slab);
+
+	/* Anything outside a slab came from the allocator */
+	class_index = slab->slab_map[slab_page_of(slab, ptr)];
+	if (!class_index) {
+		buddy_free(slab->allocator, ptr);
+		slab_unlock(slab);
+		return;
+	}
+
+	/* Slabs are buddy blocks so they are aligned on their size relative to the region */
+	class = &slab->classes[class_index - 1];
+	base = BUDDY_GET_POINTER(slab->allocator, address);
+	page = base + ((ptr - base) & ~(class->slab_size - 1));
+	object = (ptr - ((void *)page + SLAB_HEADER_SIZE)) / class->size;
+
+	/* A full slab has room again */
+	if (page->used == class->objects)
+		slab_list_add(&class->partial, page);
+	page->free_map[object / BUDDY_NUM_BITS] |= 1UL << (object % BUDDY_NUM_BITS);
+
+	/* Give back an empty slab unless it is the only one of its class left to allocate from */
+	if (--page->used == 0 && (page->next != &class->partial || page->prev != &class->partial))
+		slab_delete(slab, class, page);
+
+	slab_unlock(slab);
+}
+
+size_t buddy_slab_usable_size(buddy_slab_t *slab, const void *ptr)
+{
+	unsigned long int class_index;
+	size_t size;
+
+	/* Null pointers have no size */
+	if (!ptr)
+		return 0;
+
+	slab_lock(slab);
+	class_index = slab->slab_map[slab_page_of(slab, ptr)];
+	size = class_index ? slab->classes[class_index - 1].size : buddy_usable_size(slab->allocator, ptr);
+	slab_unlock(slab);
+
+	return size;
+}
+
+size_t buddy_slab_trim(buddy_slab_t *slab)
+{
+	buddy_slab_class_t *class;
+	buddy_slab_page_t *page;
+	buddy_slab_page_t *next;
+	size_t released = 0;
+
+	slab_lock(slab);
+	for (unsigned long int class_index = 0; class_index < BUDDY_SLAB_CLASSES; ++class_index) {
+		class = &slab->classes[class_index];
+		for (page = class->partial.next; page != &class->partial; page = next) {
+			next = page->next;
+			if (!page->used) {
+				slab_delete(slab, class, page);
+				released += class->slab_size;
+			}
+		}
+	}
+	slab_unlock(slab);
+
+	return released;
+}
@@ -12,54 +12,363 @@
 #include <stddef.h>
 #include <stdbool.h>
 
-/* Uncomment this if the memory region for the allocator is aligned on a address boundary equal to the size to
- * enable a minor optimization when calculating the address of the buddy.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Uncomment this if the memory region for the allocator is aligned on a address boundary equal to the size, rounded
+ * up to a power of two, to enable a minor optimization when calculating the address of the buddy.
 #define BUDDY_MEMORY_ALIGNED_ON_SIZE
 */
 
+/* Uncomment this to track free blocks in per level bitmaps kept with the metadata instead of in lists linked
+ * through the free blocks. Apart from buddy_create() placing the metadata in the region, the allocator then never
+ * reads or writes the managed memory, so it can manage lazily committed or file backed ranges, or offsets into an
+ * address space that cannot be dereferenced. Free blocks are handed out lowest address first.
+#define BUDDY_OUT_OF_BAND_METADATA
+*/
+
+/* Uncomment this to record the level of every allocated block in a packed map of ceil(log2(levels)) bits per leaf, five
+ * for 17 to 32 levels, so buddy_free() and buddy_usable_size() find the size of a block with a single lookup instead of
+ * walking the split bits up from the leaf level.
+#define BUDDY_LEVEL_MAP
+*/
+
+/* Uncomment this to count allocations, frees, splits, merges and failures at each level, see buddy_stats()
+#define BUDDY_STATS
+*/
+
+/* Uncomment this to let released blocks wait on a per level list, up to a watermark set with buddy_set_watermark(),
+ * instead of merging with their buddies right away. Allocations of the same size reuse them without splitting and
+ * they are only merged when a larger allocation would otherwise fail or on buddy_coalesce_all(). The waiting blocks
+ * are linked through themselves so this cannot be combined with BUDDY_OUT_OF_BAND_METADATA.
+#define BUDDY_DEFERRED_COALESCING
+*/
+
+/* Uncomment this to hand the pages of large free blocks back to the system through a hook once enough free memory
+ * is committed, see buddy_set_page_release(). The region must be page aligned. With in band metadata the first page
+ * of a released block is kept for the free list links.
+#define BUDDY_PAGE_RELEASE
+*/
+
+/* Uncomment this to keep the pointers of the allocator and the free list links as offsets from where they are stored,
+ * so a heap made with buddy_create() in shared memory or a mapped file stays valid wherever it is mapped, see
+ * buddy-shared.h. Use BUDDY_GET_POINTER() to read them. Page release hooks only make sense in the process setting
+ * them and the alignment of the region differs between mappings, so this cannot be combined with BUDDY_PAGE_RELEASE
+ * or BUDDY_MEMORY_ALIGNED_ON_SIZE.
+#define BUDDY_RELOCATABLE
+*/
+
+/* Uncomment this to lay out the block index as subtrees of eight levels, each in a 64 byte block with the free and
+ * split bits of every node side by side, instead of two breadth first halves. A path from a leaf to the root then
+ * touches a cache line per eight levels rather than two distant ones per level, which pays off on deep trees, at the
+ * cost of a few instructions to locate a node. buddy_snapshot() still writes the breadth first layout.
+#define BUDDY_BLOCKED_INDEX
+*/
+
+/* Uncomment this to keep a per level bitmap of the free blocks alongside the free lists, one bit per tree node, so
+ * buddy_set_policy() can hand out the lowest addressed free block of a level instead of the oldest or newest. Out of
+ * band metadata always works this way and needs no extra space for it.
+#define BUDDY_ADDRESS_ORDERED
+*/
+
+#if defined(BUDDY_DEFERRED_COALESCING) && defined(BUDDY_OUT_OF_BAND_METADATA)
+#error "BUDDY_DEFERRED_COALESCING cannot be combined with BUDDY_OUT_OF_BAND_METADATA"
+#endif
+
+#if defined(BUDDY_RELOCATABLE) && defined(BUDDY_PAGE_RELEASE)
+#error "BUDDY_RELOCATABLE cannot be combined with BUDDY_PAGE_RELEASE"
+#endif
+
+#if defined(BUDDY_RELOCATABLE) && defined(BUDDY_MEMORY_ALIGNED_ON_SIZE)
+#error "BUDDY_RELOCATABLE cannot be combined with BUDDY_MEMORY_ALIGNED_ON_SIZE"
+#endif
+
 #define BUDDY_ILOG2(value) ((BUDDY_NUM_BITS - 1UL) - __builtin_clzl(value))
+#define BUDDY_CLOG2(value) (BUDDY_NUM_BITS - __builtin_clzl((value) - 1UL))
 #define BUDDY_NUM_BITS (8 * sizeof(unsigned long int))
 #define BUDDY_MIN_LEAF_SIZE (sizeof(void *) << 1UL)
 #define BUDDY_LEAF_LEVEL_OFFSET (BUDDY_ILOG2(BUDDY_MIN_LEAF_SIZE))
-#define BUDDY_MAX_LEVELS(total_size, min_size) (BUDDY_ILOG2(total_size) - BUDDY_ILOG2(min_size))
+#define BUDDY_MAX_LEVELS(total_size, min_size) (BUDDY_CLOG2(total_size) - BUDDY_ILOG2(min_size))
+/* The level of the blocks handed out for size bytes in a tree of the given shape, usable in constant expressions */
+#define BUDDY_SIZE_TO_LEVEL(total_levels, max_level, min_size, size) ((size) < (min_size) ? (max_level) : (total_levels) - BUDDY_CLOG2(size))
 #define BUDDY_MAX_INDEXES(total_size, min_size) (1UL << (BUDDY_MAX_LEVELS(total_size, min_size) + 1))
-#define BUDDY_BLOCK_INDEX_SIZE(total_size, min_size) ((BUDDY_MAX_INDEXES(total_size, min_size) + (BUDDY_NUM_BITS - 1)) / BUDDY_NUM_BITS)
+#define BUDDY_NODE_MAP_SIZE(total_size, min_size) ((BUDDY_MAX_INDEXES(total_size, min_size) + (BUDDY_NUM_BITS - 1)) / BUDDY_NUM_BITS)
+
+#ifdef BUDDY_BLOCKED_INDEX
+/* The subtree blocks waste a node in 256 and the top one is always whole, plus room to align the index on a block */
+#define BUDDY_INDEX_BLOCK_LEVELS 8UL
+#define BUDDY_INDEX_BLOCK_BYTES 64UL
+#define BUDDY_BLOCK_INDEX_SIZE(total_size, min_size) ((BUDDY_MAX_INDEXES(total_size, min_size) + (BUDDY_MAX_INDEXES(total_size, min_size) >> 7) + \
+                                                      (8 * BUDDY_INDEX_BLOCK_BYTES) + (BUDDY_NUM_BITS - 1)) / BUDDY_NUM_BITS + \
+                                                      BUDDY_INDEX_BLOCK_BYTES / sizeof(unsigned long int))
+#else
+#define BUDDY_BLOCK_INDEX_SIZE(total_size, min_size) BUDDY_NODE_MAP_SIZE(total_size, min_size)
+#endif
+
+/* A bit per word of the free map, set while the word has any free block in it */
+#define BUDDY_FREE_SUMMARY_SIZE(total_size, min_size) ((BUDDY_NODE_MAP_SIZE(total_size, min_size) + (BUDDY_NUM_BITS - 1)) / BUDDY_NUM_BITS)
+
+#ifdef BUDDY_STATS
+#define BUDDY_STATS_SIZE(total_size, min_size) (sizeof(buddy_level_stats_t) * (BUDDY_MAX_LEVELS(total_size, min_size) + 1))
+#else
+#define BUDDY_STATS_SIZE(total_size, min_size) 0
+#endif
+
+#ifdef BUDDY_DEFERRED_COALESCING
+#define BUDDY_DEFERRED_SIZE(total_size, min_size) ((sizeof(buddy_block_info_t) + (2 * sizeof(unsigned long int))) * (BUDDY_MAX_LEVELS(total_size, min_size) + 1))
+#else
+#define BUDDY_DEFERRED_SIZE(total_size, min_size) 0
+#endif
+
+#ifdef BUDDY_PAGE_RELEASE
+#define BUDDY_PAGE_RELEASE_SIZE(total_size, min_size) (BUDDY_NODE_MAP_SIZE(total_size, min_size) * (BUDDY_NUM_BITS >> 3))
+#else
+#define BUDDY_PAGE_RELEASE_SIZE(total_size, min_size) 0
+#endif
+
+#if defined(BUDDY_ADDRESS_ORDERED) && !defined(BUDDY_OUT_OF_BAND_METADATA)
+#define BUDDY_ADDRESS_ORDER_SIZE(total_size, min_size) ((sizeof(unsigned long int) * (BUDDY_MAX_LEVELS(total_size, min_size) + 1)) + \
+                                                        BUDDY_NODE_MAP_SIZE(total_size, min_size) * (BUDDY_NUM_BITS >> 3) + \
+                                                        BUDDY_FREE_SUMMARY_SIZE(total_size, min_size) * (BUDDY_NUM_BITS >> 3))
+#else
+#define BUDDY_ADDRESS_ORDER_SIZE(total_size, min_size) 0
+#endif
+
+#ifdef BUDDY_LEVEL_MAP
+#define BUDDY_LEVEL_MAP_BITS(total_size, min_size) (BUDDY_ILOG2(BUDDY_MAX_LEVELS(total_size, min_size) | 1UL) + 1UL)
+#define BUDDY_LEVEL_MAP_SIZE(total_size, min_size) ((((BUDDY_MAX_INDEXES(total_size, min_size) >> 1) * BUDDY_LEVEL_MAP_BITS(total_size, min_size) + \
+                                                     (BUDDY_NUM_BITS - 1)) / BUDDY_NUM_BITS) * sizeof(unsigned long int))
+#else
+#define BUDDY_LEVEL_MAP_SIZE(total_size, min_size) 0
+#endif
+
+#ifdef BUDDY_RELOCATABLE
+/* A pointer kept as an offset from the structure holding it, the typed member only carries the pointer type */
+#define BUDDY_POINTER(type) union { ptrdiff_t offset; type *typed; }
+#define BUDDY_GET_POINTER(holder, field) ((__typeof__((holder)->field.typed))((char *)(holder) + (holder)->field.offset))
+#define BUDDY_SET_POINTER(holder, field, value) ((holder)->field.offset = (char *)(value) - (char *)(holder))
+#else
+#define BUDDY_POINTER(type) type *
+#define BUDDY_GET_POINTER(holder, field) ((holder)->field)
+#define BUDDY_SET_POINTER(holder, field, value) ((holder)->field = (value))
+#endif
 
 typedef struct buddy_block_info
 {
-	struct buddy_block_info *next;
-	struct buddy_block_info *prev;
+	BUDDY_POINTER(struct buddy_block_info) next;
+	BUDDY_POINTER(struct buddy_block_info) prev;
 } buddy_block_info_t;
 
+typedef struct buddy_level_stats
+{
+	unsigned long int allocs;
+	unsigned long int frees;
+	unsigned long int splits;
+	unsigned long int merges;
+	unsigned long int failures;
+	unsigned long int deferred;
+	unsigned long int reused;
+} buddy_level_stats_t;
+
+typedef struct buddy_stats
+{
+	size_t size;
+	size_t available;
+	size_t largest_available;
+	size_t released;
+	unsigned long int fragmentation;
+	buddy_level_stats_t totals;
+} buddy_stats_t;
+
+/* Which free block of a level is handed out next, the one released first, the one released last, whose memory is
+ * most likely still in the cache, or the one with the lowest address, which keeps the heap packed towards its start */
+typedef enum buddy_policy {
+	BUDDY_POLICY_FIFO,
+	BUDDY_POLICY_LIFO,
+	BUDDY_POLICY_ADDRESS,
+} buddy_policy_t;
+
+/* Called with page aligned ranges of free memory to decommit or, when it is not enough to touch them again, recommit */
+typedef void (*buddy_page_hook_t)(void *address, size_t size, void *context);
+
+/* The tree covers size bytes, the region size rounded up to a power of two, and the part beyond the region is kept
+ * permanently in use */
 typedef struct buddy_allocator
 {
-	void *address;
+	BUDDY_POINTER(void) address;
 	size_t size;
+	size_t region_size;
 	unsigned long int min_allocation;
 	unsigned long int max_indexes;
 	unsigned long int total_levels;
 	unsigned long int max_level;
-	buddy_block_info_t *free_blocks;
-	unsigned long int *block_index;
+	unsigned long int free_levels;
+	size_t available;
+	buddy_policy_t policy;
+#ifndef BUDDY_OUT_OF_BAND_METADATA
+	BUDDY_POINTER(buddy_block_info_t) free_blocks;
+#endif
+#if defined(BUDDY_OUT_OF_BAND_METADATA) || defined(BUDDY_ADDRESS_ORDERED)
+	BUDDY_POINTER(unsigned long int) free_hints;
+#endif
+	BUDDY_POINTER(unsigned long int) free_counts;
+	BUDDY_POINTER(unsigned long int) block_index;
+#if defined(BUDDY_OUT_OF_BAND_METADATA) || defined(BUDDY_ADDRESS_ORDERED)
+	BUDDY_POINTER(unsigned long int) free_map;
+	BUDDY_POINTER(unsigned long int) free_summary;
+#endif
+#ifdef BUDDY_LEVEL_MAP
+	BUDDY_POINTER(unsigned long int) level_map;
+#endif
+#ifdef BUDDY_STATS
+	BUDDY_POINTER(buddy_level_stats_t) level_stats;
+#endif
+#ifdef BUDDY_DEFERRED_COALESCING
+	unsigned long int deferred_levels;
+	BUDDY_POINTER(buddy_block_info_t) deferred_blocks;
+	BUDDY_POINTER(unsigned long int) deferred_counts;
+	BUDDY_POINTER(unsigned long int) deferred_limits;
+#endif
+#ifdef BUDDY_PAGE_RELEASE
+	BUDDY_POINTER(unsigned long int) released_map;
+	size_t released;
+	size_t page_size;
+	size_t release_min_block;
+	size_t release_low;
+	size_t release_high;
+	buddy_page_hook_t decommit;
+	buddy_page_hook_t commit;
+	void *page_context;
+#endif
 	void *extra_metadata;
 } buddy_allocator_t;
 
+#ifdef BUDDY_OUT_OF_BAND_METADATA
+#define buddy_sizeof_metadata(total_size, min_size) (sizeof(buddy_allocator_t) + \
+                                                    (sizeof(unsigned long int) * (BUDDY_MAX_LEVELS(total_size, min_size) + 1)) + \
+                                                    (sizeof(unsigned long int) * (BUDDY_MAX_LEVELS(total_size, min_size) + 1)) + \
+                                                    BUDDY_BLOCK_INDEX_SIZE(total_size, min_size) * (BUDDY_NUM_BITS >> 3) + \
+                                                    BUDDY_NODE_MAP_SIZE(total_size, min_size) * (BUDDY_NUM_BITS >> 3) + \
+                                                    BUDDY_FREE_SUMMARY_SIZE(total_size, min_size) * (BUDDY_NUM_BITS >> 3) + \
+                                                    BUDDY_LEVEL_MAP_SIZE(total_size, min_size) + \
+                                                    BUDDY_STATS_SIZE(total_size, min_size) + \
+                                                    BUDDY_PAGE_RELEASE_SIZE(total_size, min_size))
+#else
 #define buddy_sizeof_metadata(total_size, min_size) (sizeof(buddy_allocator_t) + \
                                                     (sizeof(buddy_block_info_t) * (BUDDY_MAX_LEVELS(total_size, min_size) + 1)) + \
-                                                    BUDDY_BLOCK_INDEX_SIZE(total_size, min_size) * (BUDDY_NUM_BITS >> 3))
+                                                    (sizeof(unsigned long int) * (BUDDY_MAX_LEVELS(total_size, min_size) + 1)) + \
+                                                    BUDDY_BLOCK_INDEX_SIZE(total_size, min_size) * (BUDDY_NUM_BITS >> 3) + \
+                                                    BUDDY_ADDRESS_ORDER_SIZE(total_size, min_size) + \
+                                                    BUDDY_LEVEL_MAP_SIZE(total_size, min_size) + \
+                                                    BUDDY_STATS_SIZE(total_size, min_size) + \
+                                                    BUDDY_DEFERRED_SIZE(total_size, min_size) + \
+                                                    BUDDY_PAGE_RELEASE_SIZE(total_size, min_size))
+#endif
 
 #define BUDDY_DECLARE_ALLOCATOR(name, size) unsigned long int name ## _metadata[buddy_sizeof_metadata(size, BUDDY_MIN_LEAF_SIZE)/ sizeof(unsigned long int)]; \
 											buddy_allocator_t * name = (buddy_allocator_t *)name ## _metadata
 
+#define BUDDY_DECLARE_ALLOCATOR_EX(name, size, min_size) unsigned long int name ## _metadata[buddy_sizeof_metadata(size, min_size)/ sizeof(unsigned long int)]; \
+														 buddy_allocator_t * name = (buddy_allocator_t *)name ## _metadata
 
+
+/* The region may be any size, only whole leaves are managed */
 void buddy_init(buddy_allocator_t *allocator, void *address, size_t size);
 buddy_allocator_t *buddy_create(void *address, size_t size);
+
+/* As above with a power of two leaf size of at least BUDDY_MIN_LEAF_SIZE, the smallest block ever handed out,
+ * metadata must be sized with buddy_sizeof_metadata(size, min_size) */
+void buddy_init_ex(buddy_allocator_t *allocator, void *address, size_t size, size_t min_size);
+buddy_allocator_t *buddy_create_ex(void *address, size_t size, size_t min_size);
+
+/* As buddy_init_ex() and buddy_create_ex() for metadata already filled with zeros, such as fresh anonymous mappings or
+ * calloc() memory, which is then never cleared. Start up takes the same time whatever the size of the region and
+ * the pages of the block index are only touched once the tree is split there. */
+void buddy_init_zeroed(buddy_allocator_t *allocator, void *address, size_t size, size_t min_size);
+buddy_allocator_t *buddy_create_zeroed(void *address, size_t size, size_t min_size);
+
 void *buddy_alloc(buddy_allocator_t *allocator, size_t size);
+void *buddy_alloc_aligned(buddy_allocator_t *allocator, size_t alignment, size_t size);
 void buddy_release(buddy_allocator_t *allocator, void *ptr, size_t size);
 void buddy_free(buddy_allocator_t *allocator, void *ptr);
 
+/* The level of the blocks handed out for size bytes, level zero being the whole tree. Sizes larger than the tree wrap
+ * around to beyond max_level, which the allocation functions fail cleanly on, so front ends check against it. */
+static inline unsigned long int buddy_size_to_level(const buddy_allocator_t *allocator, size_t size)
+{
+	/* Floor on the minimum allocation size, otherwise the delta between the number of levels and the first set bit in
+	 * the size rounded up to a power of two, sizes larger than the whole tree wrap around to beyond the last level */
+	return BUDDY_SIZE_TO_LEVEL(allocator->total_levels, allocator->max_level, allocator->min_allocation, size);
+}
+
+/* As buddy_alloc() and buddy_release() with the size given as its base two logarithm, rounded up, so callers knowing
+ * the size at compile time skip the conversion to a level */
+void *buddy_alloc_order(buddy_allocator_t *allocator, unsigned long int order);
+void buddy_release_order(buddy_allocator_t *allocator, void *ptr, unsigned long int order);
+
+/* Resize an allocated block, in place when shrinking or when the following buddies are free, otherwise by moving
+ * it. Returns null leaving the block untouched when no larger block is available. */
+void *buddy_realloc(buddy_allocator_t *allocator, void *ptr, size_t size);
+
+/* The size of the block holding an allocated pointer, at least the size requested */
+size_t buddy_usable_size(const buddy_allocator_t *allocator, const void *ptr);
+
+/* Allocate up to n blocks of the same size, returning how many were allocated */
+size_t buddy_alloc_batch(buddy_allocator_t *allocator, size_t size, void **ptrs, size_t n);
+
+/* Release n blocks of the same size, the ptrs array is sorted in place */
+void buddy_release_batch(buddy_allocator_t *allocator, void **ptrs, size_t n, size_t size);
+
 size_t buddy_largest_available(const buddy_allocator_t *allocator);
 size_t buddy_available(const buddy_allocator_t *allocator);
 size_t buddy_used(const buddy_allocator_t *allocator);
+unsigned long int buddy_free_histogram(const buddy_allocator_t *allocator, unsigned long int *counts, unsigned long int max_levels);
+
+/* Percentage of the free memory outside the largest free block, high values mean allocations fail for want of
+ * contiguous space rather than memory */
+unsigned long int buddy_fragmentation(const buddy_allocator_t *allocator);
+
+/* Snapshot the totals into stats and up to max_levels per level counters into level_stats, either may be null,
+ * returning the full number of levels. The counters are only maintained when built with BUDDY_STATS. */
+unsigned long int buddy_stats(const buddy_allocator_t *allocator, buddy_stats_t *stats, buddy_level_stats_t *level_stats, unsigned long int max_levels);
+void buddy_stats_reset(buddy_allocator_t *allocator);
+
+/* Select the order free blocks are reused in, returning false when the build cannot provide it. Allocators start out
+ * FIFO. Address order needs BUDDY_ADDRESS_ORDERED, and with BUDDY_OUT_OF_BAND_METADATA it is the only order. */
+bool buddy_set_policy(buddy_allocator_t *allocator, buddy_policy_t policy);
+
+/* Let up to count released blocks of the given size wait for reuse before merging, only effective when built with
+ * BUDDY_DEFERRED_COALESCING. Lowering a watermark merges the excess blocks right away. */
+void buddy_set_watermark(buddy_allocator_t *allocator, size_t size, unsigned long int count);
+
+/* Merge every block waiting for reuse */
+void buddy_coalesce_all(buddy_allocator_t *allocator);
+
+/* Decommit the pages of free blocks of at least min_block bytes once more than high bytes of free memory are committed,
+ * largest blocks first until no more than low bytes are. Released blocks are recommitted as they are handed out. A
+ * null decommit hook selects buddy_pages_dontneed(), the commit hook may be null, and a zero page size turns page
+ * release off. Returns false, leaving the settings unchanged, when the page size is not a power of two multiple of the
+ * leaf size or the build lacks BUDDY_PAGE_RELEASE. */
+bool buddy_set_page_release(buddy_allocator_t *allocator, size_t page_size, size_t min_block, size_t low, size_t high, buddy_page_hook_t decommit, buddy_page_hook_t commit, void *context);
+
+/* Decommit every eligible free block regardless of the watermarks, returning the number of bytes released */
+size_t buddy_trim(buddy_allocator_t *allocator);
+
+/* Page hooks using madvise() with MADV_DONTNEED, which drops the pages at once, or MADV_FREE, which lets the system
+ * reclaim them lazily, on hosted unix targets. They do nothing elsewhere. */
+void buddy_pages_dontneed(void *address, size_t size, void *context);
+void buddy_pages_free(void *address, size_t size, void *context);
+
+/* Serialize the allocator state for offline analysis with tools/buddy-snapshot. Writes at most size bytes and,
+ * like snprintf(), returns the full length of the snapshot, so a null buffer with zero size measures it. The
+ * snapshot is complete only when the returned length is no more than size. */
+#define BUDDY_SNAPSHOT_MAGIC 0x53594442UL
+#define BUDDY_SNAPSHOT_VERSION 2UL
+size_t buddy_snapshot(const buddy_allocator_t *allocator, void *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* BUDDY_ALLOC_H_ */
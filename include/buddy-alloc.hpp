@@ -0,0 +1,149 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#ifndef BUDDY_ALLOC_HPP_
+#define BUDDY_ALLOC_HPP_
+
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+#include <buddy-alloc.h>
+
+namespace buddy
+{
+
+/* The base two logarithm of a size rounded up, the order buddy_alloc_order() takes */
+constexpr unsigned long int order_of(std::size_t size) noexcept
+{
+	return size <= 1 ? 0 : BUDDY_NUM_BITS - __builtin_clzl(size - 1);
+}
+
+/* A polymorphic memory resource handing out blocks from an allocator, deallocation takes the sized buddy_release()
+ * path. Alignments beyond std::max_align_t are always requested from buddy_alloc_aligned(), which honours them
+ * whatever the alignment of the region, the rest from buddy_alloc(). The allocator does no locking. */
+class memory_resource : public std::pmr::memory_resource
+{
+public:
+	explicit memory_resource(buddy_allocator_t *allocator) noexcept : allocator_(allocator) {}
+
+	buddy_allocator_t *allocator() const noexcept
+	{
+		return allocator_;
+	}
+
+private:
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		void *ptr = alignment <= alignof(std::max_align_t) ? buddy_alloc(allocator_, bytes) : buddy_alloc_aligned(allocator_, alignment, bytes);
+
+		if (!ptr)
+			throw std::bad_alloc();
+		return ptr;
+	}
+
+	void do_deallocate(void *ptr, std::size_t bytes, std::size_t) override
+	{
+		buddy_release(allocator_, ptr, bytes);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+	{
+		const memory_resource *resource = dynamic_cast<const memory_resource *>(&other);
+
+		return resource && resource->allocator_ == allocator_;
+	}
+
+	buddy_allocator_t *allocator_;
+};
+
+/* A typed allocator for standard containers. Single objects, which is all node based containers ever ask for, and
+ * arrays of a length known at compile time have their order computed by the compiler, so neither allocation nor
+ * deallocation rounds the size at run time. */
+template <typename T>
+class allocator
+{
+public:
+	using value_type = T;
+
+	explicit allocator(buddy_allocator_t *allocator) noexcept : allocator_(allocator) {}
+
+	template <typename U>
+	allocator(const allocator<U> &other) noexcept : allocator_(other.allocator_) {}
+
+	buddy_allocator_t *get_allocator() const noexcept
+	{
+		return allocator_;
+	}
+
+	T *allocate(std::size_t n)
+	{
+		if (n == 1)
+			return allocate<1>();
+		if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+			throw std::bad_array_new_length();
+		return checked(alignof(T) <= alignof(std::max_align_t) ? buddy_alloc(allocator_, n * sizeof(T)) : buddy_alloc_aligned(allocator_, alignof(T), n * sizeof(T)));
+	}
+
+	void deallocate(T *ptr, std::size_t n) noexcept
+	{
+		if (n == 1)
+			deallocate<1>(ptr);
+		else
+			buddy_release(allocator_, ptr, n * sizeof(T));
+	}
+
+	template <std::size_t N>
+	T *allocate()
+	{
+		constexpr unsigned long int order = order_of(sizeof(T) * N);
+
+		if constexpr (alignof(T) <= alignof(std::max_align_t))
+			return checked(buddy_alloc_order(allocator_, order));
+		else
+			return checked(buddy_alloc_aligned(allocator_, alignof(T), sizeof(T) * N));
+	}
+
+	template <std::size_t N>
+	void deallocate(T *ptr) noexcept
+	{
+		constexpr unsigned long int order = order_of(sizeof(T) * N);
+
+		buddy_release_order(allocator_, ptr, order);
+	}
+
+	template <typename U>
+	bool operator==(const allocator<U> &other) const noexcept
+	{
+		return allocator_ == other.allocator_;
+	}
+
+	template <typename U>
+	bool operator!=(const allocator<U> &other) const noexcept
+	{
+		return allocator_ != other.allocator_;
+	}
+
+private:
+	template <typename U>
+	friend class allocator;
+
+	static T *checked(void *ptr)
+	{
+		if (!ptr)
+			throw std::bad_alloc();
+		return static_cast<T *>(ptr);
+	}
+
+	buddy_allocator_t *allocator_;
+};
+
+}
+
+#endif /* BUDDY_ALLOC_HPP_ */
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#ifndef BUDDY_CACHE_H_
+#define BUDDY_CACHE_H_
+
+#include <buddy-alloc.h>
+#include <buddy-lock.h>
+
+/* Number of the smallest block levels cached, the maximum blocks held per level and the number of blocks moved
+ * between the cache and the shared allocator on every refill or flush */
+#define BUDDY_CACHE_LEVELS 6
+#define BUDDY_CACHE_CAPACITY 32
+#define BUDDY_CACHE_BATCH 16
+
+typedef struct buddy_cache_level
+{
+	unsigned long int count;
+	void *blocks[BUDDY_CACHE_CAPACITY];
+} buddy_cache_level_t;
+
+/* A cache is owned by a single thread, typically declared _Thread_local, and fronts a shared allocator. Blocks
+ * held in the cache count as used by the shared allocator. The lock may be null when the allocator is not shared. */
+typedef struct buddy_cache
+{
+	buddy_allocator_t *allocator;
+	buddy_lock_t *lock;
+	unsigned long int first_level;
+	buddy_cache_level_t levels[BUDDY_CACHE_LEVELS];
+} buddy_cache_t;
+
+void buddy_cache_init(buddy_cache_t *cache, buddy_allocator_t *allocator, buddy_lock_t *lock);
+void *buddy_cache_alloc(buddy_cache_t *cache, size_t size);
+void buddy_cache_release(buddy_cache_t *cache, void *ptr, size_t size);
+
+/* Return every cached block to the shared allocator, call before the owning thread exits */
+void buddy_cache_flush(buddy_cache_t *cache);
+
+/* Return cached blocks to the shared allocator until at most keep blocks remain per level */
+void buddy_cache_trim(buddy_cache_t *cache, unsigned long int keep);
+
+#endif /* BUDDY_CACHE_H_ */
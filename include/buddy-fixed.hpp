@@ -0,0 +1,141 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#ifndef BUDDY_FIXED_HPP_
+#define BUDDY_FIXED_HPP_
+
+#include <cstddef>
+
+#include <buddy-alloc.hpp>
+
+namespace buddy
+{
+
+/* A buddy allocator whose size, leaf size and region alignment are template arguments, with the region and the
+ * metadata inside the object. It is a thin wrapper over the core allocator, so the block index, the compile time
+ * options and the results are those of buddy_alloc(). The levels and orders of sizes known at compile time are
+ * worked out by the compiler and go to buddy_alloc_order() and buddy_release_order(), which skip the size to level
+ * conversion. The allocator does no locking. */
+template <std::size_t Size, std::size_t Leaf = BUDDY_MIN_LEAF_SIZE, std::size_t Align = alignof(std::max_align_t)>
+class fixed_allocator
+{
+	static_assert(Size && !(Size & (Size - 1)), "the size must be a power of two");
+	static_assert(Leaf && !(Leaf & (Leaf - 1)), "the leaf size must be a power of two");
+	static_assert(Leaf >= BUDDY_MIN_LEAF_SIZE && Leaf <= Size, "the leaf size must hold a free list node and fit the region");
+	static_assert(Align && !(Align & (Align - 1)), "the alignment must be a power of two");
+
+public:
+	static constexpr unsigned long int total_levels = order_of(Size);
+	static constexpr unsigned long int max_level = total_levels - order_of(Leaf);
+
+	/* The level of the blocks handed out for size bytes, as buddy_size_to_level() */
+	static constexpr unsigned long int size_to_level(std::size_t size) noexcept
+	{
+		return BUDDY_SIZE_TO_LEVEL(total_levels, max_level, Leaf, size);
+	}
+
+	/* The order of the blocks handed out for size bytes, as buddy_alloc_order() takes it */
+	static constexpr unsigned long int size_to_order(std::size_t size) noexcept
+	{
+		return total_levels - size_to_level(size);
+	}
+
+	fixed_allocator() noexcept
+	{
+		reset();
+	}
+
+	fixed_allocator(const fixed_allocator &) = delete;
+	fixed_allocator &operator=(const fixed_allocator &) = delete;
+
+	/* Forget every allocation and make the whole region one free block again */
+	void reset() noexcept
+	{
+		buddy_init_ex(allocator(), arena_, Size, Leaf);
+	}
+
+	void *alloc(std::size_t size) noexcept
+	{
+		return buddy_alloc(allocator(), size);
+	}
+
+	void release(void *ptr, std::size_t size) noexcept
+	{
+		buddy_release(allocator(), ptr, size);
+	}
+
+	void free(void *ptr) noexcept
+	{
+		buddy_free(allocator(), ptr);
+	}
+
+	/* Sizes known at compile time skip the conversion to a level altogether */
+	template <std::size_t N>
+	void *alloc() noexcept
+	{
+		static_assert(N <= Size, "the allocation is larger than the region");
+		constexpr unsigned long int order = size_to_order(N);
+
+		return buddy_alloc_order(allocator(), order);
+	}
+
+	template <std::size_t N>
+	void release(void *ptr) noexcept
+	{
+		static_assert(N <= Size, "the allocation is larger than the region");
+		constexpr unsigned long int order = size_to_order(N);
+
+		buddy_release_order(allocator(), ptr, order);
+	}
+
+	/* The core allocator, for the rest of the C interface */
+	buddy_allocator_t *allocator() noexcept
+	{
+		return reinterpret_cast<buddy_allocator_t *>(metadata_);
+	}
+
+	const buddy_allocator_t *allocator() const noexcept
+	{
+		return reinterpret_cast<const buddy_allocator_t *>(metadata_);
+	}
+
+	void *address() noexcept
+	{
+		return arena_;
+	}
+
+	bool contains(const void *ptr) const noexcept
+	{
+		return static_cast<const unsigned char *>(ptr) >= arena_ && static_cast<const unsigned char *>(ptr) < arena_ + Size;
+	}
+
+	std::size_t available() const noexcept
+	{
+		return buddy_available(allocator());
+	}
+
+	std::size_t used() const noexcept
+	{
+		return buddy_used(allocator());
+	}
+
+private:
+	/* A build with BUDDY_MEMORY_ALIGNED_ON_SIZE needs the region aligned on its size whatever was asked for */
+#ifdef BUDDY_MEMORY_ALIGNED_ON_SIZE
+	static constexpr std::size_t region_align = Align > Size ? Align : Size;
+#else
+	static constexpr std::size_t region_align = Align > alignof(std::max_align_t) ? Align : alignof(std::max_align_t);
+#endif
+
+	alignas(region_align) unsigned char arena_[Size];
+	unsigned long int metadata_[(buddy_sizeof_metadata(Size, Leaf) + (sizeof(unsigned long int) - 1)) / sizeof(unsigned long int)];
+};
+
+}
+
+#endif /* BUDDY_FIXED_HPP_ */
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#ifndef BUDDY_HEAP_H_
+#define BUDDY_HEAP_H_
+
+#include <buddy-alloc.h>
+
+#define BUDDY_HEAP_MAX_REGIONS 64
+
+/* Called to obtain a new region of exactly size bytes, return null when no more memory is available */
+typedef void *(*buddy_heap_grow_t)(size_t size, void *context);
+
+/* Called to hand a fully free region back */
+typedef void (*buddy_heap_shrink_t)(void *address, size_t size, void *context);
+
+typedef struct buddy_heap_region
+{
+	void *address;
+	size_t size;
+	size_t overhead;
+	bool pinned;
+	buddy_allocator_t *allocator;
+} buddy_heap_region_t;
+
+/* A heap spanning discontiguous regions, each managed by an allocator with internal metadata. The regions are
+ * kept sorted by address so frees find their owner with a binary search. */
+typedef struct buddy_heap
+{
+	buddy_heap_grow_t grow;
+	buddy_heap_shrink_t shrink;
+	void *context;
+	size_t initial_region_size;
+	size_t region_size;
+	size_t min_size;
+	unsigned long int num_regions;
+	buddy_heap_region_t regions[BUDDY_HEAP_MAX_REGIONS];
+} buddy_heap_t;
+
+/* The first grown region is at least region_size bytes, a power of two, each later one twice the previous. All
+ * regions use leaves of min_size bytes. Either callback may be null, in which case the heap never grows or never
+ * gives regions back. Returns false when region_size is not a power of two or is smaller than min_size. */
+bool buddy_heap_init(buddy_heap_t *heap, size_t region_size, size_t min_size, buddy_heap_grow_t grow, buddy_heap_shrink_t shrink, void *context);
+
+/* Add a caller supplied region of any size, these are never handed to the shrink callback */
+bool buddy_heap_add_region(buddy_heap_t *heap, void *address, size_t size);
+
+void *buddy_heap_alloc(buddy_heap_t *heap, size_t size);
+void buddy_heap_release(buddy_heap_t *heap, void *ptr, size_t size);
+void buddy_heap_free(buddy_heap_t *heap, void *ptr);
+
+/* Give every fully free grown region back through the shrink callback, returns the number of bytes returned */
+size_t buddy_heap_trim(buddy_heap_t *heap);
+
+size_t buddy_heap_available(const buddy_heap_t *heap);
+size_t buddy_heap_used(const buddy_heap_t *heap);
+
+#endif /* BUDDY_HEAP_H_ */
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#ifndef BUDDY_LOCK_H_
+#define BUDDY_LOCK_H_
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/* A minimal test and test-and-set spin lock, built only on C11 atomics so it works on bare metal targets and,
+ * being address free, in memory shared between processes */
+typedef struct buddy_lock
+{
+	atomic_bool locked;
+} buddy_lock_t;
+
+#define BUDDY_LOCK_INIT { false }
+
+/* Number of spins on a held lock before giving up the processor */
+#define BUDDY_LOCK_SPINS 64
+
+/* Yield to other threads on hosted targets, does nothing on bare metal */
+void buddy_lock_relax(void);
+
+static inline void buddy_lock_init(buddy_lock_t *lock)
+{
+	atomic_init(&lock->locked, false);
+}
+
+static inline bool buddy_lock_try(buddy_lock_t *lock)
+{
+	return !atomic_load_explicit(&lock->locked, memory_order_relaxed) && !atomic_exchange_explicit(&lock->locked, true, memory_order_acquire);
+}
+
+static inline void buddy_lock_acquire(buddy_lock_t *lock)
+{
+	int spins = 0;
+
+	/* Spin on a plain load so waiters do not bounce the cache line, yielding so a preempted owner can finish */
+	while (atomic_exchange_explicit(&lock->locked, true, memory_order_acquire))
+		while (atomic_load_explicit(&lock->locked, memory_order_relaxed))
+			if (++spins % BUDDY_LOCK_SPINS == 0)
+				buddy_lock_relax();
+}
+
+static inline void buddy_lock_release(buddy_lock_t *lock)
+{
+	atomic_store_explicit(&lock->locked, false, memory_order_release);
+}
+
+#endif /* BUDDY_LOCK_H_ */
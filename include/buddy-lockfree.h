@@ -0,0 +1,50 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#ifndef BUDDY_LOCKFREE_H_
+#define BUDDY_LOCKFREE_H_
+
+#include <stdatomic.h>
+#include <buddy-alloc.h>
+
+/* An experimental non-blocking buddy allocator. Every block in the tree has a status byte which allocations and
+ * frees update with compare and swap, marking the path to the root as they go, so threads never wait for each other
+ * and there are no free lists, an allocation searches the level for a node whose status shows it free. Blocks may
+ * be freed from any thread. The level of each allocated block is kept in a byte per leaf for buddy_lockfree_free().
+ * The whole region is managed, the metadata is always kept outside it. */
+typedef struct buddy_lockfree
+{
+	void *address;
+	size_t size;
+	unsigned long int min_allocation;
+	unsigned long int total_levels;
+	unsigned long int max_level;
+	atomic_size_t used;
+	atomic_uchar *tree;
+	unsigned char *level_map;
+} buddy_lockfree_t;
+
+#define buddy_lockfree_sizeof_metadata(total_size, min_size) (sizeof(buddy_lockfree_t) + \
+                                                             BUDDY_MAX_INDEXES(total_size, min_size) + \
+                                                             (BUDDY_MAX_INDEXES(total_size, min_size) >> 1))
+
+#define BUDDY_DECLARE_LOCKFREE(name, size, min_size) unsigned long int name ## _metadata[(buddy_lockfree_sizeof_metadata(size, min_size) + (sizeof(unsigned long int) - 1)) / sizeof(unsigned long int)]; \
+													 buddy_lockfree_t * name = (buddy_lockfree_t *)name ## _metadata
+
+/* The leaf size must be a power of two of at least BUDDY_MIN_LEAF_SIZE and no larger than the region. A region whose
+ * size is not a power of two is rounded down to one, the rest of it is never handed out. */
+void buddy_lockfree_init(buddy_lockfree_t *allocator, void *address, size_t size, size_t min_size);
+void *buddy_lockfree_alloc(buddy_lockfree_t *allocator, size_t size);
+void buddy_lockfree_release(buddy_lockfree_t *allocator, void *ptr, size_t size);
+void buddy_lockfree_free(buddy_lockfree_t *allocator, void *ptr);
+
+/* Exact when no other thread is allocating or freeing */
+size_t buddy_lockfree_available(buddy_lockfree_t *allocator);
+size_t buddy_lockfree_used(buddy_lockfree_t *allocator);
+
+#endif /* BUDDY_LOCKFREE_H_ */
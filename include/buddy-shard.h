@@ -0,0 +1,49 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#ifndef BUDDY_SHARD_H_
+#define BUDDY_SHARD_H_
+
+#include <buddy-alloc.h>
+#include <buddy-lock.h>
+
+/* Shards are padded to this size to keep their locks from sharing a cache line */
+#define BUDDY_SHARD_ALIGNMENT 64
+
+typedef struct buddy_shard
+{
+	_Alignas(BUDDY_SHARD_ALIGNMENT) buddy_lock_t lock;
+	buddy_allocator_t *allocator;
+} buddy_shard_t;
+
+typedef struct buddy_shards
+{
+	void *address;
+	size_t size;
+	unsigned long int shard_shift;
+	unsigned long int num_shards;
+	buddy_shard_t shards[];
+} buddy_shards_t;
+
+#define buddy_shards_sizeof_metadata(num_shards) (sizeof(buddy_shards_t) + (sizeof(buddy_shard_t) * (num_shards)))
+
+#define BUDDY_DECLARE_SHARDS(name, num_shards) buddy_shard_t name ## _metadata[(buddy_shards_sizeof_metadata(num_shards) + (sizeof(buddy_shard_t) - 1)) / sizeof(buddy_shard_t)]; \
+											   buddy_shards_t * name = (buddy_shards_t *)name ## _metadata
+
+/* The number of shards must be a power of two, each shard manages size / num_shards bytes rounded down to a power of
+ * two with internal metadata and the last one also the remainder. Returns false for any other number of shards,
+ * or when the region is too small to give each a leaf. */
+bool buddy_shards_init(buddy_shards_t *shards, void *address, size_t size, unsigned long int num_shards);
+void *buddy_shards_alloc(buddy_shards_t *shards, size_t size);
+void buddy_shards_release(buddy_shards_t *shards, void *ptr, size_t size);
+void buddy_shards_free(buddy_shards_t *shards, void *ptr);
+
+size_t buddy_shards_available(buddy_shards_t *shards);
+size_t buddy_shards_used(buddy_shards_t *shards);
+
+#endif /* BUDDY_SHARD_H_ */
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#ifndef BUDDY_SHARED_H_
+#define BUDDY_SHARED_H_
+
+#include <buddy-alloc.h>
+#include <buddy-lock.h>
+
+#define BUDDY_SHARED_MAGIC 0x48534442UL
+
+/* The header is padded to this size to keep the lock off the cache line of the allocator which follows it */
+#define BUDDY_SHARED_ALIGNMENT 64
+
+/* A heap in memory shared between processes or in a mapped file, guarded by a lock kept in the heap itself. The lock
+ * is address free so it works from every process mapping the heap. When built with BUDDY_RELOCATABLE each process
+ * may map the heap at a different address, otherwise they must all map it where it was created. The region follows
+ * the header so it is never aligned on its size. A process dying while holding the lock leaves it held. */
+typedef struct buddy_shared
+{
+	_Alignas(BUDDY_SHARED_ALIGNMENT) buddy_lock_t lock;
+	unsigned long int magic;
+	size_t size;
+} buddy_shared_t;
+
+/* The heap has internal metadata, the allocator follows the header */
+buddy_shared_t *buddy_shared_create(void *address, size_t size);
+
+/* Returns null when the memory does not hold a shared heap or the heap cannot be used at this address */
+buddy_shared_t *buddy_shared_attach(void *address);
+
+void *buddy_shared_alloc(buddy_shared_t *shared, size_t size);
+void buddy_shared_release(buddy_shared_t *shared, void *ptr, size_t size);
+void buddy_shared_free(buddy_shared_t *shared, void *ptr);
+
+size_t buddy_shared_available(buddy_shared_t *shared);
+size_t buddy_shared_used(buddy_shared_t *shared);
+
+static inline buddy_allocator_t *buddy_shared_allocator(buddy_shared_t *shared)
+{
+	return (buddy_allocator_t *)(shared + 1);
+}
+
+/* Allocations are passed between processes as offsets from the heap, which are the same in every mapping, zero
+ * stands for a null pointer */
+static inline size_t buddy_shared_offset(const buddy_shared_t *shared, const void *ptr)
+{
+	return ptr ? (size_t)((const char *)ptr - (const char *)shared) : 0;
+}
+
+static inline void *buddy_shared_pointer(buddy_shared_t *shared, size_t offset)
+{
+	return offset ? (char *)shared + offset : 0;
+}
+
+#endif /* BUDDY_SHARED_H_ */
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#ifndef BUDDY_SLAB_H_
+#define BUDDY_SLAB_H_
+
+#include <buddy-alloc.h>
+#include <buddy-lock.h>
+
+/* The smallest slab and the granule of the slab map, and the largest object served from slabs, anything larger goes
+ * straight to the buddy allocator */
+#define BUDDY_SLAB_PAGE_SIZE 4096UL
+#define BUDDY_SLAB_MAX_SIZE 16384UL
+
+/* Size classes are 16 bytes apart up to 64 bytes, then four to every doubling, each a quarter of the power of two
+ * above the last, so no object is rounded up by more than 25% */
+#define BUDDY_SLAB_QUANTUM 16UL
+#define BUDDY_SLAB_CLASSES (4UL + (4UL * (BUDDY_ILOG2(BUDDY_SLAB_MAX_SIZE) - 6UL)))
+
+/* Enough free bits for the smallest class in the smallest slab */
+#define BUDDY_SLAB_MAP_WORDS ((BUDDY_SLAB_PAGE_SIZE / BUDDY_SLAB_QUANTUM + (BUDDY_NUM_BITS - 1)) / BUDDY_NUM_BITS)
+#define BUDDY_SLAB_MAX_OBJECTS (BUDDY_SLAB_MAP_WORDS * BUDDY_NUM_BITS)
+
+/* Every slab starts with this header, the objects follow it */
+typedef struct buddy_slab_page
+{
+	struct buddy_slab_page *next;
+	struct buddy_slab_page *prev;
+	unsigned long int used;
+	unsigned long int free_map[BUDDY_SLAB_MAP_WORDS];
+} buddy_slab_page_t;
+
+typedef struct buddy_slab_class
+{
+	size_t size;
+	size_t slab_size;
+	unsigned long int objects;
+	buddy_slab_page_t partial;
+} buddy_slab_class_t;
+
+/* A front end carving slabs from a buddy allocator into size classes. Slabs with free objects are kept on a list per
+ * class, and an empty slab goes back to the allocator unless it is the last one of its class. A byte per page of the
+ * region records the class of the slab covering it, which routes frees to either layer. The lock may be null when
+ * neither the slabs nor the allocator are shared, otherwise it guards both. */
+typedef struct buddy_slab
+{
+	buddy_allocator_t *allocator;
+	buddy_lock_t *lock;
+	unsigned char *slab_map;
+	buddy_slab_class_t classes[BUDDY_SLAB_CLASSES];
+} buddy_slab_t;
+
+#define buddy_slab_sizeof_metadata(total_size) (sizeof(buddy_slab_t) + ((1UL << BUDDY_CLOG2(total_size)) + (BUDDY_SLAB_PAGE_SIZE - 1)) / BUDDY_SLAB_PAGE_SIZE)
+
+#define BUDDY_DECLARE_SLAB(name, size) unsigned long int name ## _metadata[(buddy_slab_sizeof_metadata(size) + (sizeof(unsigned long int) - 1)) / sizeof(unsigned long int)]; \
+									   buddy_slab_t * name = (buddy_slab_t *)name ## _metadata
+
+/* The metadata must be sized with buddy_slab_sizeof_metadata() for the size of the region of the allocator */
+void buddy_slab_init(buddy_slab_t *slab, buddy_allocator_t *allocator, buddy_lock_t *lock);
+void *buddy_slab_alloc(buddy_slab_t *slab, size_t size);
+void buddy_slab_free(buddy_slab_t *slab, void *ptr);
+size_t buddy_slab_usable_size(buddy_slab_t *slab, const void *ptr);
+
+/* Return the empty slabs kept for each class to the allocator, returning the number of bytes released */
+size_t buddy_slab_trim(buddy_slab_t *slab);
+
+#endif /* BUDDY_SLAB_H_ */
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <buddy-alloc.h>
+
+#define ALIGNED_MEMORY_SIZE (1024UL * 1024UL)
+#define ALIGNED_MAX_BLOCKS 1024
+
+static buddy_allocator_t *aligned_create(void *address, size_t size)
+{
+	/* Metadata kept apart so the whole region is free */
+	buddy_allocator_t *allocator = malloc(buddy_sizeof_metadata(size, BUDDY_MIN_LEAF_SIZE));
+
+	if (allocator)
+		buddy_init(allocator, address, size);
+
+	return allocator;
+}
+
+static inline bool aligned_on(const void *ptr, size_t alignment)
+{
+	return !((unsigned long int)ptr & (alignment - 1));
+}
+
+static bool aligned_check_above_block_size(void *memory)
+{
+	buddy_allocator_t *allocator = aligned_create(memory, ALIGNED_MEMORY_SIZE);
+	size_t available;
+	void *ptr;
+	bool ok;
+
+	if (!allocator)
+		return false;
+	available = buddy_available(allocator);
+
+	/* The rest of the block the size of the alignment goes back to the free lists */
+	ptr = buddy_alloc_aligned(allocator, 4096, 48);
+	ok = ptr && aligned_on(ptr, 4096) && buddy_usable_size(allocator, ptr) == 64 && buddy_available(allocator) == available - 64;
+	buddy_free(allocator, ptr);
+
+	/* Sized releases work as well */
+	ptr = buddy_alloc_aligned(allocator, 64 * 1024, 4096);
+	ok = ok && ptr && aligned_on(ptr, 64 * 1024) && buddy_available(allocator) == available - 4096;
+	buddy_release(allocator, ptr, 4096);
+
+	/* Alignments which are not powers of two are refused */
+	ok = ok && !buddy_alloc_aligned(allocator, 48, 64);
+
+	buddy_coalesce_all(allocator);
+	ok = ok && buddy_available(allocator) == available;
+
+	free(allocator);
+	return ok;
+}
+
+static bool aligned_check_above_region_size(void *memory)
+{
+	buddy_allocator_t *allocator = aligned_create(memory, ALIGNED_MEMORY_SIZE);
+	size_t available;
+	void *ptr;
+	bool ok;
+
+	if (!allocator)
+		return false;
+	available = buddy_available(allocator);
+
+	/* The region starts on the only address aligned on twice its size, a second block cannot */
+	ptr = buddy_alloc_aligned(allocator, 2 * ALIGNED_MEMORY_SIZE, 64);
+	ok = ptr == memory && !buddy_alloc_aligned(allocator, 2 * ALIGNED_MEMORY_SIZE, 64);
+	buddy_free(allocator, ptr);
+	buddy_coalesce_all(allocator);
+	ok = ok && buddy_available(allocator) == available;
+	free(allocator);
+
+#ifndef BUDDY_MEMORY_ALIGNED_ON_SIZE
+	/* Starting half way up, the region holds no address aligned on twice its size at all */
+	allocator = aligned_create((unsigned char *)memory + ALIGNED_MEMORY_SIZE, ALIGNED_MEMORY_SIZE);
+	if (!allocator)
+		return false;
+	ok = ok && !buddy_alloc_aligned(allocator, 2 * ALIGNED_MEMORY_SIZE, 64) && buddy_available(allocator) == available;
+	free(allocator);
+#endif
+
+	return ok;
+}
+
+#ifndef BUDDY_MEMORY_ALIGNED_ON_SIZE
+
+static bool aligned_check_unaligned_base(void *memory)
+{
+	static void *ptrs[ALIGNED_MAX_BLOCKS];
+	unsigned char *base = (unsigned char *)memory + (3 * 4096);
+	size_t size = ALIGNED_MEMORY_SIZE / 2;
+	buddy_allocator_t *allocator = aligned_create(base, size);
+	unsigned char *candidate;
+	size_t candidates = 0;
+	size_t available;
+	size_t count;
+	bool ok;
+
+	if (!allocator)
+		return false;
+	available = buddy_available(allocator);
+
+	/* Blocks larger than the alignment of the base never start on an aligned address */
+	ok = !buddy_alloc_aligned(allocator, 16 * 1024, 8 * 1024);
+
+	/* Smaller ones are found inside larger free blocks, every aligned address in the region is handed out once */
+	for (candidate = (unsigned char *)((unsigned long int)(base + (16 * 1024) - 1) & ~((16 * 1024) - 1UL)); candidate + 64 <= base + size; candidate += 16 * 1024)
+		++candidates;
+	for (count = 0; count < ALIGNED_MAX_BLOCKS; ++count) {
+		ptrs[count] = buddy_alloc_aligned(allocator, 16 * 1024, 64);
+		if (!ptrs[count])
+			break;
+		ok = ok && aligned_on(ptrs[count], 16 * 1024) && (unsigned char *)ptrs[count] >= base && (unsigned char *)ptrs[count] + 64 <= base + size;
+	}
+
+	/* Then it fails for want of an aligned candidate, although most of the region is free */
+	ok = ok && count == candidates && buddy_available(allocator) == available - (count * 64) && buddy_alloc(allocator, 4096);
+
+	for (size_t i = 0; i < count; ++i)
+		buddy_free(allocator, ptrs[i]);
+
+	free(allocator);
+	return ok;
+}
+
+#endif
+
+int main(int argc, char **argv)
+{
+	/* Aligned on twice the size of the regions carved from it */
+	void *memory = aligned_alloc(2 * ALIGNED_MEMORY_SIZE, 2 * ALIGNED_MEMORY_SIZE);
+
+	if (!memory)
+		return 1;
+
+	if (!aligned_check_above_block_size(memory)) {
+		fprintf(stderr, "alignments above the block size misbehaved\n");
+		return 1;
+	}
+	if (!aligned_check_above_region_size(memory)) {
+		fprintf(stderr, "alignments above the region size misbehaved\n");
+		return 1;
+	}
+#ifndef BUDDY_MEMORY_ALIGNED_ON_SIZE
+	if (!aligned_check_unaligned_base(memory)) {
+		fprintf(stderr, "alignments on an unaligned region misbehaved\n");
+		return 1;
+	}
+#endif
+
+	free(memory);
+	printf("aligned: block size, region size and unaligned base checks passed\n");
+
+	return 0;
+}
@@ -37,7 +37,7 @@ static inline bool bit_array_is_set(const unsigned long int *bit_array, unsigned
 
 static inline unsigned long int index_of(const buddy_allocator_t *allocator, const void *ptr, unsigned long int level)
 {
-	return (1UL << level) + ((ptr - allocator->address) >> (allocator->total_levels - level)) - 1UL;
+	return (1UL << level) + ((ptr - BUDDY_GET_POINTER(allocator, address)) >> (allocator->total_levels - level)) - 1UL;
 }
 
 static inline unsigned long int free_index(const buddy_allocator_t *allocator, unsigned long int index)
@@ -58,14 +58,38 @@ static void buddy_dump_free_blocks(const buddy_allocator_t *allocator)
 	printf("free blocks:\n");
 	for (unsigned long int level = 0; level < allocator->max_level + 1; ++level) {
 		printf(buffer, "\t%6zu: ", allocator->size >> level);
-		for (buddy_block_info_t *cursor = allocator->free_blocks[level].next; cursor != &allocator->free_blocks[level]; cursor = cursor->next) {
+#ifdef BUDDY_OUT_OF_BAND_METADATA
+		for (unsigned long int index = (1UL << level) - 1; index < (2UL << level) - 1; ++index) {
+			if (BUDDY_GET_POINTER(allocator, free_map)[index / BUDDY_NUM_BITS] & (1UL << (index % BUDDY_NUM_BITS)))
+				printf(buffer, "%lu ", index);
+		}
+#else
+		buddy_block_info_t *list = &BUDDY_GET_POINTER(allocator, free_blocks)[level];
+		for (buddy_block_info_t *cursor = BUDDY_GET_POINTER(list, next); cursor != list; cursor = BUDDY_GET_POINTER(cursor, next)) {
 			printf(buffer, "%p(%lu) ", cursor, index_of(allocator, cursor, level));
 		}
+#endif
 		printf("\n");
 	}
 	printf("\n");
 }
 
+#ifdef BUDDY_BLOCKED_INDEX
+
+static void buddy_dump_block_index(const buddy_allocator_t *allocator)
+{
+	unsigned long int words = BUDDY_BLOCK_INDEX_SIZE(allocator->size, allocator->min_allocation);
+	unsigned long int block_words = BUDDY_INDEX_BLOCK_BYTES / sizeof(unsigned long int);
+
+	/* The blocked layout is dumped as stored, a block of free and split bits to a line */
+	printf("block index:\n");
+	for (unsigned long int word = 0; word < words; ++word)
+		printf("%s%016lx%s", word % block_words ? " " : "\t", BUDDY_GET_POINTER(allocator, block_index)[word], (word + 1) % block_words && word + 1 < words ? "" : "\n");
+	printf("\n");
+}
+
+#else
+
 static void buddy_dump_free_index(const buddy_allocator_t *allocator)
 {
 	char buffer[128];
@@ -78,7 +102,7 @@ static void buddy_dump_free_index(const buddy_allocator_t *allocator)
 		/* Loop through the indexes at this level */
 		printf(buffer, "\t%6u - %4lu:%-4lu: ", allocator->size >> (level + 1), bta_first_of_level(level + 1), bta_last_of_level(level + 1) - 1);
 		for (unsigned long int index = bta_first_of_level(level); index < bta_last_of_level(level); ++index)
-			printf(bit_array_is_set(allocator->block_index, index) ? "1" : "0");
+			printf(bit_array_is_set(BUDDY_GET_POINTER(allocator, block_index), index) ? "1" : "0");
 		printf("\n");
 	}
 	printf("\n");
@@ -96,19 +120,22 @@ static void buddy_dump_split_index(const buddy_allocator_t *allocator)
 		/* Loop through the indexes at this level */
 		printf(buffer, "\t%6u - %4lu:%-4lu: ", allocator->size >> level, bta_first_of_level(level), bta_last_of_level(level) - 1);
 		for (unsigned long int index = bta_first_of_level(level); index < bta_last_of_level(level); ++index)
-			printf(bit_array_is_set(allocator->block_index, split_index(allocator, index)) ? "1" : "0");
+			printf(bit_array_is_set(BUDDY_GET_POINTER(allocator, block_index), split_index(allocator, index)) ? "1" : "0");
 		printf("\n");
 	}
 	printf("\n");
 }
 
+#endif
+
 static void buddy_dump_info(const buddy_allocator_t *allocator)
 {
 	char buffer[128];
 
 	printf(buffer, "allocator @ %p\n", allocator);
-	printf(buffer, "\taddress:        %p\n", allocator->address);
+	printf(buffer, "\taddress:        %p\n", BUDDY_GET_POINTER(allocator, address));
 	printf(buffer, "\tsize:           %zu\n", allocator->size);
+	printf(buffer, "\tregion size:    %zu\n", allocator->region_size);
 	printf(buffer, "\ttotal levels:   %lu\n", allocator->total_levels);
 	printf(buffer, "\tmax level:      %lu\n", allocator->max_level);
 	printf(buffer, "\tmax allocation: %zu\n", allocator->size);
@@ -123,8 +150,12 @@ static void buddy_dump_allocator(const buddy_allocator_t *allocator)
 {
 	buddy_dump_info(allocator);
 	buddy_dump_free_blocks(allocator);
+#ifdef BUDDY_BLOCKED_INDEX
+	buddy_dump_block_index(allocator);
+#else
 	buddy_dump_split_index(allocator);
 	buddy_dump_free_index(allocator);
+#endif
 }
 
 int main(int argc, char **argv)
@@ -179,5 +210,19 @@ int main(int argc, char **argv)
 	printf("terminating state\n");
 	buddy_dump_allocator(allocator);
 
+	printf("testing odd sized region\n");
+	buddy_init(global_allocator, memory, BUDDY_MEMORY_SIZE - (3 * BUDDY_MIN_LEAF_SIZE) - 5);
+	printf("starting state\n");
+	buddy_dump_allocator(global_allocator);
+
+	unsigned long int leaves = 0;
+	while (buddy_alloc(global_allocator, BUDDY_MIN_LEAF_SIZE))
+		++leaves;
+	printf("allocated %lu of %lu leaves\n", leaves, (BUDDY_MEMORY_SIZE / BUDDY_MIN_LEAF_SIZE) - 4);
+	for (unsigned long int i = 0; i < leaves; ++i)
+		buddy_free(global_allocator, memory + (i * BUDDY_MIN_LEAF_SIZE));
+	printf("terminating state\n");
+	buddy_dump_allocator(global_allocator);
+
 	return 0;
 }
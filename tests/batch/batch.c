@@ -0,0 +1,211 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <buddy-alloc.h>
+
+#define BATCH_MEMORY_SIZE (1024UL * 1024UL)
+#define BATCH_BLOCK_SIZE 256UL
+#define BATCH_MAX_BLOCKS (BATCH_MEMORY_SIZE / BATCH_BLOCK_SIZE)
+#define BATCH_MIXED_BLOCKS 256
+#define BATCH_MAX_LEVELS 64
+
+static void *ptrs[BATCH_MAX_BLOCKS + 64];
+static void *reference_ptrs[BATCH_MAX_BLOCKS];
+static void *picked[BATCH_MAX_BLOCKS];
+
+static buddy_allocator_t *batch_create(void)
+{
+	/* Aligned on its size so builds with BUDDY_MEMORY_ALIGNED_ON_SIZE work too */
+	void *memory = aligned_alloc(BATCH_MEMORY_SIZE, BATCH_MEMORY_SIZE);
+
+	return memory ? buddy_create(memory, BATCH_MEMORY_SIZE) : 0;
+}
+
+static int batch_compare(const void *a, const void *b)
+{
+	const unsigned char *left = *(void * const *)a;
+	const unsigned char *right = *(void * const *)b;
+
+	return (left > right) - (left < right);
+}
+
+static bool batch_same_state(buddy_allocator_t *a, buddy_allocator_t *b)
+{
+	unsigned long int a_counts[BATCH_MAX_LEVELS];
+	unsigned long int b_counts[BATCH_MAX_LEVELS];
+	unsigned long int levels;
+
+	/* Blocks waiting to merge would hide differences in the tree */
+	buddy_coalesce_all(a);
+	buddy_coalesce_all(b);
+	levels = buddy_free_histogram(a, a_counts, BATCH_MAX_LEVELS);
+	if (levels != buddy_free_histogram(b, b_counts, BATCH_MAX_LEVELS))
+		return false;
+
+	return buddy_available(a) == buddy_available(b) && !memcmp(a_counts, b_counts, levels * sizeof(unsigned long int));
+}
+
+static size_t batch_capacity(buddy_allocator_t *allocator, size_t size)
+{
+	unsigned long int counts[BATCH_MAX_LEVELS];
+	unsigned long int levels;
+	size_t capacity = 0;
+
+	/* Every free block at least as large as size splits into blocks of exactly size */
+	buddy_coalesce_all(allocator);
+	levels = buddy_free_histogram(allocator, counts, BATCH_MAX_LEVELS);
+	for (unsigned long int level = 0; level < levels; ++level)
+		if ((BATCH_MEMORY_SIZE >> level) >= size)
+			capacity += counts[level] * ((BATCH_MEMORY_SIZE >> level) / size);
+
+	return capacity;
+}
+
+static bool batch_check_exact_count(void)
+{
+	buddy_allocator_t *allocator = batch_create();
+	size_t available;
+	size_t count;
+	bool ok;
+
+	if (!allocator)
+		return false;
+	available = buddy_available(allocator);
+
+	/* Fewer than are available, exactly as many come back */
+	count = buddy_alloc_batch(allocator, BATCH_BLOCK_SIZE, ptrs, 100);
+	ok = count == 100 && buddy_available(allocator) == available - (100 * BATCH_BLOCK_SIZE);
+	for (size_t i = 0; ok && i < count; ++i)
+		ok = ptrs[i] && buddy_usable_size(allocator, ptrs[i]) == BATCH_BLOCK_SIZE;
+	buddy_release_batch(allocator, ptrs, count, BATCH_BLOCK_SIZE);
+
+	/* Sizes beyond the region allocate nothing */
+	ok = ok && buddy_alloc_batch(allocator, 2 * BATCH_MEMORY_SIZE, ptrs, 4) == 0;
+	ok = ok && buddy_available(allocator) == available;
+
+	free(allocator);
+	return ok;
+}
+
+static bool batch_check_partial_failure(void)
+{
+	buddy_allocator_t *allocator = batch_create();
+	buddy_allocator_t *reference = batch_create();
+	size_t capacity;
+	size_t count;
+	bool ok = false;
+
+	if (allocator && reference) {
+		capacity = batch_capacity(allocator, BATCH_BLOCK_SIZE);
+
+		/* Asking for more than fits reports exactly what was allocated, none of it overlapping */
+		count = buddy_alloc_batch(allocator, BATCH_BLOCK_SIZE, ptrs, capacity + 64);
+		ok = count == capacity && !buddy_alloc(allocator, BATCH_BLOCK_SIZE);
+		qsort(ptrs, count, sizeof(void *), batch_compare);
+		for (size_t i = 1; ok && i < count; ++i)
+			ok = (size_t)((unsigned char *)ptrs[i] - (unsigned char *)ptrs[i - 1]) >= BATCH_BLOCK_SIZE;
+
+		/* Handing the partial result back rolls the allocator back to where it started */
+		buddy_release_batch(allocator, ptrs, count, BATCH_BLOCK_SIZE);
+		ok = ok && batch_same_state(allocator, reference);
+	}
+
+	free(allocator);
+	free(reference);
+	return ok;
+}
+
+static size_t batch_pick(void **blocks, size_t count, void **out, buddy_allocator_t *allocator)
+{
+	size_t aligned = 0;
+	size_t n = 0;
+
+	/* The first block heading a subtree of 16 leaves, the blocks of a fresh batch are contiguous in address order */
+	while (aligned < count && (((unsigned char *)blocks[aligned] - (unsigned char *)allocator) & ((16 * BATCH_BLOCK_SIZE) - 1)))
+		++aligned;
+	if (aligned + 40 > count)
+		return 0;
+
+	/* A straddling run, a lone block, a pair and a whole subtree, out of order and with a null, so one batch merges
+	 * at several levels */
+	for (size_t i = 30; i < 35; ++i)
+		out[n++] = blocks[aligned + i];
+	out[n++] = blocks[aligned + 20];
+	out[n++] = 0;
+	out[n++] = blocks[aligned + 17];
+	out[n++] = blocks[aligned + 16];
+	for (size_t i = 16; i > 0; --i)
+		out[n++] = blocks[aligned + i - 1];
+	for (size_t i = 0; i < n; ++i)
+		for (size_t j = 0; j < count; ++j)
+			if (out[i] && blocks[j] == out[i])
+				blocks[j] = 0;
+
+	return n;
+}
+
+static bool batch_check_mixed_release(void)
+{
+	buddy_allocator_t *allocator = batch_create();
+	buddy_allocator_t *reference = batch_create();
+	size_t count = 0;
+	size_t reference_count = 0;
+	size_t picks;
+	bool ok = false;
+
+	if (allocator && reference) {
+
+		/* Identical allocators, one releasing in batches and the other one block at a time */
+		count = buddy_alloc_batch(allocator, BATCH_BLOCK_SIZE, ptrs, BATCH_MIXED_BLOCKS);
+		reference_count = buddy_alloc_batch(reference, BATCH_BLOCK_SIZE, reference_ptrs, BATCH_MIXED_BLOCKS);
+		qsort(ptrs, count, sizeof(void *), batch_compare);
+		qsort(reference_ptrs, reference_count, sizeof(void *), batch_compare);
+
+		picks = batch_pick(ptrs, count, picked, allocator);
+		buddy_release_batch(allocator, picked, picks, BATCH_BLOCK_SIZE);
+		picks = batch_pick(reference_ptrs, reference_count, picked, reference);
+		for (size_t i = 0; i < picks; ++i)
+			buddy_release(reference, picked[i], BATCH_BLOCK_SIZE);
+		ok = count == BATCH_MIXED_BLOCKS && picks && batch_same_state(allocator, reference);
+
+		/* Then the holes left behind, which merge with the blocks released first */
+		buddy_release_batch(allocator, ptrs, count, BATCH_BLOCK_SIZE);
+		for (size_t i = 0; i < reference_count; ++i)
+			buddy_release(reference, reference_ptrs[i], BATCH_BLOCK_SIZE);
+		ok = ok && batch_same_state(allocator, reference) && buddy_used(allocator) == buddy_used(reference);
+	}
+
+	free(allocator);
+	free(reference);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (!batch_check_exact_count()) {
+		fprintf(stderr, "batch allocation returned the wrong number of blocks\n");
+		return 1;
+	}
+	if (!batch_check_partial_failure()) {
+		fprintf(stderr, "releasing a partial batch did not restore the allocator\n");
+		return 1;
+	}
+	if (!batch_check_mixed_release()) {
+		fprintf(stderr, "releasing a batch merging at several levels differs from releasing one block at a time\n");
+		return 1;
+	}
+
+	printf("batch: count, partial failure and mixed release checks passed\n");
+
+	return 0;
+}
@@ -0,0 +1,266 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <buddy-alloc.h>
+#include <buddy-slab.h>
+
+#include "../test-rand.h"
+
+#define BENCH_MEMORY_SIZE (128 * 1024 * 1024)
+#define BENCH_WORKING_SET 2048
+#define BENCH_DEFAULT_OPS 1000000UL
+#define BENCH_MAX_NSEC 65536
+
+#define BENCH_RAND_SEED 0x01371730UL
+
+typedef enum bench_profile {
+	BENCH_PROFILE_SMALL_HEAVY,
+	BENCH_PROFILE_BIMODAL,
+	BENCH_PROFILE_POWER_LAW,
+	BENCH_PROFILE_FIXED,
+	BENCH_NUM_PROFILES,
+} bench_profile_t;
+
+typedef enum bench_target {
+	BENCH_TARGET_BUDDY_SIZED,
+	BENCH_TARGET_BUDDY_UNSIZED,
+	BENCH_TARGET_SLAB,
+	BENCH_TARGET_MALLOC,
+	BENCH_NUM_TARGETS,
+} bench_target_t;
+
+typedef struct bench_histogram {
+	unsigned long int count;
+	unsigned long int buckets[BENCH_MAX_NSEC + 1];
+} bench_histogram_t;
+
+typedef struct bench_result {
+	double ops_per_sec;
+	size_t peak_used;
+	double internal_fragmentation;
+	double external_fragmentation;
+	unsigned long int failures;
+	bench_histogram_t alloc_latency;
+	bench_histogram_t free_latency;
+} bench_result_t;
+
+static const char *profile_names[BENCH_NUM_PROFILES] = { "small-heavy", "bimodal", "power-law", "fixed" };
+static const char *target_names[BENCH_NUM_TARGETS] = { "buddy release", "buddy free", "slab", "malloc" };
+
+static unsigned long int memory[BENCH_MEMORY_SIZE / sizeof(unsigned long int)];
+static buddy_allocator_t *allocator;
+static BUDDY_DECLARE_SLAB(slab, BENCH_MEMORY_SIZE);
+static unsigned long long int bench_state;
+static long int timer_overhead;
+static bench_result_t result;
+
+static size_t bench_size(bench_profile_t profile)
+{
+	unsigned long long int value = test_rand(&bench_state);
+	unsigned long int shift;
+
+	switch (profile) {
+
+		/* Mostly tiny objects with an occasional buffer */
+		case BENCH_PROFILE_SMALL_HEAVY:
+			if ((value & 0xff) < 243)
+				return 8 + ((value >> 8) % 248);
+			return 256 + ((value >> 8) % (32 * 1024 - 256));
+
+		/* Small nodes mixed with large buffers */
+		case BENCH_PROFILE_BIMODAL:
+			if ((value & 0xff) < 179)
+				return 16 + ((value >> 8) % 112);
+			return 8 * 1024 + ((value >> 8) % (56 * 1024));
+
+		/* Each doubling of the size is half as likely, capped at 1M */
+		case BENCH_PROFILE_POWER_LAW:
+			shift = __builtin_ctzll(value | (1ULL << 15));
+			return (16UL << shift) + ((value >> 20) % (16UL << shift));
+
+		case BENCH_PROFILE_FIXED:
+		default:
+			return 256;
+	}
+}
+
+static inline long int bench_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static void bench_record(bench_histogram_t *histogram, long int nsec)
+{
+	nsec -= timer_overhead;
+	if (nsec < 0)
+		nsec = 0;
+	if (nsec > BENCH_MAX_NSEC)
+		nsec = BENCH_MAX_NSEC;
+
+	++histogram->buckets[nsec];
+	++histogram->count;
+}
+
+static unsigned long int bench_percentile(const bench_histogram_t *histogram, double percentile)
+{
+	unsigned long int target = (unsigned long int)(histogram->count * percentile);
+	unsigned long int seen = 0;
+
+	for (unsigned long int nsec = 0; nsec <= BENCH_MAX_NSEC; ++nsec) {
+		seen += histogram->buckets[nsec];
+		if (seen > target)
+			return nsec;
+	}
+
+	return BENCH_MAX_NSEC;
+}
+
+static void bench_calibrate(void)
+{
+	long int start;
+	long int elapsed;
+
+	/* The cheapest back to back reading is the cost of timing anything */
+	timer_overhead = BENCH_MAX_NSEC;
+	for (int i = 0; i < 100000; ++i) {
+		start = bench_now();
+		elapsed = bench_now() - start;
+		if (elapsed < timer_overhead)
+			timer_overhead = elapsed;
+	}
+}
+
+static void *bench_alloc(bench_target_t target, size_t size)
+{
+	if (target == BENCH_TARGET_MALLOC)
+		return malloc(size);
+	if (target == BENCH_TARGET_SLAB)
+		return buddy_slab_alloc(slab, size);
+	return buddy_alloc(allocator, size);
+}
+
+static void bench_release(bench_target_t target, void *ptr, size_t size)
+{
+	if (target == BENCH_TARGET_MALLOC)
+		free(ptr);
+	else if (target == BENCH_TARGET_SLAB)
+		buddy_slab_free(slab, ptr);
+	else if (target == BENCH_TARGET_BUDDY_UNSIZED)
+		buddy_free(allocator, ptr);
+	else
+		buddy_release(allocator, ptr, size);
+}
+
+static void bench_run(bench_profile_t profile, bench_target_t target, unsigned long int ops, unsigned long long int seed)
+{
+	unsigned char *ptrs[BENCH_WORKING_SET];
+	size_t sizes[BENCH_WORKING_SET];
+	long int elapsed = 0;
+	long int start;
+	long int nsec;
+	size_t requested = 0;
+	unsigned long int slot;
+
+	memset(&result, 0, sizeof(result));
+	memset(ptrs, 0, sizeof(ptrs));
+	bench_state = seed;
+	buddy_init(allocator, memory, BENCH_MEMORY_SIZE);
+	buddy_slab_init(slab, allocator, 0);
+
+	/* Churn a working set of blocks, every run sees the same sequence of requests */
+	for (unsigned long int op = 0; op < ops; ++op) {
+		slot = test_rand(&bench_state) % BENCH_WORKING_SET;
+		if (ptrs[slot]) {
+			start = bench_now();
+			bench_release(target, ptrs[slot], sizes[slot]);
+			nsec = bench_now() - start;
+			bench_record(&result.free_latency, nsec);
+			requested -= sizes[slot];
+			ptrs[slot] = 0;
+		} else {
+			sizes[slot] = bench_size(profile);
+			start = bench_now();
+			ptrs[slot] = bench_alloc(target, sizes[slot]);
+			nsec = bench_now() - start;
+			bench_record(&result.alloc_latency, nsec);
+			if (ptrs[slot]) {
+				ptrs[slot][0] = (unsigned char)op;
+				requested += sizes[slot];
+			} else
+				++result.failures;
+		}
+		elapsed += nsec;
+
+		/* At the high water mark sample the rounding waste and the free memory which cannot satisfy a request as
+		 * large as itself */
+		if (target != BENCH_TARGET_MALLOC && buddy_used(allocator) > result.peak_used) {
+			result.peak_used = buddy_used(allocator);
+			result.internal_fragmentation = 1.0 - ((double)requested / result.peak_used);
+			result.external_fragmentation = 1.0 - ((double)buddy_largest_available(allocator) / buddy_available(allocator));
+		}
+	}
+
+	for (slot = 0; slot < BENCH_WORKING_SET; ++slot)
+		if (ptrs[slot])
+			bench_release(target, ptrs[slot], sizes[slot]);
+	buddy_slab_trim(slab);
+
+	if (target != BENCH_TARGET_MALLOC && buddy_used(allocator))
+		printf("\t%zu bytes lost\n", buddy_used(allocator));
+
+	result.ops_per_sec = ops / (elapsed / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long int ops = argc > 1 ? strtoul(argv[1], 0, 0) : BENCH_DEFAULT_OPS;
+	unsigned long long int seed = argc > 2 ? strtoull(argv[2], 0, 0) : BENCH_RAND_SEED;
+
+	if (!ops)
+		ops = BENCH_DEFAULT_OPS;
+	if (!seed)
+		seed = BENCH_RAND_SEED;
+
+	/* Keep the metadata outside the region so the whole region is available */
+	allocator = malloc(buddy_sizeof_metadata(BENCH_MEMORY_SIZE, BUDDY_MIN_LEAF_SIZE));
+	if (!allocator) {
+		perror("metadata allocation failed");
+		return 1;
+	}
+
+	bench_calibrate();
+	printf("allocator benchmark: %lu ops, working set %d, seed 0x%llx, timer overhead %ld ns\n", ops, BENCH_WORKING_SET, seed, timer_overhead);
+	printf("%-12s %-14s %12s %21s %21s %13s %8s\n", "profile", "allocator", "ops/s", "alloc p50/p99/p999", "free p50/p99/p999", "peak int/ext", "failures");
+
+	for (int profile = 0; profile < BENCH_NUM_PROFILES; ++profile) {
+		for (int target = 0; target < BENCH_NUM_TARGETS; ++target) {
+			bench_run(profile, target, ops, seed);
+			printf("%-12s %-14s %12.0f %7lu/%6lu/%6lu %7lu/%6lu/%6lu ", profile_names[profile], target_names[target], result.ops_per_sec,
+				bench_percentile(&result.alloc_latency, 0.5), bench_percentile(&result.alloc_latency, 0.99), bench_percentile(&result.alloc_latency, 0.999),
+				bench_percentile(&result.free_latency, 0.5), bench_percentile(&result.free_latency, 0.99), bench_percentile(&result.free_latency, 0.999));
+			if (target == BENCH_TARGET_MALLOC)
+				printf("%13s %8lu\n", "-", result.failures);
+			else
+				printf("%5.1f%%/%5.1f%% %8lu\n", result.internal_fragmentation * 100.0, result.external_fragmentation * 100.0, result.failures);
+		}
+	}
+
+	free(allocator);
+
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include <buddy-alloc.hpp>
+
+#include "../test-rand.h"
+
+#define CXX_MEMORY_SIZE (128 * 1024 * 1024)
+#define CXX_MAX_VECTOR 4096UL
+#define CXX_KEY_RANGE 4096UL
+#define CXX_DEFAULT_OPS 1000000UL
+
+#define CXX_RAND_SEED 0x01371730UL
+
+typedef enum cxx_target {
+	CXX_TARGET_STD,
+	CXX_TARGET_PMR,
+	CXX_TARGET_BUDDY,
+	CXX_NUM_TARGETS,
+} cxx_target_t;
+
+static const char *target_names[CXX_NUM_TARGETS] = { "std::allocator", "pmr resource", "buddy::allocator" };
+
+static unsigned long int memory[CXX_MEMORY_SIZE / sizeof(unsigned long int)];
+static buddy_allocator_t *allocator;
+static unsigned long long int cxx_state;
+static unsigned long int checksum;
+
+template <typename Alloc>
+static void cxx_vector(const Alloc &alloc, unsigned long int ops)
+{
+	using vector_t = std::vector<unsigned long int, typename std::allocator_traits<Alloc>::template rebind_alloc<unsigned long int>>;
+
+	/* Grow vectors of random lengths one element at a time, every doubling is a reallocation */
+	for (unsigned long int done = 0; done < ops;) {
+		unsigned long int length = test_rand(&cxx_state) % CXX_MAX_VECTOR + 1;
+		vector_t vector(alloc);
+
+		for (unsigned long int i = 0; i < length; ++i)
+			vector.push_back(i);
+		checksum += vector.back();
+		done += length;
+	}
+}
+
+template <typename Map>
+static void cxx_churn(Map &map, unsigned long int ops)
+{
+	/* Insert a random key when absent and erase it when present, the map holds about half the keys */
+	for (unsigned long int op = 0; op < ops; ++op) {
+		unsigned long int key = test_rand(&cxx_state) % CXX_KEY_RANGE;
+		auto found = map.find(key);
+
+		if (found == map.end())
+			map.emplace(key, op);
+		else {
+			checksum += found->second;
+			map.erase(found);
+		}
+	}
+}
+
+template <typename Alloc>
+static void cxx_map(const Alloc &alloc, unsigned long int ops)
+{
+	using value_t = std::pair<const unsigned long int, unsigned long int>;
+	std::map<unsigned long int, unsigned long int, std::less<unsigned long int>, typename std::allocator_traits<Alloc>::template rebind_alloc<value_t>> map(alloc);
+
+	cxx_churn(map, ops);
+}
+
+template <typename Alloc>
+static void cxx_unordered_map(const Alloc &alloc, unsigned long int ops)
+{
+	using value_t = std::pair<const unsigned long int, unsigned long int>;
+	std::unordered_map<unsigned long int, unsigned long int, std::hash<unsigned long int>, std::equal_to<unsigned long int>, typename std::allocator_traits<Alloc>::template rebind_alloc<value_t>> map(alloc);
+
+	cxx_churn(map, ops);
+}
+
+template <template <typename> class Workload>
+static double cxx_run(cxx_target_t target, unsigned long int ops, unsigned long long int seed)
+{
+	buddy::memory_resource resource(allocator);
+	std::chrono::steady_clock::time_point start;
+	std::chrono::duration<double> elapsed;
+
+	cxx_state = seed;
+	buddy_init(allocator, memory, CXX_MEMORY_SIZE);
+
+	start = std::chrono::steady_clock::now();
+	switch (target) {
+		case CXX_TARGET_STD:
+			Workload<std::allocator<unsigned long int>>::run(std::allocator<unsigned long int>(), ops);
+			break;
+		case CXX_TARGET_PMR:
+			Workload<std::pmr::polymorphic_allocator<unsigned long int>>::run(std::pmr::polymorphic_allocator<unsigned long int>(&resource), ops);
+			break;
+		case CXX_TARGET_BUDDY:
+		default:
+			Workload<buddy::allocator<unsigned long int>>::run(buddy::allocator<unsigned long int>(allocator), ops);
+			break;
+	}
+	elapsed = std::chrono::steady_clock::now() - start;
+
+	/* Every container is gone, so every block must be back */
+	if (buddy_used(allocator) != 0) {
+		fprintf(stderr, "%s leaked %zu bytes\n", target_names[target], buddy_used(allocator));
+		exit(1);
+	}
+
+	return ops / elapsed.count();
+}
+
+template <typename Alloc>
+struct cxx_vector_workload
+{
+	static void run(const Alloc &alloc, unsigned long int ops)
+	{
+		cxx_vector(alloc, ops);
+	}
+};
+
+template <typename Alloc>
+struct cxx_map_workload
+{
+	static void run(const Alloc &alloc, unsigned long int ops)
+	{
+		cxx_map(alloc, ops);
+	}
+};
+
+template <typename Alloc>
+struct cxx_unordered_map_workload
+{
+	static void run(const Alloc &alloc, unsigned long int ops)
+	{
+		cxx_unordered_map(alloc, ops);
+	}
+};
+
+int main(int argc, char **argv)
+{
+	unsigned long int ops = argc > 1 ? strtoul(argv[1], 0, 0) : CXX_DEFAULT_OPS;
+	unsigned long long int seed = argc > 2 ? strtoull(argv[2], 0, 0) : CXX_RAND_SEED;
+
+	if (!ops)
+		ops = CXX_DEFAULT_OPS;
+	if (!seed)
+		seed = CXX_RAND_SEED;
+
+	/* Keep the metadata outside the region so the whole region is available */
+	allocator = static_cast<buddy_allocator_t *>(malloc(buddy_sizeof_metadata(CXX_MEMORY_SIZE, BUDDY_MIN_LEAF_SIZE)));
+	if (!allocator) {
+		perror("metadata allocation failed");
+		return 1;
+	}
+
+	printf("container benchmark: %lu ops, seed 0x%llx\n", ops, seed);
+	printf("%-14s %-18s %12s\n", "workload", "allocator", "ops/s");
+
+	for (int target = 0; target < CXX_NUM_TARGETS; ++target)
+		printf("%-14s %-18s %12.0f\n", "vector", target_names[target], cxx_run<cxx_vector_workload>(static_cast<cxx_target_t>(target), ops, seed));
+	for (int target = 0; target < CXX_NUM_TARGETS; ++target)
+		printf("%-14s %-18s %12.0f\n", "map", target_names[target], cxx_run<cxx_map_workload>(static_cast<cxx_target_t>(target), ops, seed));
+	for (int target = 0; target < CXX_NUM_TARGETS; ++target)
+		printf("%-14s %-18s %12.0f\n", "unordered_map", target_names[target], cxx_run<cxx_unordered_map_workload>(static_cast<cxx_target_t>(target), ops, seed));
+
+	/* Keeps the containers from being optimised away */
+	printf("checksum 0x%lx\n", checksum);
+
+	free(allocator);
+
+	return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include <buddy-alloc.h>
+
+#include "../test-rand.h"
+
+#define DEEP_MEMORY_SIZE (1UL << 30)
+#define DEEP_LEAF_SIZE 16UL
+#define DEEP_LIVE_BLOCKS (1UL << 18)
+#define DEEP_ROUND_BLOCKS (1UL << 15)
+#define DEEP_DEFAULT_ROUNDS 16UL
+
+#define DEEP_RAND_SEED 0x01371730UL
+
+#ifdef BUDDY_BLOCKED_INDEX
+#define DEEP_LAYOUT "blocked"
+#else
+#define DEEP_LAYOUT "breadth first"
+#endif
+
+static buddy_allocator_t *allocator;
+static void **ptrs;
+static unsigned long long int deep_state;
+
+static size_t deep_size(void)
+{
+	unsigned long long int value = test_rand(&deep_state);
+	size_t size = DEEP_LEAF_SIZE << __builtin_ctzll(value | (1ULL << 12));
+
+	/* Halving odds for every doubling from a leaf up to 64K, anywhere within the power of two */
+	return size + ((value >> 32) % size);
+}
+
+static inline long int deep_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long int rounds = argc > 1 ? strtoul(argv[1], 0, 0) : DEEP_DEFAULT_ROUNDS;
+	unsigned long long int seed = argc > 2 ? strtoull(argv[2], 0, 0) : DEEP_RAND_SEED;
+	long int free_nsec = 0;
+	long int alloc_nsec = 0;
+	unsigned long int failures = 0;
+	unsigned long int slot;
+	long int start;
+	void *memory;
+
+	if (!rounds)
+		rounds = DEEP_DEFAULT_ROUNDS;
+	if (!seed)
+		seed = DEEP_RAND_SEED;
+	deep_state = seed;
+
+	/* Only the pages holding free list links are ever touched, so the region can be far larger than the memory used */
+	memory = mmap(0, DEEP_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	allocator = malloc(buddy_sizeof_metadata(DEEP_MEMORY_SIZE, DEEP_LEAF_SIZE));
+	ptrs = calloc(DEEP_LIVE_BLOCKS, sizeof(void *));
+	if (memory == MAP_FAILED || !allocator || !ptrs) {
+		perror("benchmark allocation failed");
+		return 1;
+	}
+	buddy_init_ex(allocator, memory, DEEP_MEMORY_SIZE, DEEP_LEAF_SIZE);
+
+	/* Fill the region then free every other block, leaving free blocks scattered over the whole tree */
+	for (slot = 0; slot < DEEP_LIVE_BLOCKS; ++slot)
+		ptrs[slot] = buddy_alloc(allocator, deep_size());
+	for (slot = 0; slot < DEEP_LIVE_BLOCKS; slot += 2) {
+		buddy_free(allocator, ptrs[slot]);
+		ptrs[slot] = 0;
+	}
+
+	/* Each round frees blocks picked at random, walking and merging up the tree, then allocates as many again */
+	for (unsigned long int round = 0; round < rounds; ++round) {
+		start = deep_now();
+		for (unsigned long int i = 0; i < DEEP_ROUND_BLOCKS; ++i) {
+			slot = test_rand(&deep_state) % DEEP_LIVE_BLOCKS;
+			buddy_free(allocator, ptrs[slot]);
+			ptrs[slot] = 0;
+		}
+		free_nsec += deep_now() - start;
+
+		start = deep_now();
+		for (unsigned long int i = 0; i < DEEP_ROUND_BLOCKS; ++i) {
+			slot = test_rand(&deep_state) % DEEP_LIVE_BLOCKS;
+			if (!ptrs[slot]) {
+				ptrs[slot] = buddy_alloc(allocator, deep_size());
+				failures += !ptrs[slot];
+			}
+		}
+		alloc_nsec += deep_now() - start;
+	}
+
+	printf("deep tree benchmark: %lu rounds, seed 0x%llx, %s index of %lu levels\n", rounds, seed, DEEP_LAYOUT, allocator->max_level);
+	printf("%-8s %10s\n", "", "ns/op");
+	printf("%-8s %10.1f\n", "free", (double)free_nsec / (rounds * DEEP_ROUND_BLOCKS));
+	printf("%-8s %10.1f\n", "alloc", (double)alloc_nsec / (rounds * DEEP_ROUND_BLOCKS));
+	printf("used %zu, failures %lu\n", buddy_used(allocator), failures);
+
+	for (slot = 0; slot < DEEP_LIVE_BLOCKS; ++slot)
+		buddy_free(allocator, ptrs[slot]);
+	if (buddy_used(allocator) != 0) {
+		fprintf(stderr, "blocks outstanding after the run\n");
+		return 1;
+	}
+
+	free(ptrs);
+	free(allocator);
+	munmap(memory, DEEP_MEMORY_SIZE);
+
+	return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <buddy-alloc.h>
+
+#define DEFERRED_MEMORY_SIZE (1024UL * 1024UL)
+#define DEFERRED_BLOCK_SIZE 64UL
+#define DEFERRED_MAX_BLOCKS (DEFERRED_MEMORY_SIZE / DEFERRED_BLOCK_SIZE)
+#define DEFERRED_MAX_LEVELS 64
+
+static void *ptrs[DEFERRED_MAX_BLOCKS];
+static void *memory;
+
+static buddy_allocator_t *deferred_create(void)
+{
+	/* Metadata kept apart so the whole region is free, with no limit on the blocks waiting to merge */
+	buddy_allocator_t *allocator = malloc(buddy_sizeof_metadata(DEFERRED_MEMORY_SIZE, BUDDY_MIN_LEAF_SIZE));
+
+	memory = aligned_alloc(DEFERRED_MEMORY_SIZE, DEFERRED_MEMORY_SIZE);
+	if (!allocator || !memory)
+		return 0;
+	buddy_init(allocator, memory, DEFERRED_MEMORY_SIZE);
+	buddy_set_watermark(allocator, DEFERRED_BLOCK_SIZE, DEFERRED_MAX_BLOCKS);
+
+	return allocator;
+}
+
+static void deferred_destroy(buddy_allocator_t *allocator)
+{
+	free(allocator);
+	free(memory);
+}
+
+static size_t deferred_waiting(const buddy_allocator_t *allocator)
+{
+	unsigned long int counts[DEFERRED_MAX_LEVELS];
+	unsigned long int levels = buddy_free_histogram(allocator, counts, DEFERRED_MAX_LEVELS);
+	size_t free_bytes = 0;
+
+	/* Waiting blocks count as available but sit on no free list */
+	for (unsigned long int level = 0; level < levels; ++level)
+		free_bytes += counts[level] * (DEFERRED_MEMORY_SIZE >> level);
+
+	return (buddy_available(allocator) - free_bytes) / DEFERRED_BLOCK_SIZE;
+}
+
+static size_t deferred_fill(buddy_allocator_t *allocator)
+{
+	size_t count = 0;
+
+	/* Every block of the region waiting to merge */
+	while (count < DEFERRED_MAX_BLOCKS && (ptrs[count] = buddy_alloc(allocator, DEFERRED_BLOCK_SIZE)))
+		++count;
+	for (size_t i = 0; i < count; ++i)
+		buddy_free(allocator, ptrs[i]);
+
+	return count;
+}
+
+static bool deferred_check_alloc_failure(void)
+{
+	buddy_allocator_t *allocator = deferred_create();
+	void *ptr;
+	bool ok;
+
+	if (!allocator)
+		return false;
+
+	/* No free block is larger than the waiting ones until they merge */
+	ok = deferred_fill(allocator) == DEFERRED_MAX_BLOCKS && deferred_waiting(allocator) == DEFERRED_MAX_BLOCKS;
+	ok = ok && buddy_largest_available(allocator) == DEFERRED_BLOCK_SIZE;
+	ptr = buddy_alloc(allocator, DEFERRED_MEMORY_SIZE / 2);
+	ok = ok && ptr && deferred_waiting(allocator) == 0 && buddy_available(allocator) == DEFERRED_MEMORY_SIZE / 2;
+	buddy_free(allocator, ptr);
+	ok = ok && buddy_largest_available(allocator) == DEFERRED_MEMORY_SIZE;
+
+	deferred_destroy(allocator);
+	return ok;
+}
+
+static bool deferred_check_watermark(void)
+{
+	buddy_allocator_t *allocator = deferred_create();
+	bool ok;
+
+	if (!allocator)
+		return false;
+
+	/* Only as many as the watermark wait, lowering it merges the excess */
+	buddy_set_watermark(allocator, DEFERRED_BLOCK_SIZE, 16);
+	for (size_t i = 0; i < 32; ++i)
+		ptrs[i] = buddy_alloc(allocator, DEFERRED_BLOCK_SIZE);
+	for (size_t i = 0; i < 32; ++i)
+		buddy_free(allocator, ptrs[i]);
+	ok = deferred_waiting(allocator) == 16;
+	buddy_set_watermark(allocator, DEFERRED_BLOCK_SIZE, 4);
+	ok = ok && deferred_waiting(allocator) == 4;
+
+	/* Waiting blocks are handed out again first */
+	ok = ok && buddy_alloc(allocator, DEFERRED_BLOCK_SIZE) && deferred_waiting(allocator) == 3;
+
+	deferred_destroy(allocator);
+	return ok;
+}
+
+static bool deferred_check_coalesce_all(void)
+{
+	buddy_allocator_t *allocator = deferred_create();
+	bool ok;
+
+	if (!allocator)
+		return false;
+
+	/* Merging everything leaves the region whole again */
+	ok = deferred_fill(allocator) == DEFERRED_MAX_BLOCKS && buddy_largest_available(allocator) == DEFERRED_BLOCK_SIZE;
+	buddy_coalesce_all(allocator);
+	ok = ok && deferred_waiting(allocator) == 0 && buddy_largest_available(allocator) == DEFERRED_MEMORY_SIZE;
+
+	deferred_destroy(allocator);
+	return ok;
+}
+
+static bool deferred_check_aligned_and_batch(void)
+{
+	buddy_allocator_t *allocator = deferred_create();
+	void *block;
+	void *ptr;
+	size_t count;
+	bool ok;
+
+	if (!allocator)
+		return false;
+
+	/* A waiting block of the right size is reused by an aligned allocation */
+	block = buddy_alloc(allocator, DEFERRED_BLOCK_SIZE);
+	buddy_free(allocator, block);
+	ptr = buddy_alloc_aligned(allocator, DEFERRED_BLOCK_SIZE, DEFERRED_BLOCK_SIZE);
+	ok = ptr == block && deferred_waiting(allocator) == 0;
+	buddy_free(allocator, ptr);
+	buddy_coalesce_all(allocator);
+
+	/* With the region waiting to merge, aligned allocations merge it rather than fail */
+	ok = ok && deferred_fill(allocator) == DEFERRED_MAX_BLOCKS;
+	ptr = buddy_alloc_aligned(allocator, 64 * 1024, 4096);
+	ok = ok && ptr && deferred_waiting(allocator) == 0;
+	buddy_free(allocator, ptr);
+
+	/* And so do batches, after taking the waiting blocks of their size */
+	ok = ok && deferred_fill(allocator) == DEFERRED_MAX_BLOCKS;
+	count = buddy_alloc_batch(allocator, DEFERRED_BLOCK_SIZE, ptrs, 100);
+	ok = ok && count == 100 && deferred_waiting(allocator) == DEFERRED_MAX_BLOCKS - 100;
+	buddy_release_batch(allocator, ptrs, count, DEFERRED_BLOCK_SIZE);
+	count = buddy_alloc_batch(allocator, 4096, ptrs, 16);
+	ok = ok && count == 16 && deferred_waiting(allocator) == 0;
+	buddy_release_batch(allocator, ptrs, count, 4096);
+	ok = ok && buddy_largest_available(allocator) == DEFERRED_MEMORY_SIZE;
+
+	deferred_destroy(allocator);
+	return ok;
+}
+
+static bool deferred_check_batch_release(void)
+{
+	buddy_allocator_t *allocator = deferred_create();
+	size_t count;
+	bool ok;
+
+	if (!allocator)
+		return false;
+
+	/* A batch release fills the waiting list up to the watermark and merges the rest */
+	buddy_set_watermark(allocator, DEFERRED_BLOCK_SIZE, 16);
+	count = buddy_alloc_batch(allocator, DEFERRED_BLOCK_SIZE, ptrs, 64);
+	ok = count == 64;
+	buddy_release_batch(allocator, ptrs, count, DEFERRED_BLOCK_SIZE);
+	ok = ok && deferred_waiting(allocator) == 16 && buddy_used(allocator) == 0;
+
+	/* With the list full, the next batch merges right away */
+	count = buddy_alloc_batch(allocator, 4096, ptrs, 4);
+	ok = ok && count == 4 && deferred_waiting(allocator) == 16;
+	buddy_release_batch(allocator, ptrs, count, 4096);
+	ok = ok && deferred_waiting(allocator) == 16;
+	buddy_coalesce_all(allocator);
+	ok = ok && deferred_waiting(allocator) == 0 && buddy_largest_available(allocator) == DEFERRED_MEMORY_SIZE;
+
+	deferred_destroy(allocator);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (!deferred_check_alloc_failure()) {
+		fprintf(stderr, "waiting blocks did not merge when an allocation failed\n");
+		return 1;
+	}
+	if (!deferred_check_watermark()) {
+		fprintf(stderr, "waiting blocks did not follow the watermark\n");
+		return 1;
+	}
+	if (!deferred_check_coalesce_all()) {
+		fprintf(stderr, "waiting blocks did not merge on buddy_coalesce_all()\n");
+		return 1;
+	}
+	if (!deferred_check_aligned_and_batch()) {
+		fprintf(stderr, "aligned or batch allocations did not reuse or merge waiting blocks\n");
+		return 1;
+	}
+
+	if (!deferred_check_batch_release()) {
+		fprintf(stderr, "batch releases did not fill the waiting list up to the watermark\n");
+		return 1;
+	}
+
+	printf("deferred: allocation failure, watermark, coalesce all, aligned, batch and batch release checks passed\n");
+
+	return 0;
+}
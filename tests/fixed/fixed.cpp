@@ -0,0 +1,244 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include <buddy-alloc.hpp>
+#include <buddy-fixed.hpp>
+
+#include "../test-rand.h"
+
+#define FIXED_MEMORY_SIZE (16 * 1024 * 1024)
+#define FIXED_LEAF_SIZE 16
+#define FIXED_CONSTANT_SIZE 64
+#define FIXED_WORKING_SET 2048
+#define FIXED_DEFAULT_OPS 1000000UL
+
+#define FIXED_RAND_SEED 0x01371730UL
+
+typedef enum fixed_target {
+	FIXED_TARGET_GENERIC_RELEASE,
+	FIXED_TARGET_FIXED_RELEASE,
+	FIXED_TARGET_ALIGNED_RELEASE,
+	FIXED_TARGET_GENERIC_FREE,
+	FIXED_TARGET_FIXED_FREE,
+	FIXED_TARGET_GENERIC_CONSTANT,
+	FIXED_TARGET_FIXED_CONSTANT,
+	FIXED_NUM_TARGETS,
+} fixed_target_t;
+
+static const char *target_names[FIXED_NUM_TARGETS] = { "generic release", "fixed release", "aligned release", "generic free", "fixed free", "generic order", "fixed constant" };
+
+alignas(FIXED_MEMORY_SIZE) static unsigned char memory[FIXED_MEMORY_SIZE];
+static buddy_allocator_t *allocator;
+static buddy::fixed_allocator<FIXED_MEMORY_SIZE, FIXED_LEAF_SIZE> fixed;
+static buddy::fixed_allocator<FIXED_MEMORY_SIZE, FIXED_LEAF_SIZE, FIXED_MEMORY_SIZE> aligned;
+
+static unsigned long long int fixed_state;
+static unsigned int *slots;
+static unsigned int *sizes;
+static unsigned long int *ptrs[FIXED_WORKING_SET];
+static size_t lengths[FIXED_WORKING_SET];
+static void *fixed_ptrs[FIXED_WORKING_SET];
+
+static void fixed_generate(unsigned long int ops, unsigned long long int seed)
+{
+	unsigned long long int value;
+
+	/* Draw the whole sequence up front so the timed loops only allocate and free, sizes are mostly small with a
+	 * long tail up to 64K */
+	fixed_state = seed;
+	for (unsigned long int op = 0; op < ops; ++op) {
+		slots[op] = test_rand(&fixed_state) % FIXED_WORKING_SET;
+		value = test_rand(&fixed_state);
+		sizes[op] = 16 + (value & 0xffff) % (16UL << (value >> 60));
+	}
+}
+
+static void *fixed_alloc(fixed_target_t target, size_t size)
+{
+	switch (target) {
+		case FIXED_TARGET_GENERIC_RELEASE:
+		case FIXED_TARGET_GENERIC_FREE:
+			return buddy_alloc(allocator, size);
+		case FIXED_TARGET_FIXED_RELEASE:
+		case FIXED_TARGET_FIXED_FREE:
+			return fixed.alloc(size);
+		case FIXED_TARGET_ALIGNED_RELEASE:
+			return aligned.alloc(size);
+		case FIXED_TARGET_GENERIC_CONSTANT:
+			return buddy_alloc_order(allocator, buddy::order_of(FIXED_CONSTANT_SIZE));
+		case FIXED_TARGET_FIXED_CONSTANT:
+		default:
+			return fixed.alloc<FIXED_CONSTANT_SIZE>();
+	}
+}
+
+static void fixed_release(fixed_target_t target, void *ptr, size_t size)
+{
+	switch (target) {
+		case FIXED_TARGET_GENERIC_RELEASE:
+			buddy_release(allocator, ptr, size);
+			break;
+		case FIXED_TARGET_FIXED_RELEASE:
+			fixed.release(ptr, size);
+			break;
+		case FIXED_TARGET_ALIGNED_RELEASE:
+			aligned.release(ptr, size);
+			break;
+		case FIXED_TARGET_GENERIC_FREE:
+			buddy_free(allocator, ptr);
+			break;
+		case FIXED_TARGET_FIXED_FREE:
+			fixed.free(ptr);
+			break;
+		case FIXED_TARGET_GENERIC_CONSTANT:
+			buddy_release_order(allocator, ptr, buddy::order_of(FIXED_CONSTANT_SIZE));
+			break;
+		case FIXED_TARGET_FIXED_CONSTANT:
+		default:
+			fixed.release<FIXED_CONSTANT_SIZE>(ptr);
+			break;
+	}
+}
+
+static bool fixed_check_matches(unsigned long int ops)
+{
+	unsigned long int slot;
+	size_t size;
+
+	buddy_init_ex(allocator, memory, FIXED_MEMORY_SIZE, FIXED_LEAF_SIZE);
+	fixed.reset();
+
+	/* The same sequence must give the same blocks at the same offsets, odd slots taking the constant size path and
+	 * sized releases alternating with unsized frees */
+	for (unsigned long int op = 0; op < ops; ++op) {
+		slot = slots[op];
+		if (ptrs[slot]) {
+			if (op & 1) {
+				buddy_release(allocator, ptrs[slot], lengths[slot]);
+				if (slot & 1)
+					fixed.release<FIXED_CONSTANT_SIZE>(fixed_ptrs[slot]);
+				else
+					fixed.release(fixed_ptrs[slot], lengths[slot]);
+			} else {
+				buddy_free(allocator, ptrs[slot]);
+				fixed.free(fixed_ptrs[slot]);
+			}
+			ptrs[slot] = 0;
+			fixed_ptrs[slot] = 0;
+		} else {
+			size = (slot & 1) ? FIXED_CONSTANT_SIZE : sizes[op];
+			ptrs[slot] = static_cast<unsigned long int *>(buddy_alloc(allocator, size));
+			fixed_ptrs[slot] = (slot & 1) ? fixed.alloc<FIXED_CONSTANT_SIZE>() : fixed.alloc(size);
+			lengths[slot] = size;
+			if (!ptrs[slot] != !fixed_ptrs[slot] || (ptrs[slot] && reinterpret_cast<unsigned char *>(ptrs[slot]) - memory != static_cast<unsigned char *>(fixed_ptrs[slot]) - static_cast<unsigned char *>(fixed.address())))
+				return false;
+		}
+		if (buddy_available(allocator) != fixed.available())
+			return false;
+	}
+
+	/* Drain the working set */
+	for (slot = 0; slot < FIXED_WORKING_SET; ++slot) {
+		buddy_free(allocator, ptrs[slot]);
+		fixed.free(fixed_ptrs[slot]);
+		ptrs[slot] = 0;
+		fixed_ptrs[slot] = 0;
+	}
+
+	return buddy_used(allocator) == 0 && fixed.used() == 0;
+}
+
+static double fixed_run(fixed_target_t target, unsigned long int ops)
+{
+	bool constant = target == FIXED_TARGET_GENERIC_CONSTANT || target == FIXED_TARGET_FIXED_CONSTANT;
+	std::chrono::steady_clock::time_point start;
+	std::chrono::duration<double> elapsed;
+	unsigned long int slot;
+	size_t size;
+
+	buddy_init_ex(allocator, memory, FIXED_MEMORY_SIZE, FIXED_LEAF_SIZE);
+	fixed.reset();
+	aligned.reset();
+
+	/* Every block carries its slot in its first and last word, an overlap shows up when the block goes back */
+	start = std::chrono::steady_clock::now();
+	for (unsigned long int op = 0; op < ops; ++op) {
+		slot = slots[op];
+		if (ptrs[slot]) {
+			if (ptrs[slot][0] != slot || ptrs[slot][lengths[slot] / sizeof(unsigned long int) - 1] != slot) {
+				fprintf(stderr, "%s: block of slot %lu overwritten\n", target_names[target], slot);
+				exit(1);
+			}
+			fixed_release(target, ptrs[slot], lengths[slot]);
+			ptrs[slot] = 0;
+		} else {
+			size = constant ? FIXED_CONSTANT_SIZE : sizes[op];
+			ptrs[slot] = static_cast<unsigned long int *>(fixed_alloc(target, size));
+			if (ptrs[slot]) {
+				lengths[slot] = size;
+				ptrs[slot][0] = slot;
+				ptrs[slot][size / sizeof(unsigned long int) - 1] = slot;
+			}
+		}
+	}
+	elapsed = std::chrono::steady_clock::now() - start;
+
+	/* Drain the working set, everything must be free again */
+	for (slot = 0; slot < FIXED_WORKING_SET; ++slot) {
+		if (ptrs[slot])
+			fixed_release(target, ptrs[slot], lengths[slot]);
+		ptrs[slot] = 0;
+	}
+	if (buddy_used(allocator) != 0 || fixed.used() != 0 || aligned.used() != 0) {
+		fprintf(stderr, "%s: blocks outstanding after the run\n", target_names[target]);
+		exit(1);
+	}
+
+	return ops / elapsed.count();
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long int ops = argc > 1 ? strtoul(argv[1], 0, 0) : FIXED_DEFAULT_OPS;
+	unsigned long long int seed = argc > 2 ? strtoull(argv[2], 0, 0) : FIXED_RAND_SEED;
+
+	if (!ops)
+		ops = FIXED_DEFAULT_OPS;
+	if (!seed)
+		seed = FIXED_RAND_SEED;
+
+	/* Keep the metadata outside the region so both allocators manage the whole region */
+	allocator = static_cast<buddy_allocator_t *>(malloc(buddy_sizeof_metadata(FIXED_MEMORY_SIZE, FIXED_LEAF_SIZE)));
+	slots = static_cast<unsigned int *>(malloc(ops * sizeof(*slots)));
+	sizes = static_cast<unsigned int *>(malloc(ops * sizeof(*sizes)));
+	if (!allocator || !slots || !sizes) {
+		perror("benchmark allocation failed");
+		return 1;
+	}
+	fixed_generate(ops, seed);
+
+	if (!fixed_check_matches(ops)) {
+		fprintf(stderr, "the fixed allocator did not match the runtime allocator\n");
+		return 1;
+	}
+
+	printf("fixed geometry benchmark: %lu ops, working set %d, seed 0x%llx\n", ops, FIXED_WORKING_SET, seed);
+	printf("%-16s %12s\n", "allocator", "ops/s");
+	for (int target = 0; target < FIXED_NUM_TARGETS; ++target)
+		printf("%-16s %12.0f\n", target_names[target], fixed_run(static_cast<fixed_target_t>(target), ops));
+
+	free(sizes);
+	free(slots);
+	free(allocator);
+
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <buddy-alloc.h>
+#include <buddy-heap.h>
+
+#define HEAP_ARENA_SIZE (16UL * 1024UL * 1024UL)
+#define HEAP_REGION_SIZE (64UL * 1024UL)
+#define HEAP_PINNED_SIZE (32UL * 1024UL)
+#define HEAP_BLOCK_SIZE 4000UL
+#define HEAP_MAX_BLOCKS 1024
+#define HEAP_MIN_REGIONS 4
+
+/* Regions are carved from the top of an arena downwards with a gap after each, so they are discontiguous and
+ * every new one lands below the others */
+typedef struct heap_arena {
+	unsigned char *base;
+	unsigned char *top;
+	unsigned long int grows;
+	unsigned long int shrinks;
+	size_t grown;
+	size_t shrunk;
+	bool foreign;
+} heap_arena_t;
+
+static void *ptrs[HEAP_MAX_BLOCKS];
+
+static void *heap_grow(size_t size, void *context)
+{
+	heap_arena_t *arena = context;
+
+	/* Aligned on its size so builds with BUDDY_MEMORY_ALIGNED_ON_SIZE work too */
+	unsigned char *address = (unsigned char *)((unsigned long int)(arena->top - (2 * size)) & ~(size - 1));
+
+	if (address < arena->base)
+		return 0;
+	arena->top = address;
+	++arena->grows;
+	arena->grown += size;
+
+	return address;
+}
+
+static void heap_shrink(void *address, size_t size, void *context)
+{
+	heap_arena_t *arena = context;
+
+	/* Only ever regions which came from the arena */
+	if ((unsigned char *)address < arena->base || (unsigned char *)address + size > arena->base + HEAP_ARENA_SIZE)
+		arena->foreign = true;
+	++arena->shrinks;
+	arena->shrunk += size;
+}
+
+static bool heap_check_regions(void)
+{
+	heap_arena_t arena = { 0 };
+	void *pinned = aligned_alloc(HEAP_REGION_SIZE, HEAP_REGION_SIZE);
+	buddy_heap_t heap;
+	size_t count = 0;
+	size_t returned;
+	bool ok;
+
+	arena.base = aligned_alloc(HEAP_ARENA_SIZE, HEAP_ARENA_SIZE);
+	if (!arena.base || !pinned)
+		return false;
+	arena.top = arena.base + HEAP_ARENA_SIZE;
+
+	/* A caller supplied region first, which trimming never gives back */
+	ok = buddy_heap_init(&heap, HEAP_REGION_SIZE, BUDDY_MIN_LEAF_SIZE, heap_grow, heap_shrink, &arena);
+	ok = ok && buddy_heap_add_region(&heap, pinned, HEAP_PINNED_SIZE);
+
+	/* Grow several regions, each block must lie in one of them */
+	while (count < HEAP_MAX_BLOCKS && heap.num_regions < HEAP_MIN_REGIONS + 1) {
+		ptrs[count] = buddy_heap_alloc(&heap, HEAP_BLOCK_SIZE);
+		if (!ptrs[count])
+			break;
+		++count;
+	}
+	ok = ok && heap.num_regions == HEAP_MIN_REGIONS + 1 && arena.grows == HEAP_MIN_REGIONS;
+	for (unsigned long int i = 1; ok && i < heap.num_regions; ++i)
+		ok = heap.regions[i - 1].address + heap.regions[i - 1].size <= heap.regions[i].address;
+	ok = ok && buddy_heap_used(&heap) == count * 4096;
+
+	/* Foreign pointers are ignored */
+	buddy_heap_free(&heap, &arena);
+	buddy_heap_release(&heap, arena.base + HEAP_ARENA_SIZE, HEAP_BLOCK_SIZE);
+	ok = ok && buddy_heap_used(&heap) == count * 4096;
+
+	/* Free across the regions, alternating sized and unsized frees, keeping the last block */
+	for (size_t i = 0; i + 1 < count; ++i) {
+		if (i & 1)
+			buddy_heap_release(&heap, ptrs[i], HEAP_BLOCK_SIZE);
+		else
+			buddy_heap_free(&heap, ptrs[i]);
+	}
+	ok = ok && buddy_heap_used(&heap) == 4096;
+
+	/* Every empty grown region goes back, the one still holding a block and the pinned one stay */
+	returned = buddy_heap_trim(&heap);
+	ok = ok && heap.num_regions == 2 && arena.shrinks == HEAP_MIN_REGIONS - 1 && returned == arena.shrunk && !arena.foreign;
+
+	/* Then the last one, after which the heap grows again from the initial size */
+	buddy_heap_free(&heap, ptrs[count - 1]);
+	returned += buddy_heap_trim(&heap);
+	ok = ok && heap.num_regions == 1 && heap.regions[0].address == pinned && returned == arena.grown;
+	ok = ok && arena.shrinks == arena.grows && heap.region_size == HEAP_REGION_SIZE && buddy_heap_used(&heap) == 0;
+
+	free(arena.base);
+	free(pinned);
+	return ok;
+}
+
+static bool heap_check_limits(void)
+{
+	heap_arena_t arena = { 0 };
+	buddy_heap_t heap;
+	bool ok;
+
+	/* Region sizes must be powers of two holding at least a leaf */
+	ok = !buddy_heap_init(&heap, 0, BUDDY_MIN_LEAF_SIZE, heap_grow, heap_shrink, &arena);
+	ok = ok && !buddy_heap_init(&heap, HEAP_REGION_SIZE + HEAP_PINNED_SIZE, BUDDY_MIN_LEAF_SIZE, heap_grow, heap_shrink, &arena);
+	ok = ok && !buddy_heap_init(&heap, HEAP_REGION_SIZE, 2 * HEAP_REGION_SIZE, heap_grow, heap_shrink, &arena);
+
+	/* Sizes whose region would not fit in a size_t fail without growing, rather than looping forever */
+	ok = ok && buddy_heap_init(&heap, HEAP_REGION_SIZE, BUDDY_MIN_LEAF_SIZE, heap_grow, heap_shrink, &arena);
+	ok = ok && !buddy_heap_alloc(&heap, SIZE_MAX) && !buddy_heap_alloc(&heap, (SIZE_MAX >> 1) + 1) && !buddy_heap_alloc(&heap, (SIZE_MAX >> 2) + 2);
+
+	return ok && arena.grows == 0 && heap.num_regions == 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (!heap_check_limits()) {
+		fprintf(stderr, "invalid region sizes or huge allocations were not refused\n");
+		return 1;
+	}
+
+	if (!heap_check_regions()) {
+		fprintf(stderr, "growing, freeing across or trimming regions misbehaved\n");
+		return 1;
+	}
+
+	printf("heap: limit and region checks passed\n");
+
+	return 0;
+}
@@ -0,0 +1,351 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <buddy-alloc.h>
+#include <buddy-lockfree.h>
+
+#define LOCKFREE_MEMORY_SIZE (16 * 1024 * 1024)
+#define LOCKFREE_LEAF_SIZE BUDDY_MIN_LEAF_SIZE
+#define LOCKFREE_MAX_THREADS 64
+#define LOCKFREE_OPS_PER_THREAD 200000
+#define LOCKFREE_WORKING_SET 64
+#define LOCKFREE_MAILBOX_SLOTS 64
+#define LOCKFREE_MIN_ALLOC_SIZE (sizeof(lockfree_header_t) + sizeof(unsigned long int))
+#define LOCKFREE_MAX_ALLOC_SIZE 1024
+
+#define LOCKFREE_RAND_SEED 0x01371730UL
+
+typedef enum lockfree_mode {
+	LOCKFREE_MODE_GLOBAL_MUTEX,
+	LOCKFREE_MODE_LOCKFREE,
+} lockfree_mode_t;
+
+typedef struct lockfree_thread {
+	pthread_t thread;
+	unsigned int seed;
+	unsigned long int number;
+	unsigned long int failures;
+	unsigned long int corruptions;
+	unsigned long int double_handouts;
+} lockfree_thread_t;
+
+/* Every block starts with its size and a stamp unique to the allocation, the stamp is repeated at the end */
+typedef struct lockfree_header {
+	size_t size;
+	unsigned long int stamp;
+} lockfree_header_t;
+
+static unsigned long int memory[LOCKFREE_MEMORY_SIZE / sizeof(unsigned long int)];
+
+static lockfree_mode_t mode;
+static bool checking;
+static buddy_allocator_t *global_allocator;
+static pthread_mutex_t global_mutex = PTHREAD_MUTEX_INITIALIZER;
+static BUDDY_DECLARE_LOCKFREE(lockfree_allocator, LOCKFREE_MEMORY_SIZE, LOCKFREE_LEAF_SIZE);
+
+/* A bit per leaf set while a thread owns it, blocks are at most 64 leaves and aligned on their size so each fits in
+ * one word */
+static atomic_ulong owners[LOCKFREE_MEMORY_SIZE / LOCKFREE_LEAF_SIZE / BUDDY_NUM_BITS];
+
+/* Blocks parked here are freed by whichever thread picks them up next */
+static _Atomic(unsigned char *) mailbox[LOCKFREE_MAILBOX_SLOTS];
+
+static void *lockfree_alloc(size_t size)
+{
+	void *ptr;
+
+	if (mode == LOCKFREE_MODE_LOCKFREE)
+		return buddy_lockfree_alloc(lockfree_allocator, size);
+
+	pthread_mutex_lock(&global_mutex);
+	ptr = buddy_alloc(global_allocator, size);
+	pthread_mutex_unlock(&global_mutex);
+	return ptr;
+}
+
+static void lockfree_release(void *ptr, size_t size)
+{
+	if (mode == LOCKFREE_MODE_LOCKFREE) {
+		buddy_lockfree_release(lockfree_allocator, ptr, size);
+		return;
+	}
+
+	pthread_mutex_lock(&global_mutex);
+	buddy_release(global_allocator, ptr, size);
+	pthread_mutex_unlock(&global_mutex);
+}
+
+static void lockfree_free(void *ptr)
+{
+	if (mode == LOCKFREE_MODE_LOCKFREE) {
+		buddy_lockfree_free(lockfree_allocator, ptr);
+		return;
+	}
+
+	pthread_mutex_lock(&global_mutex);
+	buddy_free(global_allocator, ptr);
+	pthread_mutex_unlock(&global_mutex);
+}
+
+static unsigned long int owner_mask(const unsigned char *ptr, size_t size)
+{
+	unsigned long int leaf = (ptr - (unsigned char *)memory) / LOCKFREE_LEAF_SIZE;
+	unsigned long int leaves = (1UL << (BUDDY_NUM_BITS - __builtin_clzl(size - 1))) / LOCKFREE_LEAF_SIZE;
+
+	if (leaves >= BUDDY_NUM_BITS)
+		return ~0UL;
+	return ((1UL << leaves) - 1) << (leaf % BUDDY_NUM_BITS);
+}
+
+static atomic_ulong *owner_word(const unsigned char *ptr)
+{
+	return &owners[(ptr - (unsigned char *)memory) / LOCKFREE_LEAF_SIZE / BUDDY_NUM_BITS];
+}
+
+static void lockfree_take(lockfree_thread_t *self, unsigned char *ptr, size_t size)
+{
+	unsigned long int mask = owner_mask(ptr, size);
+
+	/* Any leaf of the block already owned means two threads were handed overlapping blocks */
+	if (checking && (atomic_fetch_or(owner_word(ptr), mask) & mask))
+		++self->double_handouts;
+}
+
+static void lockfree_give_up(unsigned char *ptr, size_t size)
+{
+	/* Disown before freeing, the leaves may be handed out again straight away */
+	if (checking)
+		atomic_fetch_and(owner_word(ptr), ~owner_mask(ptr, size));
+}
+
+static void lockfree_stamp(unsigned char *ptr, size_t size, unsigned long int stamp)
+{
+	lockfree_header_t header = { size, stamp };
+
+	memcpy(ptr, &header, sizeof(header));
+	memcpy(ptr + size - sizeof(stamp), &stamp, sizeof(stamp));
+}
+
+static bool lockfree_check(const unsigned char *ptr, size_t size)
+{
+	lockfree_header_t header;
+	unsigned long int stamp;
+
+	memcpy(&header, ptr, sizeof(header));
+	if (header.size != size)
+		return false;
+	memcpy(&stamp, ptr + size - sizeof(stamp), sizeof(stamp));
+	return header.stamp == stamp;
+}
+
+static size_t lockfree_size_of(const unsigned char *ptr)
+{
+	lockfree_header_t header;
+
+	memcpy(&header, ptr, sizeof(header));
+	return header.size;
+}
+
+static void lockfree_retire(lockfree_thread_t *self, unsigned char *ptr)
+{
+	size_t size = lockfree_size_of(ptr);
+
+	/* Blocks from other threads are checked and freed without their size */
+	if (size < LOCKFREE_MIN_ALLOC_SIZE || size > LOCKFREE_MAX_ALLOC_SIZE || !lockfree_check(ptr, size)) {
+		++self->corruptions;
+		return;
+	}
+	lockfree_give_up(ptr, size);
+	lockfree_free(ptr);
+}
+
+static void *lockfree_worker(void *arg)
+{
+	lockfree_thread_t *self = arg;
+	unsigned char *ptrs[LOCKFREE_WORKING_SET];
+	size_t sizes[LOCKFREE_WORKING_SET];
+	unsigned char *parked;
+
+	memset(ptrs, 0, sizeof(ptrs));
+
+	/* Churn a small working set of blocks, when checking hand some to other threads through the mailbox */
+	for (unsigned long int op = 0; op < LOCKFREE_OPS_PER_THREAD; ++op) {
+		int slot = rand_r(&self->seed) % LOCKFREE_WORKING_SET;
+		if (ptrs[slot]) {
+			if (!lockfree_check(ptrs[slot], sizes[slot]))
+				++self->corruptions;
+			if (checking && rand_r(&self->seed) % 4 == 0) {
+				parked = atomic_exchange(&mailbox[rand_r(&self->seed) % LOCKFREE_MAILBOX_SLOTS], ptrs[slot]);
+				if (parked)
+					lockfree_retire(self, parked);
+			} else {
+				lockfree_give_up(ptrs[slot], sizes[slot]);
+				lockfree_release(ptrs[slot], sizes[slot]);
+			}
+			ptrs[slot] = 0;
+		} else {
+			sizes[slot] = LOCKFREE_MIN_ALLOC_SIZE + (rand_r(&self->seed) % (LOCKFREE_MAX_ALLOC_SIZE - LOCKFREE_MIN_ALLOC_SIZE + 1));
+			ptrs[slot] = lockfree_alloc(sizes[slot]);
+			if (ptrs[slot]) {
+				lockfree_take(self, ptrs[slot], sizes[slot]);
+				lockfree_stamp(ptrs[slot], sizes[slot], (self->number << 32) | op);
+			} else
+				++self->failures;
+		}
+	}
+
+	for (int slot = 0; slot < LOCKFREE_WORKING_SET; ++slot) {
+		if (ptrs[slot]) {
+			lockfree_give_up(ptrs[slot], sizes[slot]);
+			lockfree_release(ptrs[slot], sizes[slot]);
+		}
+	}
+
+	return 0;
+}
+
+static unsigned long int lockfree_lost_blocks(void)
+{
+	unsigned long int lost = 0;
+	unsigned long int count;
+	size_t size;
+
+	/* With everything freed every block of every level must be available again, a stale mark anywhere in the tree
+	 * would hide some of them */
+	for (unsigned long int level = 0; level <= lockfree_allocator->max_level; ++level) {
+		size = LOCKFREE_MEMORY_SIZE >> level;
+		for (count = 0; buddy_lockfree_alloc(lockfree_allocator, size); ++count)
+			;
+		lost += (1UL << level) - count;
+		for (unsigned long int i = 0; i < count; ++i)
+			buddy_lockfree_release(lockfree_allocator, (unsigned char *)memory + (i * size), size);
+	}
+
+	return lost;
+}
+
+static bool lockfree_check_rounded_region(void)
+{
+	size_t size = LOCKFREE_MEMORY_SIZE / 2;
+	unsigned long int count;
+	bool ok;
+
+	/* A region three quarters of the memory is managed as the half below it, down to single leaves */
+	buddy_lockfree_init(lockfree_allocator, memory, (LOCKFREE_MEMORY_SIZE / 4) * 3, LOCKFREE_LEAF_SIZE);
+	ok = lockfree_allocator->size == size && lockfree_allocator->max_level == BUDDY_ILOG2(size / LOCKFREE_LEAF_SIZE);
+	ok = ok && !buddy_lockfree_alloc(lockfree_allocator, size + 1) && buddy_lockfree_available(lockfree_allocator) == size;
+	for (count = 0; ok && buddy_lockfree_alloc(lockfree_allocator, 1); ++count)
+		;
+	ok = ok && count == size / LOCKFREE_LEAF_SIZE && buddy_lockfree_used(lockfree_allocator) == size;
+	for (unsigned long int i = 0; i < count; ++i)
+		buddy_lockfree_free(lockfree_allocator, (unsigned char *)memory + (i * LOCKFREE_LEAF_SIZE));
+
+	/* And the whole of it is one block again */
+	ok = ok && buddy_lockfree_alloc(lockfree_allocator, size) == memory;
+
+	return ok;
+}
+
+static double lockfree_run(lockfree_mode_t run_mode, int num_threads, bool run_checking)
+{
+	lockfree_thread_t threads[LOCKFREE_MAX_THREADS];
+	lockfree_thread_t drain = { 0 };
+	struct timespec start;
+	struct timespec end;
+	unsigned long int failures = 0;
+	unsigned long int corruptions = 0;
+	unsigned long int double_handouts = 0;
+	unsigned char *parked;
+	size_t used;
+
+	mode = run_mode;
+	checking = run_checking;
+	if (mode == LOCKFREE_MODE_LOCKFREE) {
+		buddy_lockfree_init(lockfree_allocator, memory, LOCKFREE_MEMORY_SIZE, LOCKFREE_LEAF_SIZE);
+		used = buddy_lockfree_used(lockfree_allocator);
+	} else {
+		global_allocator = buddy_create(memory, LOCKFREE_MEMORY_SIZE);
+		used = buddy_used(global_allocator);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < num_threads; ++i) {
+		threads[i].seed = LOCKFREE_RAND_SEED + i;
+		threads[i].number = i;
+		threads[i].failures = 0;
+		threads[i].corruptions = 0;
+		threads[i].double_handouts = 0;
+		pthread_create(&threads[i].thread, 0, lockfree_worker, &threads[i]);
+	}
+	for (int i = 0; i < num_threads; ++i) {
+		pthread_join(threads[i].thread, 0);
+		failures += threads[i].failures;
+		corruptions += threads[i].corruptions;
+		double_handouts += threads[i].double_handouts;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	/* Free whatever is left in the mailbox */
+	for (int i = 0; i < LOCKFREE_MAILBOX_SLOTS; ++i) {
+		parked = atomic_exchange(&mailbox[i], 0);
+		if (parked)
+			lockfree_retire(&drain, parked);
+	}
+	corruptions += drain.corruptions;
+
+	/* Everything should be back where it started */
+	if (mode == LOCKFREE_MODE_LOCKFREE)
+		used = buddy_lockfree_used(lockfree_allocator) - used;
+	else
+		used = buddy_used(global_allocator) - used;
+
+	if (failures || corruptions || double_handouts || used)
+		printf("\t%lu failures, %lu corruptions, %lu double handouts, %zu bytes lost\n", failures, corruptions, double_handouts, used);
+
+	return (num_threads * (double)LOCKFREE_OPS_PER_THREAD) / ((end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1e9));
+}
+
+int main(int argc, char **argv)
+{
+	int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+	unsigned long int lost;
+
+	if (max_threads < 1 || max_threads > LOCKFREE_MAX_THREADS)
+		max_threads = LOCKFREE_MAX_THREADS;
+
+	if (!lockfree_check_rounded_region()) {
+		fprintf(stderr, "a region whose size is not a power of two was not rounded down to one\n");
+		return 1;
+	}
+
+	/* Heavy churn with cross thread frees, checking every handout against the leaves already owned */
+	printf("lock-free allocator stress: %d threads, %d ops per thread\n", max_threads, LOCKFREE_OPS_PER_THREAD);
+	lockfree_run(LOCKFREE_MODE_LOCKFREE, max_threads, true);
+	if (!buddy_lockfree_used(lockfree_allocator) && (lost = lockfree_lost_blocks()))
+		printf("\t%lu blocks lost\n", lost);
+
+	printf("lock-free allocator throughput: %d ops per thread\n", LOCKFREE_OPS_PER_THREAD);
+	printf("%8s %16s %16s %8s\n", "threads", "mutex ops/s", "lock-free ops/s", "speedup");
+	for (int num_threads = 1; num_threads <= max_threads; num_threads <<= 1) {
+		double mutex_rate = lockfree_run(LOCKFREE_MODE_GLOBAL_MUTEX, num_threads, false);
+		double lockfree_rate = lockfree_run(LOCKFREE_MODE_LOCKFREE, num_threads, false);
+		printf("%8d %16.0f %16.0f %7.2fx\n", num_threads, mutex_rate, lockfree_rate, lockfree_rate / mutex_rate);
+	}
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include <buddy-alloc.h>
+
+/* The region is mapped without any access, so the test faults the moment the allocator touches it */
+#define OOB_MEMORY_SIZE (4UL * 1024UL * 1024UL)
+#define OOB_MAX_TIME 1000000
+#define OOB_MAX_ALLOC_SIZE (100 * 1024)
+#define OOB_MAX_DELAY 5
+#define OOB_MAX_BLOCKS 4096
+#define OOB_RAND_SEED 0x01371730UL
+
+typedef struct oob_block {
+	unsigned char *ptr;
+	size_t size;
+	int expire;
+} oob_block_t;
+
+static BUDDY_DECLARE_ALLOCATOR(allocator, OOB_MEMORY_SIZE);
+static oob_block_t blocks[OOB_MAX_BLOCKS];
+static unsigned char leaves[OOB_MEMORY_SIZE / BUDDY_MIN_LEAF_SIZE];
+
+/* Mark or clear the leaves a block covers, failing when one is already in the state wanted */
+static bool oob_track(unsigned char *region, const oob_block_t *block, unsigned char state)
+{
+	size_t first = (block->ptr - region) / BUDDY_MIN_LEAF_SIZE;
+
+	if (block->ptr < region || block->ptr + block->size > region + OOB_MEMORY_SIZE || ((block->ptr - region) & (block->size - 1)))
+		return false;
+
+	for (size_t leaf = first; leaf < first + block->size / BUDDY_MIN_LEAF_SIZE; ++leaf) {
+		if (leaves[leaf] == state)
+			return false;
+		leaves[leaf] = state;
+	}
+
+	return true;
+}
+
+static bool oob_run(unsigned char *region)
+{
+	unsigned long int failures = 0;
+	size_t count = 0;
+	size_t size;
+	bool ok = true;
+
+	buddy_init(allocator, region, OOB_MEMORY_SIZE);
+	ok = buddy_available(allocator) == OOB_MEMORY_SIZE;
+
+	/* The simulator workload, blocks live for a few steps and the sizes span most of the levels */
+	srand(OOB_RAND_SEED);
+	for (int mark = 0; ok && mark < OOB_MAX_TIME; ++mark) {
+		size = BUDDY_MIN_LEAF_SIZE + (rand() % (OOB_MAX_ALLOC_SIZE - BUDDY_MIN_LEAF_SIZE));
+		if (count < OOB_MAX_BLOCKS) {
+			/* Every eighth block asks for an alignment beyond its size */
+			blocks[count].ptr = (mark & 7) ? buddy_alloc(allocator, size) : buddy_alloc_aligned(allocator, 4UL << BUDDY_CLOG2(size), size);
+			blocks[count].expire = mark + (rand() % OOB_MAX_DELAY);
+			if (blocks[count].ptr) {
+				blocks[count].size = buddy_usable_size(allocator, blocks[count].ptr);
+				ok = blocks[count].size >= size && oob_track(region, &blocks[count], 1);
+				++count;
+			} else
+				++failures;
+		}
+
+		/* Expired blocks go back, alternating sized and unsized frees */
+		for (size_t i = 0; ok && i < count;) {
+			if (blocks[i].expire > mark) {
+				++i;
+				continue;
+			}
+			ok = oob_track(region, &blocks[i], 0);
+			if (mark & 1)
+				buddy_release(allocator, blocks[i].ptr, blocks[i].size);
+			else
+				buddy_free(allocator, blocks[i].ptr);
+			blocks[i] = blocks[--count];
+		}
+	}
+
+	/* Drain what is left, after which the whole region must be one free block again */
+	while (ok && count > 0) {
+		ok = oob_track(region, &blocks[--count], 0);
+		buddy_free(allocator, blocks[count].ptr);
+	}
+	ok = ok && buddy_used(allocator) == 0 && buddy_largest_available(allocator) == OOB_MEMORY_SIZE;
+	if (!ok)
+		fprintf(stderr, "%lu failures, %zu used, %zu largest available\n", failures, buddy_used(allocator), buddy_largest_available(allocator));
+
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char *region = mmap(0, OOB_MEMORY_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (region == MAP_FAILED) {
+		fprintf(stderr, "could not map the region\n");
+		return 1;
+	}
+
+	if (!oob_run(region)) {
+		fprintf(stderr, "blocks overlapped, strayed outside the region or went missing\n");
+		return 1;
+	}
+
+	munmap(region, OOB_MEMORY_SIZE);
+	printf("oob: simulator workload over an inaccessible region passed\n");
+
+	return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <buddy-alloc.h>
+
+#define PAGES_MEMORY_SIZE (64UL * 1024 * 1024)
+#define PAGES_PAGE_SIZE 4096UL
+#define PAGES_NUM_PAGES (PAGES_MEMORY_SIZE / PAGES_PAGE_SIZE)
+#define PAGES_MIN_BLOCK (64UL * 1024)
+#define PAGES_LOW (512UL * 1024)
+#define PAGES_HIGH (1024UL * 1024)
+#define PAGES_CHURN_CYCLES 1000
+#define PAGES_SPIKE_CYCLES 100
+#define PAGES_SPIKE_BLOCKS 4
+#define PAGES_SPIKE_SIZE (8UL * 1024 * 1024)
+
+/* What the hooks have seen, with the state of every page as the allocator asked for it */
+typedef struct pages_counters {
+	unsigned long int decommits;
+	unsigned long int commits;
+	size_t decommitted;
+	size_t committed;
+	unsigned long int errors;
+	unsigned char released[PAGES_NUM_PAGES];
+} pages_counters_t;
+
+static unsigned char *memory;
+static buddy_allocator_t *allocator;
+static pages_counters_t counters;
+
+static void pages_decommit(void *address, size_t size, void *context)
+{
+	pages_counters_t *pages = context;
+	unsigned long int first = ((unsigned char *)address - memory) / PAGES_PAGE_SIZE;
+
+	++pages->decommits;
+	pages->decommitted += size;
+
+	/* Whole pages never released twice */
+	if (((unsigned char *)address - memory) % PAGES_PAGE_SIZE || size % PAGES_PAGE_SIZE)
+		++pages->errors;
+	for (unsigned long int page = first; page < first + size / PAGES_PAGE_SIZE; ++page) {
+		pages->errors += pages->released[page];
+		pages->released[page] = 1;
+	}
+
+	madvise(address, size, MADV_DONTNEED);
+}
+
+static void pages_commit(void *address, size_t size, void *context)
+{
+	pages_counters_t *pages = context;
+	unsigned long int first = ((unsigned char *)address - memory) / PAGES_PAGE_SIZE;
+
+	++pages->commits;
+	pages->committed += size;
+
+	/* Only pages which were released are brought back */
+	for (unsigned long int page = first; page < first + size / PAGES_PAGE_SIZE; ++page) {
+		pages->errors += !pages->released[page];
+		pages->released[page] = 0;
+	}
+}
+
+static bool pages_check_block(const void *ptr, size_t size)
+{
+	unsigned long int first = ((const unsigned char *)ptr - memory) / PAGES_PAGE_SIZE;
+	unsigned long int last = ((const unsigned char *)ptr - memory + size - 1) / PAGES_PAGE_SIZE;
+
+	/* Every page handed out must have been committed */
+	for (unsigned long int page = first; page <= last; ++page)
+		if (counters.released[page])
+			return false;
+
+	return true;
+}
+
+static bool pages_check_released(void)
+{
+	buddy_stats_t stats;
+	size_t released = 0;
+
+	/* The allocator and the hooks must agree on what is released */
+	for (unsigned long int page = 0; page < PAGES_NUM_PAGES; ++page)
+		released += counters.released[page] * PAGES_PAGE_SIZE;
+	buddy_stats(allocator, &stats, 0, 0);
+
+	return stats.released == released && counters.decommitted - counters.committed == released;
+}
+
+static bool pages_check_madvise(buddy_page_hook_t hook, bool zeroed)
+{
+	unsigned char resident[PAGES_NUM_PAGES];
+	buddy_stats_t stats;
+	unsigned char *ptr;
+	size_t trimmed;
+	bool ok;
+
+	/* Dirty the whole region, then turn page release on with a high watermark nothing reaches */
+	buddy_init(allocator, memory, PAGES_MEMORY_SIZE);
+	ptr = buddy_alloc(allocator, PAGES_MEMORY_SIZE);
+	ok = ptr == memory;
+	memset(memory, 0xa5, PAGES_MEMORY_SIZE);
+	buddy_free(allocator, ptr);
+	ok = ok && buddy_set_page_release(allocator, PAGES_PAGE_SIZE, PAGES_MIN_BLOCK, 0, PAGES_MEMORY_SIZE, hook, 0, 0);
+	buddy_stats(allocator, &stats, 0, 0);
+	ok = ok && stats.released == 0;
+
+	/* Trimming hands all but the page holding the free list links to the hook */
+	trimmed = buddy_trim(allocator);
+	buddy_stats(allocator, &stats, 0, 0);
+	ok = ok && trimmed >= PAGES_MEMORY_SIZE - PAGES_PAGE_SIZE && stats.released == trimmed;
+
+	/* MADV_DONTNEED drops the pages at once and they come back zero filled, MADV_FREE may leave them be */
+	if (zeroed && mincore(memory, PAGES_MEMORY_SIZE, resident) == 0) {
+		for (unsigned long int page = 1; page < PAGES_NUM_PAGES; ++page)
+			ok = ok && !(resident[page] & 1);
+		ok = ok && memory[PAGES_MEMORY_SIZE - 1] == 0;
+	}
+
+	/* Handing the region out again recommits it, with no commit hook writing to it is enough */
+	ptr = buddy_alloc(allocator, PAGES_MEMORY_SIZE);
+	buddy_stats(allocator, &stats, 0, 0);
+	ok = ok && ptr == memory && stats.released == 0;
+	memset(memory, 0x5a, PAGES_MEMORY_SIZE);
+	ok = ok && memory[PAGES_MEMORY_SIZE - 1] == 0x5a;
+	buddy_free(allocator, ptr);
+
+	return buddy_set_page_release(allocator, 0, 0, 0, 0, 0, 0, 0) && ok;
+}
+
+static int pages_fail(const char *what)
+{
+	fprintf(stderr, "page release test failed: %s\n", what);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long int decommits;
+	unsigned long int commits;
+	size_t decommitted;
+	void *spike[PAGES_SPIKE_BLOCKS];
+	void *ptr;
+
+	memory = mmap(0, PAGES_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	allocator = malloc(buddy_sizeof_metadata(PAGES_MEMORY_SIZE, BUDDY_MIN_LEAF_SIZE));
+	if (memory == MAP_FAILED || !allocator) {
+		perror("test allocation failed");
+		return 1;
+	}
+	buddy_init(allocator, memory, PAGES_MEMORY_SIZE);
+
+	/* Pages which are not a power of two or smaller than a leaf are refused without touching the region */
+	if (buddy_set_page_release(allocator, 3000, PAGES_MIN_BLOCK, PAGES_LOW, PAGES_HIGH, pages_decommit, pages_commit, &counters) ||
+		buddy_set_page_release(allocator, BUDDY_MIN_LEAF_SIZE / 2, PAGES_MIN_BLOCK, PAGES_LOW, PAGES_HIGH, pages_decommit, pages_commit, &counters) ||
+		counters.decommits)
+		return pages_fail("bad page size accepted");
+
+	/* The whole free region is well above the high watermark, so it is released in one go */
+	if (!buddy_set_page_release(allocator, PAGES_PAGE_SIZE, PAGES_MIN_BLOCK, PAGES_LOW, PAGES_HIGH, pages_decommit, pages_commit, &counters))
+		return pages_fail("page size refused");
+	if (counters.decommits != 1 || !pages_check_released())
+		return pages_fail("initial release");
+
+	/* Churn of a small block only brings back the pages the first split needs for its free list links, after that
+	 * neither hook is called again */
+	for (int cycle = 0; cycle < PAGES_CHURN_CYCLES; ++cycle) {
+		ptr = buddy_alloc(allocator, 16);
+		if (!ptr || !pages_check_block(ptr, 16))
+			return pages_fail("small block not committed");
+		memset(ptr, 0xa5, 16);
+		buddy_free(allocator, ptr);
+		if (cycle == 0) {
+			decommits = counters.decommits;
+			commits = counters.commits;
+		}
+	}
+	printf("small churn: %lu decommits, %lu commits over %d cycles\n", counters.decommits, counters.commits, PAGES_CHURN_CYCLES);
+	if (counters.decommits != 1 || counters.commits != decommits + commits - 1 || commits > allocator->max_level)
+		return pages_fail("hooks called by small block churn");
+	if (counters.errors || !pages_check_released())
+		return pages_fail("small churn accounting");
+
+	/* Spikes of large blocks are committed as they are handed out and released again once freed, each time only the
+	 * pages the spike brought back are released */
+	decommits = counters.decommits;
+	decommitted = counters.decommitted;
+	for (int cycle = 0; cycle < PAGES_SPIKE_CYCLES; ++cycle) {
+		for (int i = 0; i < PAGES_SPIKE_BLOCKS; ++i) {
+			spike[i] = buddy_alloc(allocator, PAGES_SPIKE_SIZE);
+			if (!spike[i] || !pages_check_block(spike[i], PAGES_SPIKE_SIZE))
+				return pages_fail("large block not committed");
+			memset(spike[i], cycle, PAGES_SPIKE_SIZE);
+		}
+		for (int i = 0; i < PAGES_SPIKE_BLOCKS; ++i)
+			buddy_free(allocator, spike[i]);
+	}
+	printf("large spikes: %lu decommits of %zu bytes over %d cycles\n", counters.decommits - decommits, counters.decommitted - decommitted, PAGES_SPIKE_CYCLES);
+	if (counters.decommitted - decommitted > PAGES_SPIKE_CYCLES * (PAGES_SPIKE_BLOCKS * PAGES_SPIKE_SIZE + PAGES_HIGH))
+		return pages_fail("more released than the spikes committed");
+	if (counters.errors || !pages_check_released())
+		return pages_fail("spike accounting");
+
+	/* Trimming releases the rest of the large free blocks, turning page release off brings everything back */
+	buddy_trim(allocator);
+	if (counters.errors || !pages_check_released())
+		return pages_fail("trim accounting");
+	buddy_set_page_release(allocator, 0, 0, 0, 0, 0, 0, 0);
+	if (counters.errors || counters.decommitted != counters.committed || buddy_used(allocator) != 0)
+		return pages_fail("turning page release off");
+
+	/* The default hook and the lazy one, released by buddy_trim() alone */
+	if (!pages_check_madvise(0, true))
+		return pages_fail("trim with buddy_pages_dontneed()");
+	if (!pages_check_madvise(buddy_pages_free, false))
+		return pages_fail("trim with buddy_pages_free()");
+	printf("madvise hooks: trim released and recommitted the region\n");
+
+	free(allocator);
+	munmap(memory, PAGES_MEMORY_SIZE);
+
+	return 0;
+}
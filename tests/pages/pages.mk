@@ -0,0 +1,25 @@
+#
+# Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+# 
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+#
+
+ifeq ($(findstring ${BUILD_ROOT},${CURDIR}),)
+include ${PROJECT_ROOT}/tools/makefiles/target.mk
+else
+
+EXEC := pages
+
+include ${PROJECT_ROOT}/tools/makefiles/project.mk
+
+# The test builds its own copy of the allocator with page release, whatever the configuration of the library
+CPPFLAGS := $(filter-out -DBUDDY_RELOCATABLE -DBUDDY_MEMORY_ALIGNED_ON_SIZE,${CPPFLAGS})
+CPPFLAGS += -DBUDDY_PAGE_RELEASE
+CPPFLAGS += -I ${SOURCE_DIR}/../../include
+
+endif
+
+
+
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <buddy-alloc.h>
+
+#include "../test-rand.h"
+
+#define POLICY_MEMORY_SIZE (16 * 1024 * 1024)
+#define POLICY_MAX_DELAY 256
+#define POLICY_DEFAULT_TICKS 100000UL
+
+#define POLICY_RAND_SEED 0x01371730UL
+
+typedef struct policy_workload {
+	const char *name;
+	size_t memory_size;
+	size_t max_size;
+	unsigned long int max_delay;
+	unsigned long int per_tick;
+} policy_workload_t;
+
+typedef struct policy_data {
+	unsigned long int expire;
+	size_t size;
+	struct policy_data *next;
+	unsigned char data[];
+} policy_data_t;
+
+typedef struct policy_result {
+	double ops_per_sec;
+	double fragmentation;
+	size_t high_water;
+	unsigned long int failures;
+} policy_result_t;
+
+/* The simulator workload as it is, then many more short lived small blocks filling a larger region to the point of
+ * failing now and then */
+static const policy_workload_t workloads[] = {
+	{ "sim", 1024 * 1024, 100 * 1024, 5, 1 },
+	{ "small", POLICY_MEMORY_SIZE, 4 * 1024, POLICY_MAX_DELAY, 48 },
+};
+
+static const char *policy_names[] = { "fifo", "lifo", "address" };
+
+static unsigned long int memory[POLICY_MEMORY_SIZE / sizeof(unsigned long int)];
+static buddy_allocator_t *allocator;
+static unsigned long long int policy_state;
+
+static inline long int policy_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static int policy_run(const policy_workload_t *workload, buddy_policy_t policy, unsigned long int ticks, unsigned long long int seed, policy_result_t *result)
+{
+	policy_data_t *expiring[POLICY_MAX_DELAY];
+	policy_data_t *datum;
+	unsigned long int fragmentation = 0;
+	unsigned long int ops = 0;
+	unsigned long int delay;
+	unsigned long int slot;
+	size_t size;
+	size_t end;
+	long int start;
+
+	memset(result, 0, sizeof(*result));
+	memset(expiring, 0, sizeof(expiring));
+	policy_state = seed;
+	buddy_init(allocator, memory, workload->memory_size);
+	if (!buddy_set_policy(allocator, policy))
+		return 0;
+
+	/* Every tick allocates blocks which live for a few ticks, writing them as their owner would, then frees the ones
+	 * expiring, so the order blocks are reused in shows up in the cache misses of the writes */
+	start = policy_now();
+	for (unsigned long int tick = 0; tick < ticks; ++tick) {
+		for (unsigned long int i = 0; i < workload->per_tick; ++i) {
+			size = sizeof(policy_data_t) + (test_rand(&policy_state) % (workload->max_size - sizeof(policy_data_t)));
+			delay = test_rand(&policy_state) % workload->max_delay;
+
+			datum = buddy_alloc(allocator, size);
+			++ops;
+			if (!datum) {
+				++result->failures;
+				continue;
+			}
+			memset(datum->data, (int)tick, size - sizeof(policy_data_t));
+			slot = (tick + delay) % workload->max_delay;
+			datum->expire = tick + delay;
+			datum->size = size;
+			datum->next = expiring[slot];
+			expiring[slot] = datum;
+
+			/* How far into the region the heap reaches */
+			end = (unsigned char *)datum + size - (unsigned char *)memory;
+			if (end > result->high_water)
+				result->high_water = end;
+		}
+
+		fragmentation += buddy_fragmentation(allocator);
+
+		slot = tick % workload->max_delay;
+		while ((datum = expiring[slot]) != 0) {
+			expiring[slot] = datum->next;
+			buddy_free(allocator, datum);
+			++ops;
+		}
+	}
+	result->ops_per_sec = ops / ((policy_now() - start) / 1e9);
+	result->fragmentation = (double)fragmentation / ticks;
+
+	for (slot = 0; slot < workload->max_delay; ++slot) {
+		while ((datum = expiring[slot]) != 0) {
+			expiring[slot] = datum->next;
+			buddy_free(allocator, datum);
+		}
+	}
+
+	return buddy_used(allocator) == 0 ? 1 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long int ticks = argc > 1 ? strtoul(argv[1], 0, 0) : POLICY_DEFAULT_TICKS;
+	unsigned long long int seed = argc > 2 ? strtoull(argv[2], 0, 0) : POLICY_RAND_SEED;
+	policy_result_t result;
+	int status;
+
+	if (!ticks)
+		ticks = POLICY_DEFAULT_TICKS;
+	if (!seed)
+		seed = POLICY_RAND_SEED;
+
+	/* Keep the metadata outside the region so the whole region is available */
+	allocator = malloc(buddy_sizeof_metadata(POLICY_MEMORY_SIZE, BUDDY_MIN_LEAF_SIZE));
+	if (!allocator) {
+		perror("metadata allocation failed");
+		return 1;
+	}
+
+	printf("placement policy benchmark: %lu ticks, seed 0x%llx\n", ticks, seed);
+	printf("%-8s %-8s %12s %8s %12s %8s\n", "workload", "policy", "ops/s", "frag", "high water", "failures");
+
+	for (unsigned long int workload = 0; workload < sizeof(workloads) / sizeof(workloads[0]); ++workload) {
+		for (int policy = BUDDY_POLICY_FIFO; policy <= BUDDY_POLICY_ADDRESS; ++policy) {
+			status = policy_run(&workloads[workload], policy, ticks, seed, &result);
+			if (status < 0) {
+				fprintf(stderr, "blocks outstanding after the %s run\n", policy_names[policy]);
+				return 1;
+			}
+
+			printf("%-8s %-8s ", workloads[workload].name, policy_names[policy]);
+			if (status == 0)
+				printf("%12s\n", "unsupported");
+			else
+				printf("%12.0f %7.1f%% %10zuKB %8lu\n", result.ops_per_sec, result.fragmentation, result.high_water >> 10, result.failures);
+		}
+	}
+
+	free(allocator);
+
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <buddy-alloc.h>
+
+#define RESIZE_MEMORY_SIZE (1024UL * 1024UL)
+#define RESIZE_MAX_BLOCKS 4096
+
+#define RESIZE_RAND_SEED 0x01371730UL
+
+static void *memory;
+static void *ptrs[RESIZE_MAX_BLOCKS];
+static size_t sizes[RESIZE_MAX_BLOCKS];
+
+static buddy_allocator_t *resize_create(void)
+{
+	/* Metadata kept apart so the whole region is free and splits the same way every time, and the region aligned on
+	 * its size so builds with BUDDY_MEMORY_ALIGNED_ON_SIZE work too */
+	buddy_allocator_t *allocator = malloc(buddy_sizeof_metadata(RESIZE_MEMORY_SIZE, BUDDY_MIN_LEAF_SIZE));
+
+	memory = aligned_alloc(RESIZE_MEMORY_SIZE, RESIZE_MEMORY_SIZE);
+	if (!allocator || !memory)
+		return 0;
+	buddy_init(allocator, memory, RESIZE_MEMORY_SIZE);
+
+	return allocator;
+}
+
+static void resize_destroy(buddy_allocator_t *allocator)
+{
+	free(allocator);
+	free(memory);
+}
+
+static bool resize_check_pattern(const unsigned char *ptr, size_t size, unsigned char seed)
+{
+	for (size_t i = 0; i < size; ++i)
+		if (ptr[i] != (unsigned char)(seed + i))
+			return false;
+
+	return true;
+}
+
+static void resize_fill_pattern(unsigned char *ptr, size_t size, unsigned char seed)
+{
+	for (size_t i = 0; i < size; ++i)
+		ptr[i] = (unsigned char)(seed + i);
+}
+
+static bool resize_check_realloc(void)
+{
+	buddy_allocator_t *allocator = resize_create();
+	unsigned char *ptr;
+	unsigned char *buddy;
+	unsigned char *moved;
+	size_t available;
+	bool ok;
+
+	if (!allocator)
+		return false;
+	available = buddy_available(allocator);
+
+	/* A null pointer allocates */
+	ptr = buddy_realloc(allocator, 0, 64);
+	ok = ptr && buddy_available(allocator) == available - 64;
+
+	/* The right hand buddies of a fresh split are free, so the block grows where it is */
+	ok = ok && ptr == memory;
+	resize_fill_pattern(ptr, 64, 1);
+	ok = ok && buddy_realloc(allocator, ptr, 4096) == ptr && buddy_available(allocator) == available - 4096;
+	ok = ok && resize_check_pattern(ptr, 64, 1);
+
+	/* Shrinking splits off the tail halves in place */
+	ok = ok && buddy_realloc(allocator, ptr, 100) == ptr && buddy_available(allocator) == available - 128;
+	ok = ok && resize_check_pattern(ptr, 64, 1);
+
+	/* Same size class, nothing to do */
+	ok = ok && buddy_realloc(allocator, ptr, 65) == ptr && buddy_available(allocator) == available - 128;
+
+	/* With the right hand buddy in use the block moves, keeping its contents and freeing the old block */
+	buddy = buddy_alloc(allocator, 128);
+	ok = ok && buddy == ptr + 128;
+	resize_fill_pattern(ptr, 128, 2);
+	moved = buddy_realloc(allocator, ptr, 256);
+	ok = ok && moved && moved != ptr && resize_check_pattern(moved, 128, 2);
+	ok = ok && buddy_available(allocator) == available - 256 - 128;
+	ptr = moved;
+
+	/* A size beyond the region fails and leaves the block untouched */
+	ok = ok && !buddy_realloc(allocator, ptr, 2 * RESIZE_MEMORY_SIZE) && resize_check_pattern(ptr, 128, 2);
+	ok = ok && buddy_available(allocator) == available - 256 - 128;
+
+	/* As does a size larger than any free block */
+	ok = ok && !buddy_realloc(allocator, ptr, RESIZE_MEMORY_SIZE) && resize_check_pattern(ptr, 128, 2);
+
+	/* Size zero frees */
+	ok = ok && !buddy_realloc(allocator, ptr, 0) && !buddy_realloc(allocator, buddy, 0);
+	buddy_coalesce_all(allocator);
+	ok = ok && buddy_available(allocator) == available;
+
+	resize_destroy(allocator);
+	return ok;
+}
+
+static size_t resize_class(size_t size)
+{
+	size_t block_size = BUDDY_MIN_LEAF_SIZE;
+
+	while (block_size < size)
+		block_size <<= 1;
+
+	return block_size;
+}
+
+static bool resize_check_usable_size(void)
+{
+	buddy_allocator_t *allocator = resize_create();
+	unsigned long long int state = RESIZE_RAND_SEED;
+	unsigned char *ptr;
+	size_t available;
+	size_t count;
+	bool ok;
+
+	if (!allocator)
+		return false;
+	available = buddy_available(allocator);
+	ok = buddy_usable_size(allocator, 0) == 0;
+
+	/* Neighbouring blocks of every size, so the packed entries of the level map share words */
+	for (count = 0; count < RESIZE_MAX_BLOCKS; ++count) {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		sizes[count] = 1 + ((state >> 33) % (16UL << ((state >> 24) % 10)));
+		ptrs[count] = buddy_alloc(allocator, sizes[count]);
+		if (!ptrs[count])
+			break;
+	}
+	ok = ok && count > 0;
+
+	/* Checked once all are allocated, later entries must not clobber earlier ones */
+	for (size_t i = 0; ok && i < count; ++i)
+		ok = buddy_usable_size(allocator, ptrs[i]) == resize_class(sizes[i]);
+	for (size_t i = 0; i < count; i += 2)
+		buddy_free(allocator, ptrs[i]);
+
+	/* Aligned blocks and resized blocks report their new size */
+	ptr = buddy_alloc_aligned(allocator, 4096, 48);
+	ok = ok && ptr && !(((unsigned char *)ptr - (unsigned char *)memory) & 4095) && buddy_usable_size(allocator, ptr) == 64;
+	ptr = buddy_realloc(allocator, ptr, 20);
+	ok = ok && ptr && buddy_usable_size(allocator, ptr) == 32;
+	ptr = buddy_realloc(allocator, ptr, 1000);
+	ok = ok && ptr && buddy_usable_size(allocator, ptr) == 1024;
+	buddy_free(allocator, ptr);
+
+	/* Unsized frees find every size */
+	for (size_t i = 1; i < count; i += 2)
+		buddy_free(allocator, ptrs[i]);
+	buddy_coalesce_all(allocator);
+	ok = ok && buddy_available(allocator) == available;
+
+	resize_destroy(allocator);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (!resize_check_realloc()) {
+		fprintf(stderr, "reallocation misbehaved\n");
+		return 1;
+	}
+
+	if (!resize_check_usable_size()) {
+		fprintf(stderr, "usable size does not match the size of the block\n");
+		return 1;
+	}
+
+	printf("resize: realloc and usable size checks passed\n");
+
+	return 0;
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <buddy-alloc.h>
+#include <buddy-shard.h>
+#include <buddy-cache.h>
+
+#define SHARD_MEMORY_SIZE (64 * 1024 * 1024)
+#define SHARD_NUM_SHARDS 16
+#define SHARD_MAX_THREADS 64
+#define SHARD_OPS_PER_THREAD 200000
+#define SHARD_WORKING_SET 64
+#define SHARD_MAX_ALLOC_SIZE 1024
+
+#define SHARD_RAND_SEED 0x01371730UL
+
+/* Regions which do not split into power of two shards, the second leaving a remainder for the last shard */
+#define SHARD_ODD_MEMORY_SIZE (3 * 1024 * 1024)
+#define SHARD_ODD_REMAINDER 12345
+#define SHARD_ODD_MAX_BLOCKS 16384
+
+typedef enum shard_mode {
+	SHARD_MODE_GLOBAL_MUTEX,
+	SHARD_MODE_SHARDED,
+	SHARD_MODE_CACHED,
+} shard_mode_t;
+
+typedef struct shard_thread {
+	pthread_t thread;
+	unsigned int seed;
+	unsigned long int failures;
+	unsigned long int corruptions;
+} shard_thread_t;
+
+static unsigned long int memory[SHARD_MEMORY_SIZE / sizeof(unsigned long int)];
+
+static shard_mode_t mode;
+static buddy_allocator_t *global_allocator;
+static pthread_mutex_t global_mutex = PTHREAD_MUTEX_INITIALIZER;
+static BUDDY_DECLARE_SHARDS(sharded_allocator, SHARD_NUM_SHARDS);
+static buddy_lock_t cached_lock = BUDDY_LOCK_INIT;
+static _Thread_local buddy_cache_t thread_cache;
+
+static void *shard_alloc(size_t size)
+{
+	void *ptr;
+
+	if (mode == SHARD_MODE_SHARDED)
+		return buddy_shards_alloc(sharded_allocator, size);
+
+	if (mode == SHARD_MODE_CACHED)
+		return buddy_cache_alloc(&thread_cache, size);
+
+	pthread_mutex_lock(&global_mutex);
+	ptr = buddy_alloc(global_allocator, size);
+	pthread_mutex_unlock(&global_mutex);
+	return ptr;
+}
+
+static void shard_release(void *ptr, size_t size)
+{
+	if (mode == SHARD_MODE_SHARDED) {
+		buddy_shards_release(sharded_allocator, ptr, size);
+		return;
+	}
+
+	if (mode == SHARD_MODE_CACHED) {
+		buddy_cache_release(&thread_cache, ptr, size);
+		return;
+	}
+
+	pthread_mutex_lock(&global_mutex);
+	buddy_release(global_allocator, ptr, size);
+	pthread_mutex_unlock(&global_mutex);
+}
+
+static void *shard_worker(void *arg)
+{
+	shard_thread_t *self = arg;
+	unsigned char *ptrs[SHARD_WORKING_SET];
+	size_t sizes[SHARD_WORKING_SET];
+	unsigned char tag = (unsigned char)self->seed;
+
+	memset(ptrs, 0, sizeof(ptrs));
+	if (mode == SHARD_MODE_CACHED)
+		buddy_cache_init(&thread_cache, global_allocator, &cached_lock);
+
+	/* Churn a small working set of blocks, tagging each to catch double handouts */
+	for (int op = 0; op < SHARD_OPS_PER_THREAD; ++op) {
+		int slot = rand_r(&self->seed) % SHARD_WORKING_SET;
+		if (ptrs[slot]) {
+			if (ptrs[slot][0] != tag || ptrs[slot][sizes[slot] - 1] != tag)
+				++self->corruptions;
+			shard_release(ptrs[slot], sizes[slot]);
+			ptrs[slot] = 0;
+		} else {
+			sizes[slot] = 1 + (rand_r(&self->seed) % SHARD_MAX_ALLOC_SIZE);
+			ptrs[slot] = shard_alloc(sizes[slot]);
+			if (ptrs[slot]) {
+				ptrs[slot][0] = tag;
+				ptrs[slot][sizes[slot] - 1] = tag;
+			} else
+				++self->failures;
+		}
+	}
+
+	for (int slot = 0; slot < SHARD_WORKING_SET; ++slot)
+		if (ptrs[slot])
+			shard_release(ptrs[slot], sizes[slot]);
+
+	/* Hand cached blocks back before the thread exits */
+	if (mode == SHARD_MODE_CACHED)
+		buddy_cache_flush(&thread_cache);
+
+	return 0;
+}
+
+static double shard_run(shard_mode_t run_mode, int num_threads)
+{
+	shard_thread_t threads[SHARD_MAX_THREADS];
+	struct timespec start;
+	struct timespec end;
+	unsigned long int failures = 0;
+	unsigned long int corruptions = 0;
+	size_t used;
+
+	mode = run_mode;
+	if (mode == SHARD_MODE_SHARDED) {
+		buddy_shards_init(sharded_allocator, memory, SHARD_MEMORY_SIZE, SHARD_NUM_SHARDS);
+		used = buddy_shards_used(sharded_allocator);
+	} else {
+		global_allocator = buddy_create(memory, SHARD_MEMORY_SIZE);
+		used = buddy_used(global_allocator);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < num_threads; ++i) {
+		threads[i].seed = SHARD_RAND_SEED + i;
+		threads[i].failures = 0;
+		threads[i].corruptions = 0;
+		pthread_create(&threads[i].thread, 0, shard_worker, &threads[i]);
+	}
+	for (int i = 0; i < num_threads; ++i) {
+		pthread_join(threads[i].thread, 0);
+		failures += threads[i].failures;
+		corruptions += threads[i].corruptions;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	/* Everything should be back where it started */
+	if (mode == SHARD_MODE_SHARDED)
+		used = buddy_shards_used(sharded_allocator) - used;
+	else
+		used = buddy_used(global_allocator) - used;
+
+	if (failures || corruptions || used)
+		printf("\t%lu failures, %lu corruptions, %zu bytes lost\n", failures, corruptions, used);
+
+	return (num_threads * (double)SHARD_OPS_PER_THREAD) / ((end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1e9));
+}
+
+static bool shard_check_odd(size_t size)
+{
+	static unsigned char *ptrs[SHARD_ODD_MAX_BLOCKS];
+	unsigned int seed = SHARD_RAND_SEED;
+	size_t available;
+	size_t count = 0;
+	size_t block_size;
+	bool ok = true;
+
+	buddy_shards_init(sharded_allocator, memory, size, SHARD_NUM_SHARDS);
+	available = buddy_shards_available(sharded_allocator);
+
+	/* Fill every shard, home and stolen from, tagging each block with its slot */
+	while (count < SHARD_ODD_MAX_BLOCKS) {
+		block_size = 16 + (rand_r(&seed) % SHARD_MAX_ALLOC_SIZE);
+		ptrs[count] = buddy_shards_alloc(sharded_allocator, block_size);
+		if (!ptrs[count])
+			break;
+		memset(ptrs[count], (unsigned char)count, 16);
+		++count;
+	}
+
+	/* Every block must go back to the shard it came from, leaving the others intact */
+	for (size_t i = 0; i < count; ++i) {
+		for (size_t j = 0; j < 16; ++j)
+			ok = ok && ptrs[i][j] == (unsigned char)i;
+		buddy_shards_free(sharded_allocator, ptrs[i]);
+	}
+
+	return ok && count > 0 && buddy_shards_available(sharded_allocator) == available;
+}
+
+static bool shard_check_count(void)
+{
+	/* Home shards wrap around with a mask, so only powers of two are accepted */
+	return !buddy_shards_init(sharded_allocator, memory, SHARD_MEMORY_SIZE, 0) && !buddy_shards_init(sharded_allocator, memory, SHARD_MEMORY_SIZE, 3) &&
+		!buddy_shards_init(sharded_allocator, memory, SHARD_MEMORY_SIZE, SHARD_NUM_SHARDS - 1) && buddy_shards_init(sharded_allocator, memory, SHARD_MEMORY_SIZE, 1) &&
+		buddy_shards_init(sharded_allocator, memory, SHARD_MEMORY_SIZE, SHARD_NUM_SHARDS);
+}
+
+static bool shard_check_cache_oversize(void)
+{
+	buddy_cache_t cache;
+	size_t used;
+	void *ptr;
+
+	global_allocator = buddy_create(memory, SHARD_MEMORY_SIZE);
+	used = buddy_used(global_allocator);
+	buddy_cache_init(&cache, global_allocator, 0);
+
+	/* Sizes beyond the tree must fail rather than index past the cached levels */
+	if (buddy_cache_alloc(&cache, 4UL * SHARD_MEMORY_SIZE) || buddy_cache_alloc(&cache, SHARD_MEMORY_SIZE + 1))
+		return false;
+
+	/* Small sizes still come from the cache */
+	ptr = buddy_cache_alloc(&cache, 16);
+	if (!ptr)
+		return false;
+	buddy_cache_release(&cache, ptr, 16);
+	buddy_cache_flush(&cache);
+
+	return buddy_used(global_allocator) == used;
+}
+
+static bool shard_check_cache_trim(void)
+{
+	static void *ptrs[BUDDY_CACHE_LEVELS][BUDDY_CACHE_CAPACITY];
+	buddy_cache_t cache;
+	size_t used;
+	size_t kept = 0;
+	bool ok;
+
+	global_allocator = buddy_create(memory, SHARD_MEMORY_SIZE);
+	used = buddy_used(global_allocator);
+	buddy_cache_init(&cache, global_allocator, 0);
+
+	/* Fill every magazine to capacity, the blocks stay in use as far as the allocator is concerned */
+	for (unsigned long int level = 0; level < BUDDY_CACHE_LEVELS; ++level)
+		for (unsigned long int i = 0; i < BUDDY_CACHE_CAPACITY; ++i)
+			ptrs[level][i] = buddy_cache_alloc(&cache, 16UL << level);
+	for (unsigned long int level = 0; level < BUDDY_CACHE_LEVELS; ++level)
+		for (unsigned long int i = 0; i < BUDDY_CACHE_CAPACITY; ++i)
+			buddy_cache_release(&cache, ptrs[level][i], 16UL << level);
+	ok = buddy_used(global_allocator) > used;
+
+	/* Trimming keeps at most the given number of blocks a level and gives the rest back */
+	buddy_cache_trim(&cache, 4);
+	for (unsigned long int level = 0; level < BUDDY_CACHE_LEVELS; ++level) {
+		ok = ok && cache.levels[level].count <= 4;
+		kept += cache.levels[level].count * (global_allocator->size >> (cache.first_level + level));
+	}
+	ok = ok && buddy_used(global_allocator) == used + kept;
+
+	/* Trimming to nothing brings the allocator back to where it started */
+	buddy_cache_trim(&cache, 0);
+	return ok && buddy_used(global_allocator) == used;
+}
+
+int main(int argc, char **argv)
+{
+	int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+
+	if (max_threads < 1 || max_threads > SHARD_MAX_THREADS)
+		max_threads = SHARD_MAX_THREADS;
+
+	if (!shard_check_count()) {
+		fprintf(stderr, "shard counts which are not a power of two were accepted\n");
+		return 1;
+	}
+	if (!shard_check_odd(SHARD_ODD_MEMORY_SIZE) || !shard_check_odd(SHARD_ODD_MEMORY_SIZE + SHARD_ODD_REMAINDER)) {
+		fprintf(stderr, "frees on regions not split into power of two shards went astray\n");
+		return 1;
+	}
+	if (!shard_check_cache_trim()) {
+		fprintf(stderr, "trimming the cache did not give its blocks back\n");
+		return 1;
+	}
+	if (!shard_check_cache_oversize()) {
+		fprintf(stderr, "cache allocations larger than the region did not fail\n");
+		return 1;
+	}
+
+	printf("sharded allocator throughput: %d shards, %d ops per thread\n", SHARD_NUM_SHARDS, SHARD_OPS_PER_THREAD);
+	printf("%8s %16s %16s %8s %16s %8s\n", "threads", "mutex ops/s", "sharded ops/s", "speedup", "cached ops/s", "speedup");
+	for (int num_threads = 1; num_threads <= max_threads; num_threads <<= 1) {
+		double mutex_rate = shard_run(SHARD_MODE_GLOBAL_MUTEX, num_threads);
+		double sharded_rate = shard_run(SHARD_MODE_SHARDED, num_threads);
+		double cached_rate = shard_run(SHARD_MODE_CACHED, num_threads);
+		printf("%8d %16.0f %16.0f %7.2fx %16.0f %7.2fx\n", num_threads, mutex_rate, sharded_rate, sharded_rate / mutex_rate, cached_rate, cached_rate / mutex_rate);
+	}
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <buddy-shared.h>
+
+#define SHARED_MEMORY_SIZE (1024UL * 1024UL)
+#define SHARED_MAX_BLOCKS 512
+#define SHARED_MAX_ALLOC_SIZE 2048
+
+#define SHARED_RAND_SEED 0x01371730UL
+
+static size_t offsets[SHARED_MAX_BLOCKS];
+static size_t sizes[SHARED_MAX_BLOCKS];
+
+static void *shared_map(int fd)
+{
+	void *address = mmap(0, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	return address == MAP_FAILED ? 0 : address;
+}
+
+static bool shared_check_pattern(buddy_shared_t *shared, unsigned long int i)
+{
+	unsigned char *ptr = buddy_shared_pointer(shared, offsets[i]);
+
+	return ptr[0] == (unsigned char)i && ptr[sizes[i] - 1] == (unsigned char)~i;
+}
+
+static size_t shared_fill(buddy_shared_t *shared, unsigned int *seed)
+{
+	unsigned char *ptr;
+	size_t count;
+
+	/* Tag both ends of each block so the other mapping can tell them apart */
+	for (count = 0; count < SHARED_MAX_BLOCKS; ++count) {
+		sizes[count] = 2 + (rand_r(seed) % (SHARED_MAX_ALLOC_SIZE - 1));
+		ptr = buddy_shared_alloc(shared, sizes[count]);
+		if (!ptr)
+			break;
+		ptr[0] = (unsigned char)count;
+		ptr[sizes[count] - 1] = (unsigned char)~count;
+		offsets[count] = buddy_shared_offset(shared, ptr);
+	}
+
+	return count;
+}
+
+static bool shared_check_mappings(int fd)
+{
+	unsigned char *first = shared_map(fd);
+	unsigned char *second = shared_map(fd);
+	buddy_shared_t *creator;
+	buddy_shared_t *attached;
+	unsigned int seed = SHARED_RAND_SEED;
+	size_t used;
+	size_t count;
+	bool ok;
+
+	if (!first || !second)
+		return false;
+
+	/* The same memory at two addresses, each mapping sees the heap at its own address */
+	creator = buddy_shared_create(first, SHARED_MEMORY_SIZE);
+	attached = buddy_shared_attach(second);
+	if (first == second || attached != (buddy_shared_t *)second)
+		return false;
+	used = buddy_shared_used(creator);
+
+	/* Allocate through one mapping and free through the other, with the free lists split in the first and merged
+	 * in the second */
+	count = shared_fill(creator, &seed);
+	ok = count > 0 && buddy_shared_used(attached) == buddy_shared_used(creator);
+	for (size_t i = 0; ok && i < count; ++i) {
+		ok = shared_check_pattern(attached, i);
+		if (i & 1)
+			buddy_shared_release(attached, buddy_shared_pointer(attached, offsets[i]), sizes[i]);
+		else
+			buddy_shared_free(attached, buddy_shared_pointer(attached, offsets[i]));
+	}
+	ok = ok && buddy_shared_used(creator) == used;
+
+	/* And the other way round, again from the heap as the first mapping left it */
+	count = shared_fill(attached, &seed);
+	for (size_t i = 0; ok && i < count; ++i) {
+		ok = shared_check_pattern(creator, i);
+		buddy_shared_free(creator, buddy_shared_pointer(creator, offsets[i]));
+	}
+	ok = ok && count > 0 && buddy_shared_used(attached) == used;
+
+	/* A third mapping after the first is gone still finds a whole heap */
+	munmap(first, SHARED_MEMORY_SIZE);
+	first = shared_map(fd);
+	creator = first ? buddy_shared_attach(first) : 0;
+	ok = ok && creator && buddy_shared_used(creator) == used;
+	ok = ok && buddy_alloc(buddy_shared_allocator(creator), SHARED_MEMORY_SIZE / 4);
+
+	if (first)
+		munmap(first, SHARED_MEMORY_SIZE);
+	munmap(second, SHARED_MEMORY_SIZE);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	int fd = memfd_create("buddy-shared", 0);
+
+	if (fd < 0 || ftruncate(fd, SHARED_MEMORY_SIZE)) {
+		perror("shared memory");
+		return 1;
+	}
+
+	if (!shared_check_mappings(fd)) {
+		fprintf(stderr, "a heap mapped at two addresses went wrong\n");
+		return 1;
+	}
+	close(fd);
+
+	printf("shared: checks across two mappings passed\n");
+
+	return 0;
+}
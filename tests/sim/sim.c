@@ -10,7 +10,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
 #include <buddy-alloc.h>
 
@@ -38,7 +37,7 @@ static void buddy_dump_info(const buddy_allocator_t *allocator)
 	char buffer[128];
 
 	printf(buffer, "allocator @ %p\n", allocator);
-	printf(buffer, "\taddress:        %p\n", allocator->address);
+	printf(buffer, "\taddress:        %p\n", BUDDY_GET_POINTER(allocator, address));
 	printf(buffer, "\tsize:           %zu\n", allocator->size);
 	printf(buffer, "\ttotal levels:   %lu\n", allocator->total_levels);
 	printf(buffer, "\tmax level:      %lu\n", allocator->max_level);
@@ -64,7 +63,8 @@ int main(int argc, char **argv)
 	allocator = buddy_create(memory, SIM_MEMORY_SIZE);
 	buddy_dump_info(allocator);
 
-	srand(SIM_RAND_SEED + time(0));
+	/* Fixed seed so runs can be reproduced, pass another one to explore */
+	srand(argc > 1 ? strtoul(argv[1], 0, 0) : SIM_RAND_SEED);
 	memset(sim_data, 0, sizeof(sim_data));
 
 	/* Run the simulation */
@@ -84,7 +84,7 @@ int main(int argc, char **argv)
 			datum->next = sim_data[(sim_data_mark + new_delay) % SIM_MAX_DELAY];
 			sim_data[(sim_data_mark + new_delay) % SIM_MAX_DELAY] = datum;
 		} else
-			printf("fail at %u for size %d with %zu available and largest %zu\n", mark, new_size, buddy_available(allocator), buddy_largest_available(allocator));
+			printf("fail at %u for size %d with %zu available and largest %zu, %lu%% fragmented\n", mark, new_size, buddy_available(allocator), buddy_largest_available(allocator), buddy_fragmentation(allocator));
 
 		while ((datum = sim_data[sim_data_mark]) != 0) {
 			sim_data[sim_data_mark] = sim_data[sim_data_mark]->next;
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <buddy-alloc.h>
+#include <buddy-slab.h>
+
+#define SLAB_MEMORY_SIZE (1024UL * 1024UL)
+#define SLAB_OBJECT_SIZE 48UL
+#define SLAB_MAX_OBJECTS 1024
+
+static void *ptrs[SLAB_MAX_OBJECTS];
+static buddy_allocator_t *allocator;
+static buddy_slab_t *slab;
+static void *memory;
+
+/* The class a size rounds up to, worked out apart from the allocator: 16 bytes apart up to 64, then a quarter of the
+ * power of two below the size apart */
+static size_t slab_expected_size(size_t size)
+{
+	size_t step = size <= 4 * BUDDY_SLAB_QUANTUM ? BUDDY_SLAB_QUANTUM : (1UL << (BUDDY_CLOG2(size) - 1)) >> 2;
+
+	if (!size)
+		return BUDDY_SLAB_QUANTUM;
+	return (size + (step - 1)) & ~(step - 1);
+}
+
+static bool slab_check_classes(void)
+{
+	buddy_slab_class_t *class;
+	size_t expected;
+	size_t usable;
+	void *ptr;
+
+	/* Every size up to the largest class rounds to its class, served from a slab or, for the classes the slabs leave
+	 * alone, as a buddy block */
+	class = slab->classes;
+	for (size_t size = 1; size <= BUDDY_SLAB_MAX_SIZE; ++size) {
+		if (class->size < size)
+			++class;
+		expected = class->objects ? class->size : 1UL << BUDDY_CLOG2(size < BUDDY_MIN_LEAF_SIZE ? BUDDY_MIN_LEAF_SIZE : size);
+		ptr = buddy_slab_alloc(slab, size);
+		usable = buddy_slab_usable_size(slab, ptr);
+		buddy_slab_free(slab, ptr);
+		if (class->size != slab_expected_size(size) || !ptr || usable != expected) {
+			fprintf(stderr, "size %zu got %zu usable bytes in the class of %zu instead of %zu\n", size, usable, class->size, expected);
+			return false;
+		}
+	}
+
+	/* The boundaries where the spacing changes, at 64 bytes and at each doubling */
+	if (slab_expected_size(64) != 64 || slab_expected_size(65) != 80 || slab_expected_size(129) != 160 || slab_expected_size(1025) != 1280)
+		return false;
+
+	/* Above the classes the size is that of the buddy block */
+	ptr = buddy_slab_alloc(slab, BUDDY_SLAB_MAX_SIZE + 1);
+	usable = buddy_slab_usable_size(slab, ptr);
+	buddy_slab_free(slab, ptr);
+
+	return ptr && usable == 2 * BUDDY_SLAB_MAX_SIZE && buddy_slab_trim(slab) > 0 && buddy_used(allocator) == 0;
+}
+
+static bool slab_check_routing(void)
+{
+	unsigned char *base = memory;
+	void *block;
+	void *object;
+	void *exact;
+	bool ok;
+
+	/* A slab object, a block taken from the allocator directly and a power of two the allocator serves exactly */
+	object = buddy_slab_alloc(slab, SLAB_OBJECT_SIZE);
+	block = buddy_alloc(allocator, 2 * BUDDY_SLAB_PAGE_SIZE);
+	exact = buddy_slab_alloc(slab, 256);
+	ok = object && block && exact;
+
+	/* Only the slab shows up in the page map */
+	ok = ok && slab->slab_map[((unsigned char *)object - base) / BUDDY_SLAB_PAGE_SIZE];
+	ok = ok && !slab->slab_map[((unsigned char *)block - base) / BUDDY_SLAB_PAGE_SIZE];
+	ok = ok && !slab->slab_map[((unsigned char *)exact - base) / BUDDY_SLAB_PAGE_SIZE];
+	ok = ok && buddy_slab_usable_size(slab, exact) == 256 && buddy_slab_usable_size(slab, block) == 2 * BUDDY_SLAB_PAGE_SIZE;
+
+	/* Blocks go back to the allocator, the object to its slab which stays as the last of its class */
+	buddy_slab_free(slab, block);
+	buddy_slab_free(slab, exact);
+	ok = ok && buddy_used(allocator) == slab->classes[SLAB_OBJECT_SIZE / BUDDY_SLAB_QUANTUM - 1].slab_size;
+	buddy_slab_free(slab, object);
+	ok = ok && buddy_used(allocator) == slab->classes[SLAB_OBJECT_SIZE / BUDDY_SLAB_QUANTUM - 1].slab_size;
+
+	return buddy_slab_trim(slab) > 0 && buddy_used(allocator) == 0 && ok;
+}
+
+static bool slab_check_empty_slab(void)
+{
+	buddy_slab_class_t *class = &slab->classes[SLAB_OBJECT_SIZE / BUDDY_SLAB_QUANTUM - 1];
+	unsigned long int count = class->objects + 1;
+	bool ok = class->objects > 1 && count <= SLAB_MAX_OBJECTS;
+
+	/* One object more than a slab holds takes a second slab */
+	for (unsigned long int i = 0; ok && i < count; ++i)
+		ok = (ptrs[i] = buddy_slab_alloc(slab, SLAB_OBJECT_SIZE)) != 0;
+	ok = ok && buddy_used(allocator) == 2 * class->slab_size;
+
+	/* Emptying the first slab hands it back, the second is kept as the last of its class */
+	for (unsigned long int i = 0; ok && i < class->objects; ++i)
+		buddy_slab_free(slab, ptrs[i]);
+	ok = ok && buddy_used(allocator) == class->slab_size;
+	buddy_slab_free(slab, ptrs[class->objects]);
+	ok = ok && buddy_used(allocator) == class->slab_size;
+
+	/* Until trimming */
+	ok = ok && buddy_slab_trim(slab) == class->slab_size && buddy_used(allocator) == 0;
+	ok = ok && buddy_largest_available(allocator) == SLAB_MEMORY_SIZE;
+
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	/* Metadata kept apart so the whole region is free */
+	allocator = malloc(buddy_sizeof_metadata(SLAB_MEMORY_SIZE, BUDDY_MIN_LEAF_SIZE));
+	slab = malloc(buddy_slab_sizeof_metadata(SLAB_MEMORY_SIZE));
+	memory = aligned_alloc(SLAB_MEMORY_SIZE, SLAB_MEMORY_SIZE);
+	if (!allocator || !slab || !memory) {
+		perror("test allocation failed");
+		return 1;
+	}
+	buddy_init(allocator, memory, SLAB_MEMORY_SIZE);
+	buddy_slab_init(slab, allocator, 0);
+
+	if (!slab_check_classes()) {
+		fprintf(stderr, "sizes did not round to their classes\n");
+		return 1;
+	}
+	if (!slab_check_routing()) {
+		fprintf(stderr, "frees were not routed to the slab or the allocator\n");
+		return 1;
+	}
+	if (!slab_check_empty_slab()) {
+		fprintf(stderr, "an emptied slab was not handed back to the allocator\n");
+		return 1;
+	}
+
+	printf("slab: class, usable size, free routing and empty slab checks passed\n");
+
+	free(slab);
+	free(allocator);
+	free(memory);
+
+	return 0;
+}
@@ -0,0 +1,305 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <buddy-alloc.h>
+
+/* Not a power of two, the tree is rounded up to 2MB and the tail past the region is never handed out */
+#define SNAPSHOT_MEMORY_SIZE 1500000UL
+#define SNAPSHOT_TREE_SIZE (2UL * 1024UL * 1024UL)
+#define SNAPSHOT_MAX_BLOCKS 4096
+#define SNAPSHOT_MAX_LEVELS 64
+
+#define SNAPSHOT_RAND_SEED 0x01371730UL
+
+typedef struct snapshot_reader {
+	const unsigned char *buffer;
+	size_t size;
+	size_t offset;
+} snapshot_reader_t;
+
+/* Just enough of tools/buddy-snapshot to walk the tree */
+typedef struct snapshot {
+	unsigned long long int address;
+	unsigned long long int size;
+	unsigned long long int region_size;
+	unsigned long long int max_level;
+	unsigned long long int max_indexes;
+	unsigned long long int available;
+	unsigned long long int free_counts[SNAPSHOT_MAX_LEVELS];
+	unsigned long long int *block_index;
+	unsigned long long int *free_map;
+} snapshot_t;
+
+static unsigned char buffer[64 * 1024];
+static void *ptrs[SNAPSHOT_MAX_BLOCKS];
+
+static unsigned char snapshot_get_byte(snapshot_reader_t *reader)
+{
+	return reader->offset < reader->size ? reader->buffer[reader->offset++] : 0;
+}
+
+static unsigned long long int snapshot_get_u64(snapshot_reader_t *reader)
+{
+	unsigned long long int value = 0;
+
+	for (int i = 0; i < 8; ++i)
+		value |= (unsigned long long int)snapshot_get_byte(reader) << (i * 8);
+
+	return value;
+}
+
+static unsigned long long int snapshot_get_varint(snapshot_reader_t *reader)
+{
+	unsigned long long int value = 0;
+	unsigned char byte;
+	int shift = 0;
+
+	do {
+		byte = snapshot_get_byte(reader);
+		value |= (unsigned long long int)(byte & 0x7f) << shift;
+		shift += 7;
+	} while ((byte & 0x80) && shift < 64);
+
+	return value;
+}
+
+static inline bool bit_is_set(const unsigned long long int *bits, unsigned long long int index)
+{
+	return (bits[index >> 6] >> (index & 63)) & 1;
+}
+
+static bool snapshot_decode(snapshot_t *snapshot, const void *data, size_t size)
+{
+	snapshot_reader_t reader = { data, size, 0 };
+	unsigned long long int words;
+	unsigned long long int word = 0;
+	unsigned long long int zeros;
+	unsigned long long int literals;
+	unsigned long long int offset;
+
+	if (snapshot_get_u64(&reader) != (BUDDY_SNAPSHOT_MAGIC | ((unsigned long long int)BUDDY_SNAPSHOT_VERSION << 32)))
+		return false;
+
+	snapshot->address = snapshot_get_u64(&reader);
+	snapshot->size = snapshot_get_u64(&reader);
+	snapshot->region_size = snapshot_get_u64(&reader);
+	snapshot_get_u64(&reader);
+	snapshot->max_level = snapshot_get_u64(&reader);
+	snapshot->max_indexes = snapshot_get_u64(&reader);
+	snapshot->available = snapshot_get_u64(&reader);
+	if (snapshot->max_level >= SNAPSHOT_MAX_LEVELS || snapshot->max_indexes != (2ULL << snapshot->max_level))
+		return false;
+
+	for (unsigned long long int level = 0; level < snapshot->max_level + 1; ++level)
+		snapshot->free_counts[level] = snapshot_get_varint(&reader);
+
+	words = (snapshot->max_indexes + 63) / 64;
+	snapshot->block_index = calloc(words, sizeof(unsigned long long int));
+	snapshot->free_map = calloc(words, sizeof(unsigned long long int));
+	if (!snapshot->block_index || !snapshot->free_map)
+		return false;
+	while (word < words) {
+		zeros = snapshot_get_varint(&reader);
+		literals = snapshot_get_varint(&reader);
+		if (zeros > words - word || literals > words - word - zeros)
+			return false;
+		word += zeros;
+		for (; literals > 0; --literals)
+			snapshot->block_index[word++] = snapshot_get_u64(&reader);
+	}
+
+	for (unsigned long long int level = 0; level < snapshot->max_level + 1; ++level) {
+		for (unsigned long long int i = 0; i < snapshot->free_counts[level]; ++i) {
+			offset = snapshot_get_varint(&reader);
+			if (offset >= (1ULL << level))
+				return false;
+			offset += (1ULL << level) - 1;
+			snapshot->free_map[offset >> 6] |= 1ULL << (offset & 63);
+		}
+	}
+
+	/* Every byte accounted for, nothing more */
+	return reader.offset == size;
+}
+
+static void snapshot_release(snapshot_t *snapshot)
+{
+	free(snapshot->block_index);
+	free(snapshot->free_map);
+}
+
+/* Sum the unsplit blocks of the tree into free, allocated within the region and reserved past its end */
+static void snapshot_walk(const snapshot_t *snapshot, unsigned long long int *free_bytes, unsigned long long int *allocated, unsigned long long int *reserved)
+{
+	unsigned long long int stack[SNAPSHOT_MAX_LEVELS + 1];
+	unsigned long long int index;
+	unsigned long long int level;
+	unsigned long long int block_size;
+	int depth = 0;
+
+	*free_bytes = *allocated = *reserved = 0;
+	stack[depth++] = 0;
+	while (depth > 0) {
+		index = stack[--depth];
+		level = 63 - __builtin_clzll(index + 1);
+		if (level < snapshot->max_level && bit_is_set(snapshot->block_index, (snapshot->max_indexes >> 1) + index)) {
+			stack[depth++] = (index << 1) + 2;
+			stack[depth++] = (index << 1) + 1;
+			continue;
+		}
+
+		block_size = snapshot->size >> level;
+		if (bit_is_set(snapshot->free_map, index))
+			*free_bytes += block_size;
+		else if ((index - ((1ULL << level) - 1)) * block_size >= snapshot->region_size)
+			*reserved += block_size;
+		else
+			*allocated += block_size;
+	}
+}
+
+/* Whether the byte at offset lies in a free block, found by following the split bits down from the root */
+static bool snapshot_is_free(const snapshot_t *snapshot, unsigned long long int offset)
+{
+	unsigned long long int index = 0;
+
+	for (unsigned long long int level = 0; level < snapshot->max_level; ++level) {
+		if (!bit_is_set(snapshot->block_index, (snapshot->max_indexes >> 1) + index))
+			break;
+		index = (index << 1) + 1 + ((offset >> (BUDDY_ILOG2(snapshot->size) - level - 1)) & 1);
+	}
+
+	return bit_is_set(snapshot->free_map, index);
+}
+
+static bool snapshot_check_region(void)
+{
+	/* Aligned on the size of the tree so builds with BUDDY_MEMORY_ALIGNED_ON_SIZE work too */
+	void *memory = aligned_alloc(SNAPSHOT_TREE_SIZE, SNAPSHOT_TREE_SIZE);
+	buddy_allocator_t *allocator;
+	unsigned long long int free_bytes;
+	unsigned long long int allocated;
+	unsigned long long int reserved;
+	unsigned long long int state = SNAPSHOT_RAND_SEED;
+	snapshot_t snapshot = { 0 };
+	size_t length;
+	size_t count;
+	bool ok;
+
+	if (!memory)
+		return false;
+	allocator = buddy_create(memory, SNAPSHOT_MEMORY_SIZE);
+
+	/* Fill the region with mixed sizes and free every other block */
+	for (count = 0; count < SNAPSHOT_MAX_BLOCKS; ++count) {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		ptrs[count] = buddy_alloc(allocator, 16UL << ((state >> 33) % 8));
+		if (!ptrs[count])
+			break;
+	}
+	for (size_t i = 0; i < count; i += 2)
+		buddy_free(allocator, ptrs[i]);
+
+	length = buddy_snapshot(allocator, buffer, sizeof(buffer));
+	ok = length <= sizeof(buffer) && snapshot_decode(&snapshot, buffer, length);
+
+	/* The tail beyond the region is neither free nor allocated, and what is left is the region */
+	if (ok) {
+		snapshot_walk(&snapshot, &free_bytes, &allocated, &reserved);
+		ok = snapshot.size == SNAPSHOT_TREE_SIZE && snapshot.region_size == buddy_used(allocator) + buddy_available(allocator) &&
+			snapshot.region_size > SNAPSHOT_MEMORY_SIZE - 1024 && free_bytes == snapshot.available &&
+			allocated + free_bytes == snapshot.region_size && reserved == snapshot.size - snapshot.region_size;
+		if (!ok)
+			fprintf(stderr, "region %llu of %llu: %llu free, %llu allocated, %llu reserved\n", snapshot.region_size, snapshot.size, free_bytes, allocated, reserved);
+	}
+	snapshot_release(&snapshot);
+	free(memory);
+
+	return ok;
+}
+
+static bool snapshot_check_round_trip(void)
+{
+	void *memory = aligned_alloc(SNAPSHOT_TREE_SIZE, SNAPSHOT_TREE_SIZE);
+	unsigned long int counts[SNAPSHOT_MAX_LEVELS];
+	unsigned long long int state = SNAPSHOT_RAND_SEED;
+	unsigned char second[sizeof(buffer)];
+	buddy_allocator_t *allocator;
+	snapshot_t snapshot = { 0 };
+	unsigned long int levels;
+	size_t length;
+	size_t count;
+	bool ok;
+
+	if (!memory)
+		return false;
+	allocator = buddy_create(memory, SNAPSHOT_MEMORY_SIZE);
+
+	/* A fresh allocator only has the edges of the metadata and of the tail split, the rest is run length encoded */
+	length = buddy_snapshot(allocator, 0, 0);
+	ok = length > 0 && length < (2UL * SNAPSHOT_TREE_SIZE / BUDDY_MIN_LEAF_SIZE) / 8 / 16;
+
+	for (count = 0; count < SNAPSHOT_MAX_BLOCKS; ++count) {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		ptrs[count] = buddy_alloc(allocator, 1 + ((state >> 33) % 2048));
+		if (!ptrs[count])
+			break;
+	}
+	for (size_t i = 0; i < count; i += 3)
+		buddy_free(allocator, ptrs[i]);
+	buddy_coalesce_all(allocator);
+
+	/* The probe measures exactly what a full snapshot writes */
+	length = buddy_snapshot(allocator, 0, 0);
+	ok = ok && length <= sizeof(buffer) && buddy_snapshot(allocator, buffer, sizeof(buffer)) == length;
+
+	/* A short buffer still reports the full length, and nothing is written past its end */
+	memset(second, 0xa5, sizeof(second));
+	ok = ok && buddy_snapshot(allocator, second, length / 2) == length && !memcmp(second, buffer, length / 2);
+	for (size_t i = length / 2; ok && i < sizeof(second); ++i)
+		ok = second[i] == 0xa5;
+
+	/* Nothing changed, nothing differs */
+	ok = ok && buddy_snapshot(allocator, second, sizeof(second)) == length && !memcmp(second, buffer, length);
+
+	/* Decoding gives back the state of the allocator, every freed block free and every held one not */
+	ok = ok && snapshot_decode(&snapshot, buffer, length);
+	ok = ok && snapshot.address == (unsigned long int)memory && snapshot.available == buddy_available(allocator);
+	levels = buddy_free_histogram(allocator, counts, SNAPSHOT_MAX_LEVELS);
+	ok = ok && levels == snapshot.max_level + 1;
+	for (unsigned long int level = 0; ok && level < levels; ++level)
+		ok = counts[level] == snapshot.free_counts[level];
+	for (size_t i = 0; ok && i < count; ++i)
+		ok = snapshot_is_free(&snapshot, (unsigned char *)ptrs[i] - (unsigned char *)memory) == !(i % 3);
+	snapshot_release(&snapshot);
+	free(memory);
+
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (!snapshot_check_region()) {
+		fprintf(stderr, "snapshot does not describe the region\n");
+		return 1;
+	}
+
+	if (!snapshot_check_round_trip()) {
+		fprintf(stderr, "snapshot does not round trip\n");
+		return 1;
+	}
+
+	printf("snapshot: region and round trip checks passed\n");
+
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include <buddy-alloc.h>
+
+#define STARTUP_LEAF_SIZE 64UL
+#define STARTUP_MIN_SHIFT 26
+#define STARTUP_CLEARED_SHIFT 32
+#define STARTUP_MAX_SHIFT 36
+#define STARTUP_BLOCKS 64UL
+
+static inline long int startup_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static long int startup_create(size_t size, bool zeroed)
+{
+	buddy_allocator_t *allocator;
+	void *ptrs[STARTUP_BLOCKS];
+	void *memory;
+	long int start;
+	long int elapsed;
+	size_t used;
+
+	/* A fresh anonymous mapping is zero filled, nothing is committed until it is touched */
+	memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (memory == MAP_FAILED)
+		return -1;
+
+	start = startup_now();
+	if (zeroed)
+		allocator = buddy_create_zeroed(memory, size, STARTUP_LEAF_SIZE);
+	else
+		allocator = buddy_create_ex(memory, size, STARTUP_LEAF_SIZE);
+	elapsed = startup_now() - start;
+
+	/* The allocator must be whole, every size comes and goes leaving only the metadata in use */
+	used = buddy_used(allocator);
+	for (unsigned long int i = 0; i < STARTUP_BLOCKS; ++i)
+		ptrs[i] = buddy_alloc(allocator, STARTUP_LEAF_SIZE << (i % 16));
+	for (unsigned long int i = 0; i < STARTUP_BLOCKS; ++i) {
+		if (!ptrs[i]) {
+			munmap(memory, size);
+			return -1;
+		}
+		buddy_free(allocator, ptrs[i]);
+	}
+	if (buddy_used(allocator) != used) {
+		munmap(memory, size);
+		return -1;
+	}
+
+	munmap(memory, size);
+	return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+	long int cleared;
+	long int zeroed;
+
+	printf("start up benchmark: %lu byte leaves, metadata in the region\n", STARTUP_LEAF_SIZE);
+	printf("%-8s %12s %12s\n", "region", "create us", "zeroed us");
+
+	for (unsigned long int shift = STARTUP_MIN_SHIFT; shift <= STARTUP_MAX_SHIFT; shift += 2) {
+		/* Clearing the index of the largest regions takes long enough to leave them to the zeroed path alone */
+		cleared = shift <= STARTUP_CLEARED_SHIFT ? startup_create(1UL << shift, false) : 0;
+		zeroed = startup_create(1UL << shift, true);
+		if (cleared < 0 || zeroed < 0) {
+			fprintf(stderr, "start up of a %lu MB region failed\n", 1UL << (shift - 20));
+			return 1;
+		}
+
+		printf("%6luMB ", 1UL << (shift - 20));
+		if (shift <= STARTUP_CLEARED_SHIFT)
+			printf("%12.1f", cleared / 1000.0);
+		else
+			printf("%12s", "-");
+		printf(" %12.1f\n", zeroed / 1000.0);
+	}
+
+	return 0;
+}
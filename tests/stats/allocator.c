@@ -0,0 +1,11 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+/* The allocator itself, built with the options of this test */
+#include "../../buddy-alloc/buddy-pages.c"
+#include "../../buddy-alloc/buddy-alloc.c"
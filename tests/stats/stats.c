@@ -0,0 +1,202 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <buddy-alloc.h>
+
+#define STATS_MEMORY_SIZE (1024UL * 1024UL)
+#define STATS_MAX_LEVELS 64
+
+static buddy_level_stats_t expected[STATS_MAX_LEVELS];
+
+static inline unsigned long int stats_level(size_t size)
+{
+	/* The whole region is level zero */
+	return BUDDY_ILOG2(STATS_MEMORY_SIZE) - BUDDY_ILOG2(size);
+}
+
+static bool stats_match(const buddy_allocator_t *allocator)
+{
+	buddy_level_stats_t levels[STATS_MAX_LEVELS];
+	buddy_level_stats_t totals = { 0 };
+	buddy_stats_t stats;
+	unsigned long int count = buddy_stats(allocator, &stats, levels, STATS_MAX_LEVELS);
+	bool ok = count == stats_level(BUDDY_MIN_LEAF_SIZE) + 1;
+
+	/* Every level as expected, and the totals their sum */
+	for (unsigned long int level = 0; ok && level < count; ++level) {
+		ok = !memcmp(&levels[level], &expected[level], sizeof(buddy_level_stats_t));
+		if (!ok)
+			fprintf(stderr, "level %lu: %lu allocs, %lu frees, %lu splits, %lu merges, %lu failures\n", level, levels[level].allocs,
+				levels[level].frees, levels[level].splits, levels[level].merges, levels[level].failures);
+		totals.allocs += expected[level].allocs;
+		totals.frees += expected[level].frees;
+		totals.splits += expected[level].splits;
+		totals.merges += expected[level].merges;
+		totals.failures += expected[level].failures;
+	}
+
+	return ok && !memcmp(&stats.totals, &totals, sizeof(buddy_level_stats_t)) && stats.size == STATS_MEMORY_SIZE &&
+		stats.available == buddy_available(allocator) && stats.largest_available == buddy_largest_available(allocator);
+}
+
+static bool stats_check_sequence(buddy_allocator_t *allocator)
+{
+	void *a;
+	void *b;
+	void *c;
+	bool ok;
+
+	/* The first allocation splits the whole region down to its level, one block per level */
+	memset(expected, 0, sizeof(expected));
+	a = buddy_alloc(allocator, 64);
+	for (unsigned long int level = 0; level < stats_level(64); ++level)
+		expected[level].splits = 1;
+	expected[stats_level(64)].allocs = 1;
+	ok = stats_match(allocator);
+
+	/* Its buddy and the free block one level up need no splitting */
+	b = buddy_alloc(allocator, 64);
+	c = buddy_alloc(allocator, 128);
+	expected[stats_level(64)].allocs = 2;
+	expected[stats_level(128)].allocs = 1;
+	ok = ok && a && b && c && stats_match(allocator);
+
+	/* Sizes beyond the region and sizes with no free block fail, both at the top */
+	ok = ok && !buddy_alloc(allocator, 2 * STATS_MEMORY_SIZE) && !buddy_alloc(allocator, STATS_MEMORY_SIZE);
+	expected[0].failures = 2;
+	ok = ok && stats_match(allocator);
+
+	/* The first free finds its buddy in use, the second merges once, the last all the way up */
+	buddy_free(allocator, a);
+	expected[stats_level(64)].frees = 1;
+	ok = ok && stats_match(allocator);
+	buddy_free(allocator, b);
+	expected[stats_level(64)].frees = 2;
+	expected[stats_level(64)].merges = 1;
+	ok = ok && stats_match(allocator);
+	buddy_release(allocator, c, 128);
+	expected[stats_level(128)].frees = 1;
+	for (unsigned long int level = 1; level <= stats_level(128); ++level)
+		expected[level].merges = 1;
+	ok = ok && stats_match(allocator);
+
+	return ok && buddy_largest_available(allocator) == STATS_MEMORY_SIZE;
+}
+
+static bool stats_check_batch(buddy_allocator_t *allocator)
+{
+	unsigned long int level = stats_level(256);
+	void *ptrs[8];
+	bool ok;
+
+	/* Eight contiguous blocks split one node per level down to three levels above, then 1, 2 and 4 nodes */
+	memset(expected, 0, sizeof(expected));
+	ok = buddy_alloc_batch(allocator, 256, ptrs, 8) == 8;
+	for (unsigned long int split_level = 0; split_level < level; ++split_level)
+		expected[split_level].splits = split_level + 3 < level ? 1 : 1UL << (split_level + 3 - level);
+	expected[level].allocs = 8;
+	ok = ok && stats_match(allocator);
+
+	/* Releasing them merges the same nodes back */
+	buddy_release_batch(allocator, ptrs, 8, 256);
+	for (unsigned long int merge_level = 1; merge_level <= level; ++merge_level)
+		expected[merge_level].merges = expected[merge_level - 1].splits;
+	expected[level].frees = 8;
+	ok = ok && stats_match(allocator);
+
+	return ok && buddy_largest_available(allocator) == STATS_MEMORY_SIZE;
+}
+
+static bool stats_check_histogram(buddy_allocator_t *allocator)
+{
+	unsigned long int counts[STATS_MAX_LEVELS];
+	unsigned long int level = stats_level(4096);
+	void *ptrs[STATS_MEMORY_SIZE / 4096];
+	size_t count = 0;
+	bool ok;
+
+	/* Fill the region with blocks in address order, then free every other one, none of which can merge */
+	while (count < STATS_MEMORY_SIZE / 4096 && (ptrs[count] = buddy_alloc(allocator, 4096)))
+		++count;
+	ok = count == STATS_MEMORY_SIZE / 4096;
+	for (size_t i = 1; i < count; ++i)
+		ok = ok && ptrs[i] == (unsigned char *)ptrs[i - 1] + 4096;
+	for (size_t i = 0; i < count; i += 2)
+		buddy_free(allocator, ptrs[i]);
+
+	memset(counts, 0xff, sizeof(counts));
+	ok = ok && buddy_free_histogram(allocator, counts, STATS_MAX_LEVELS) == stats_level(BUDDY_MIN_LEAF_SIZE) + 1;
+	for (unsigned long int i = 0; ok && i <= stats_level(BUDDY_MIN_LEAF_SIZE); ++i)
+		ok = counts[i] == (i == level ? count / 2 : 0);
+	ok = ok && buddy_fragmentation(allocator) == ((count / 2 - 1) * 100) / (count / 2);
+
+	/* Filling two holes merges the first four blocks into one, two levels up */
+	buddy_free(allocator, ptrs[1]);
+	buddy_free(allocator, ptrs[3]);
+	ok = ok && buddy_free_histogram(allocator, counts, STATS_MAX_LEVELS) == stats_level(BUDDY_MIN_LEAF_SIZE) + 1;
+	for (unsigned long int i = 0; ok && i <= stats_level(BUDDY_MIN_LEAF_SIZE); ++i)
+		ok = counts[i] == (i == level ? count / 2 - 2 : i == level - 2 ? 1 : 0);
+
+	/* A short array only takes the top levels, the full number of levels is still returned */
+	memset(counts, 0xff, sizeof(counts));
+	ok = ok && buddy_free_histogram(allocator, counts, level - 1) == stats_level(BUDDY_MIN_LEAF_SIZE) + 1;
+	ok = ok && counts[level - 2] == 1 && counts[level - 1] == ~0UL;
+
+	/* And everything back leaves a single block */
+	for (size_t i = 5; i < count; i += 2)
+		buddy_free(allocator, ptrs[i]);
+	ok = ok && buddy_free_histogram(allocator, counts, STATS_MAX_LEVELS) && counts[0] == 1 && buddy_fragmentation(allocator) == 0;
+
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	/* Metadata kept apart so the whole region is free and every count is known */
+	buddy_allocator_t *allocator = malloc(buddy_sizeof_metadata(STATS_MEMORY_SIZE, BUDDY_MIN_LEAF_SIZE));
+	void *memory = aligned_alloc(STATS_MEMORY_SIZE, STATS_MEMORY_SIZE);
+
+	if (!allocator || !memory)
+		return 1;
+	buddy_init(allocator, memory, STATS_MEMORY_SIZE);
+
+	if (!stats_check_sequence(allocator)) {
+		fprintf(stderr, "counters do not match a known sequence\n");
+		return 1;
+	}
+
+	/* Resetting clears every counter */
+	buddy_stats_reset(allocator);
+	memset(expected, 0, sizeof(expected));
+	if (!stats_match(allocator)) {
+		fprintf(stderr, "counters survived a reset\n");
+		return 1;
+	}
+
+	buddy_stats_reset(allocator);
+	if (!stats_check_batch(allocator)) {
+		fprintf(stderr, "counters do not match a batch\n");
+		return 1;
+	}
+
+	if (!stats_check_histogram(allocator)) {
+		fprintf(stderr, "free histogram does not match a known fragmentation pattern\n");
+		return 1;
+	}
+
+	free(allocator);
+	free(memory);
+	printf("stats: sequence, reset, batch and histogram checks passed\n");
+
+	return 0;
+}
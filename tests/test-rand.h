@@ -0,0 +1,21 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#ifndef TEST_RAND_H_
+#define TEST_RAND_H_
+
+/* xorshift64*, small and identical on every platform, so the benchmarks all replay the same sequence for a seed */
+static inline unsigned long long int test_rand(unsigned long long int *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+#endif /* TEST_RAND_H_ */
@@ -6,6 +6,6 @@
 # file, You can obtain one at http://mozilla.org/MPL/2.0/. 
 #
 
-targets: basic sim
+targets: basic sim stats shard bench lockfree cxx fixed deep startup policy pages snapshot batch resize aligned deferred heap shared oob slab sim-blocked basic-blocked deep-blocked
 
 include ${TOOLS_ROOT}/makefiles/tree.mk
@@ -0,0 +1,342 @@
+/*
+ * Copyright 2015 Stephen Street <stephen@redrocketcomputing.com>
+ * 
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. 
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <buddy-alloc.h>
+
+#define SNAPSHOT_MAP_COLUMNS 64
+#define SNAPSHOT_MAX_LEVELS 64
+
+typedef struct snapshot_reader {
+	const unsigned char *buffer;
+	size_t size;
+	size_t offset;
+	bool truncated;
+} snapshot_reader_t;
+
+typedef struct snapshot {
+	unsigned long long int address;
+	unsigned long long int size;
+	unsigned long long int region_size;
+	unsigned long long int min_allocation;
+	unsigned long long int max_level;
+	unsigned long long int max_indexes;
+	unsigned long long int available;
+	unsigned long long int free_counts[SNAPSHOT_MAX_LEVELS];
+	unsigned long long int *block_index;
+	unsigned long long int *free_map;
+} snapshot_t;
+
+typedef struct snapshot_level {
+	unsigned long long int allocated;
+	unsigned long long int free;
+	char map[SNAPSHOT_MAP_COLUMNS + 1];
+} snapshot_level_t;
+
+static snapshot_level_t levels[SNAPSHOT_MAX_LEVELS];
+static unsigned long long int run_histogram[SNAPSHOT_MAX_LEVELS];
+static unsigned long long int usage[SNAPSHOT_MAP_COLUMNS];
+
+static unsigned char snapshot_get_byte(snapshot_reader_t *reader)
+{
+	if (reader->offset >= reader->size) {
+		reader->truncated = true;
+		return 0;
+	}
+	return reader->buffer[reader->offset++];
+}
+
+static unsigned long long int snapshot_get_u64(snapshot_reader_t *reader)
+{
+	unsigned long long int value = 0;
+
+	for (int i = 0; i < 8; ++i)
+		value |= (unsigned long long int)snapshot_get_byte(reader) << (i * 8);
+
+	return value;
+}
+
+static unsigned long long int snapshot_get_varint(snapshot_reader_t *reader)
+{
+	unsigned long long int value = 0;
+	unsigned char byte;
+	int shift = 0;
+
+	do {
+		byte = snapshot_get_byte(reader);
+		if (shift < 64)
+			value |= (unsigned long long int)(byte & 0x7f) << shift;
+		shift += 7;
+	} while ((byte & 0x80) && !reader->truncated);
+
+	return value;
+}
+
+static inline bool bit_is_set(const unsigned long long int *bits, unsigned long long int index)
+{
+	return (bits[index >> 6] >> (index & 63)) & 1;
+}
+
+static inline void bit_set(unsigned long long int *bits, unsigned long long int index)
+{
+	bits[index >> 6] |= 1ULL << (index & 63);
+}
+
+static int snapshot_decode(snapshot_t *snapshot, snapshot_reader_t *reader)
+{
+	unsigned long long int magic = snapshot_get_u64(reader);
+	unsigned long long int words;
+	unsigned long long int word = 0;
+	unsigned long long int zeros;
+	unsigned long long int literals;
+	unsigned long long int offset;
+
+	if ((magic & 0xffffffffULL) != BUDDY_SNAPSHOT_MAGIC) {
+		fprintf(stderr, "not a buddy allocator snapshot\n");
+		return -1;
+	}
+	if ((magic >> 32) < 1 || (magic >> 32) > BUDDY_SNAPSHOT_VERSION) {
+		fprintf(stderr, "unsupported snapshot version %llu\n", magic >> 32);
+		return -1;
+	}
+
+	/* Version 1 predates regions of any size, the region was the whole tree */
+	snapshot->address = snapshot_get_u64(reader);
+	snapshot->size = snapshot_get_u64(reader);
+	snapshot->region_size = (magic >> 32) > 1 ? snapshot_get_u64(reader) : snapshot->size;
+	snapshot->min_allocation = snapshot_get_u64(reader);
+	snapshot->max_level = snapshot_get_u64(reader);
+	snapshot->max_indexes = snapshot_get_u64(reader);
+	snapshot->available = snapshot_get_u64(reader);
+	if (reader->truncated || snapshot->max_level >= SNAPSHOT_MAX_LEVELS || snapshot->max_indexes != (2ULL << snapshot->max_level) ||
+		snapshot->region_size > snapshot->size) {
+		fprintf(stderr, "corrupt snapshot header\n");
+		return -1;
+	}
+
+	for (unsigned long long int level = 0; level < snapshot->max_level + 1; ++level)
+		snapshot->free_counts[level] = snapshot_get_varint(reader);
+
+	/* Expand the runs of the block index */
+	words = (snapshot->max_indexes + 63) / 64;
+	snapshot->block_index = calloc(words, sizeof(unsigned long long int));
+	snapshot->free_map = calloc(words, sizeof(unsigned long long int));
+	if (!snapshot->block_index || !snapshot->free_map) {
+		perror("out of memory");
+		return -1;
+	}
+	while (word < words && !reader->truncated) {
+		zeros = snapshot_get_varint(reader);
+		literals = snapshot_get_varint(reader);
+		if (zeros > words - word || literals > words - word - zeros) {
+			fprintf(stderr, "corrupt block index\n");
+			return -1;
+		}
+		word += zeros;
+		for (; literals > 0; --literals)
+			snapshot->block_index[word++] = snapshot_get_u64(reader);
+	}
+
+	/* Mark the free blocks */
+	for (unsigned long long int level = 0; level < snapshot->max_level + 1; ++level) {
+		for (unsigned long long int i = 0; i < snapshot->free_counts[level]; ++i) {
+			offset = snapshot_get_varint(reader);
+			if (offset >= (1ULL << level)) {
+				fprintf(stderr, "corrupt free block at level %llu\n", level);
+				return -1;
+			}
+			bit_set(snapshot->free_map, ((1ULL << level) - 1) + offset);
+		}
+	}
+
+	if (reader->truncated) {
+		fprintf(stderr, "truncated snapshot\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void snapshot_usage(const snapshot_t *snapshot, unsigned long long int start, unsigned long long int length)
+{
+	unsigned long long int column_size = snapshot->region_size / SNAPSHOT_MAP_COLUMNS;
+	unsigned long long int end = start + length;
+	unsigned long long int column_end;
+
+	/* Spread an allocated block over the columns it covers */
+	if (!column_size)
+		return;
+	while (start < end) {
+		column_end = ((start / column_size) + 1) * column_size;
+		if (column_end > end)
+			column_end = end;
+		usage[start / column_size] += column_end - start;
+		start = column_end;
+	}
+}
+
+static void snapshot_analyze(const snapshot_t *snapshot)
+{
+	unsigned long long int stack[SNAPSHOT_MAX_LEVELS + 1];
+	unsigned long long int index;
+	unsigned long long int level;
+	unsigned long long int block_size;
+	unsigned long long int offset;
+	unsigned long long int cells;
+	unsigned long long int cell;
+	unsigned long long int run = 0;
+	unsigned long long int largest_run = 0;
+	unsigned long long int largest_block = 0;
+	unsigned long long int total_free = 0;
+	unsigned long long int total_allocated = 0;
+	unsigned long long int total_reserved = 0;
+	unsigned long long int percent;
+	int depth = 0;
+
+	for (level = 0; level < snapshot->max_level + 1; ++level) {
+		cells = (1ULL << level) < SNAPSHOT_MAP_COLUMNS ? (1ULL << level) : SNAPSHOT_MAP_COLUMNS;
+		memset(levels[level].map, '.', cells);
+		levels[level].map[cells] = 0;
+	}
+
+	/* Visit the blocks depth first, left child first, which is address order */
+	stack[depth++] = 0;
+	while (depth > 0) {
+		index = stack[--depth];
+		level = 63 - __builtin_clzll(index + 1);
+
+		/* Split blocks, leaves are never split */
+		if (level < snapshot->max_level && bit_is_set(snapshot->block_index, (snapshot->max_indexes >> 1) + index)) {
+			stack[depth++] = (index << 1) + 2;
+			stack[depth++] = (index << 1) + 1;
+			continue;
+		}
+
+		block_size = snapshot->size >> level;
+		offset = (index - ((1ULL << level) - 1)) * block_size;
+		cells = (1ULL << level) < SNAPSHOT_MAP_COLUMNS ? (1ULL << level) : SNAPSHOT_MAP_COLUMNS;
+		cell = (offset * cells) / snapshot->size;
+
+		if (bit_is_set(snapshot->free_map, index)) {
+			++levels[level].free;
+			total_free += block_size;
+			if (block_size > largest_block)
+				largest_block = block_size;
+			if (levels[level].map[cell] != '#')
+				levels[level].map[cell] = 'o';
+			run += block_size;
+			continue;
+		}
+
+		/* The tree beyond the end of the region is kept in use for good, it ends the last free run */
+		if (offset >= snapshot->region_size) {
+			total_reserved += block_size;
+			continue;
+		}
+
+		/* Anything else is allocated, close the current free run */
+		++levels[level].allocated;
+		total_allocated += block_size;
+		levels[level].map[cell] = '#';
+		snapshot_usage(snapshot, offset, block_size);
+		if (run) {
+			++run_histogram[63 - __builtin_clzll(run)];
+			if (run > largest_run)
+				largest_run = run;
+			run = 0;
+		}
+	}
+	if (run) {
+		++run_histogram[63 - __builtin_clzll(run)];
+		if (run > largest_run)
+			largest_run = run;
+	}
+
+	/* Summary */
+	printf("region:       0x%llx, %llu bytes, %llu byte leaves, %llu levels\n", snapshot->address, snapshot->region_size, snapshot->min_allocation, snapshot->max_level + 1);
+	if (total_reserved)
+		printf("tree:         %llu bytes, %llu beyond the region kept in use\n", snapshot->size, total_reserved);
+	printf("allocated:    %llu bytes, %.1f%% of the region\n", total_allocated, snapshot->region_size ? (100.0 * total_allocated) / snapshot->region_size : 0.0);
+	printf("free:         %llu bytes, %.1f%% of the region, largest block %llu, largest run %llu\n", total_free,
+		snapshot->region_size ? (100.0 * total_free) / snapshot->region_size : 0.0, largest_block, largest_run);
+	if (total_free != snapshot->available)
+		printf("warning:      allocator reported %llu bytes free\n", snapshot->available);
+
+	/* Occupancy, one row per level with # for allocated and o for free blocks */
+	printf("\nlevel occupancy:\n%3s %12s %10s %10s\n", "", "size", "allocated", "free");
+	for (level = 0; level < snapshot->max_level + 1; ++level) {
+		if (levels[level].free != snapshot->free_counts[level])
+			printf("warning: level %llu has %llu free blocks, allocator counted %llu\n", level, levels[level].free, snapshot->free_counts[level]);
+		printf("%3llu %12llu %10llu %10llu |%s|\n", level, snapshot->size >> level, levels[level].allocated, levels[level].free, levels[level].map);
+	}
+
+	/* Allocated share of each slice of the region */
+	if (snapshot->region_size >= SNAPSHOT_MAP_COLUMNS) {
+		printf("\naddress usage:\n%37s|", "");
+		for (cell = 0; cell < SNAPSHOT_MAP_COLUMNS; ++cell) {
+			percent = (usage[cell] * 100) / (snapshot->region_size / SNAPSHOT_MAP_COLUMNS);
+			putchar(percent == 0 ? ' ' : percent < 25 ? '.' : percent < 50 ? ':' : percent < 100 ? '+' : '#');
+		}
+		printf("|\n");
+	}
+
+	/* Contiguous free runs, which can span buddies that cannot merge */
+	printf("\nfree runs:\n");
+	for (level = 0; level < SNAPSHOT_MAX_LEVELS; ++level)
+		if (run_histogram[level])
+			printf("%12llu - %-12llu %llu\n", 1ULL << level, (2ULL << level) - 1, run_histogram[level]);
+
+	/* Fragmentation, the share of free memory a request as large as all of it could not use */
+	printf("\nfragmentation: %.1f%% by block, %.1f%% by run\n", total_free ? (100.0 * (total_free - largest_block)) / total_free : 0.0,
+		total_free ? (100.0 * (total_free - largest_run)) / total_free : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+	snapshot_reader_t reader = { 0 };
+	snapshot_t snapshot = { 0 };
+	unsigned char *buffer;
+	long int size;
+	FILE *file;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <snapshot>\n", argv[0]);
+		return 2;
+	}
+
+	/* Slurp the file */
+	file = fopen(argv[1], "rb");
+	if (!file || fseek(file, 0, SEEK_END) || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET)) {
+		perror(argv[1]);
+		return 1;
+	}
+	buffer = malloc(size ? size : 1);
+	if (!buffer || fread(buffer, 1, size, file) != (size_t)size) {
+		perror(argv[1]);
+		return 1;
+	}
+	fclose(file);
+
+	reader.buffer = buffer;
+	reader.size = size;
+	if (snapshot_decode(&snapshot, &reader))
+		return 1;
+
+	printf("snapshot:     %s, %ld bytes\n", argv[1], size);
+	snapshot_analyze(&snapshot);
+
+	free(snapshot.block_index);
+	free(snapshot.free_map);
+	free(buffer);
+
+	return 0;
+}